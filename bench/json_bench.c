@@ -0,0 +1,208 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+/*
+ * Microbenchmark del manejo de la respuesta de /releases/latest.
+ *
+ * Genera JSON sintético de releases con muchos assets y notas largas, lo
+ * entrega en bloques como lo haría curl y compara:
+ *   - acumulación: strlen + realloc exacto + strncat (write_json original)
+ *     contra byte_buffer con crecimiento geométrico
+ *   - extracción: árbol completo de jansson contra el parser incremental
+ *
+ * Uso: json_bench [iteraciones]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jansson.h>
+
+#include "../buffer.h"
+#include "../release_json.h"
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Genera una release con 'assets' assets y 'notes' bytes de notas
+static char *make_release_json(int assets, size_t notes) {
+    byte_buffer buf;
+    byte_buffer_init(&buf);
+
+    char chunk[1024];
+    const char *head = "{\n  \"url\": \"https://api.github.com/repos/SplinterGU/ESPeccy/releases/1\",\n"
+                       "  \"author\": {\"login\": \"SplinterGU\", \"id\": 1, \"site_admin\": false},\n"
+                       "  \"tag_name\": \"v1.3.1\",\n  \"draft\": false,\n  \"body\": \"";
+    byte_buffer_append(&buf, head, strlen(head));
+
+    const char *line = "* Fixed \\\"something\\\" in the \\u00e1udio path\\r\\n";
+    for (size_t n = 0; n < notes; n += strlen(line)) byte_buffer_append(&buf, line, strlen(line));
+
+    byte_buffer_append(&buf, "\",\n  \"assets\": [", 16);
+    for (int i = 0; i < assets; i++) {
+        int len = snprintf(chunk, sizeof(chunk),
+            "%s\n    {\"url\": \"https://api.github.com/repos/SplinterGU/ESPeccy/releases/assets/%d\", \"id\": %d,"
+            " \"name\": \"asset_%04d.bin\", \"label\": null,"
+            " \"uploader\": {\"login\": \"SplinterGU\", \"id\": 1, \"type\": \"User\"},"
+            " \"content_type\": \"application/octet-stream\", \"state\": \"uploaded\", \"size\": %d,"
+            " \"download_count\": %d, \"created_at\": \"2025-01-01T00:00:00Z\","
+            " \"browser_download_url\": \"https://github.com/SplinterGU/ESPeccy/releases/download/v1.3.1/asset_%04d.bin\"}",
+            i ? "," : "", i, i, i, 4194304 + i, i * 7, i);
+        byte_buffer_append(&buf, chunk, len);
+    }
+    byte_buffer_append(&buf, "\n  ]\n}\n", 7);
+
+    return buf.data;
+}
+
+// write_json original: strlen en cada bloque, realloc exacto y strncat
+static char *legacy_accumulate(const char *json, size_t len, size_t chunk) {
+    char *response = malloc(1);
+    response[0] = '\0';
+
+    for (size_t off = 0; off < len; off += chunk) {
+        size_t real_size = (len - off < chunk) ? len - off : chunk;
+        int curr_size = strlen(response);
+        response = realloc(response, curr_size + real_size + 1);
+        strncat(response, json + off, real_size);
+    }
+    return response;
+}
+
+static byte_buffer buffer_accumulate(const char *json, size_t len, size_t chunk) {
+    byte_buffer buf;
+    byte_buffer_init(&buf);
+    for (size_t off = 0; off < len; off += chunk) {
+        size_t real_size = (len - off < chunk) ? len - off : chunk;
+        byte_buffer_append(&buf, json + off, real_size);
+    }
+    return buf;
+}
+
+static int jansson_extract(const char *json, size_t len, release_info *info) {
+    json_error_t error;
+    json_t *root = json_loadb(json, len, 0, &error);
+    if (!root) return -1;
+
+    snprintf(info->tag, sizeof(info->tag), "%s", json_string_value(json_object_get(root, "tag_name")));
+    info->asset_count = 0;
+
+    size_t index;
+    json_t *asset;
+    json_array_foreach(json_object_get(root, "assets"), index, asset) {
+        if (info->asset_count == RELEASE_MAX_ASSETS) break;
+        release_asset *dest = &info->assets[info->asset_count++];
+        snprintf(dest->name, sizeof(dest->name), "%s", json_string_value(json_object_get(asset, "name")));
+        snprintf(dest->url, sizeof(dest->url), "%s", json_string_value(json_object_get(asset, "browser_download_url")));
+    }
+
+    json_decref(root);
+    return 0;
+}
+
+static int stream_extract(const char *json, size_t len, size_t chunk, release_info *info) {
+    release_parser parser;
+    release_parser_init(&parser, info);
+    for (size_t off = 0; off < len; off += chunk) {
+        size_t real_size = (len - off < chunk) ? len - off : chunk;
+        release_parser_feed(&parser, json + off, real_size);
+    }
+    return release_parser_finish(&parser);
+}
+
+static int same_release(const release_info *a, const release_info *b) {
+    if (strcmp(a->tag, b->tag) || a->asset_count != b->asset_count) return 0;
+    for (int i = 0; i < a->asset_count; i++) {
+        if (strcmp(a->assets[i].name, b->assets[i].name) || strcmp(a->assets[i].url, b->assets[i].url)) return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+    if (iterations < 1) iterations = 1;
+
+    static const struct { int assets; size_t notes; } sizes[] = {
+        { 8, 4 * 1024 }, { 64, 32 * 1024 }, { 64, 256 * 1024 }, { 64, 1024 * 1024 }
+    };
+    static const size_t chunks[] = { 1024, 16384 };
+
+    static release_info a, b;
+
+    printf("%-10s %-8s %-7s %14s %14s %14s %14s\n",
+           "json", "assets", "chunk", "legacy ms", "buffer ms", "jansson ms", "stream ms");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        char *json = make_release_json(sizes[s].assets, sizes[s].notes);
+        size_t len = strlen(json);
+
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            size_t chunk = chunks[c];
+            double t_legacy = 0, t_buffer = 0, t_jansson = 0, t_stream = 0;
+
+            for (int i = 0; i < iterations; i++) {
+                double t0 = now_ms();
+                char *legacy = legacy_accumulate(json, len, chunk);
+                double t1 = now_ms();
+                byte_buffer buf = buffer_accumulate(json, len, chunk);
+                double t2 = now_ms();
+                int ja = jansson_extract(buf.data, buf.len, &a);
+                double t3 = now_ms();
+                int st = stream_extract(json, len, chunk, &b);
+                double t4 = now_ms();
+
+                if (strcmp(legacy, buf.data) != 0 || ja != 0 || st != 0 || !same_release(&a, &b)) {
+                    fprintf(stderr, "results differ!\n");
+                    return 1;
+                }
+
+                free(legacy);
+                byte_buffer_free(&buf);
+
+                t_legacy += t1 - t0;
+                t_buffer += t2 - t1;
+                t_jansson += t3 - t2;
+                t_stream += t4 - t3;
+            }
+
+            char size_label[32];
+            snprintf(size_label, sizeof(size_label), "%zuK", len / 1024);
+            printf("%-10s %-8d %-7zu %14.3f %14.3f %14.3f %14.3f\n", size_label, sizes[s].assets, chunk,
+                   t_legacy / iterations, t_buffer / iterations, t_jansson / iterations, t_stream / iterations);
+        }
+        free(json);
+    }
+
+    return 0;
+}
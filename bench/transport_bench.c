@@ -0,0 +1,193 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+/*
+ * Microbenchmark del transporte serie sobre un par pty.
+ *
+ * Un hilo hace de dispositivo en el lado maestro del pty y devuelve todo lo
+ * que recibe; el transporte abre el lado esclavo como si fuera un adaptador
+ * USB-serie. Para tramas del tamaño de un SYNC, de un bloque de flash y de
+ * varios buffers de salida, mide la ida y vuelta completa (escritura agrupada
+ * en paquetes, poll, lectura) y comprueba que vuelva intacta. También prueba
+ * una velocidad fuera de las constantes B* (termios2/BOTHER en Linux).
+ *
+ * No hace falta hardware: un pty no tiene latency timer ni UART, así que lo
+ * que se mide es el costo del camino por el kernel y por el transporte.
+ *
+ * Uso: transport_bench [iteraciones]
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../transport.h"
+
+#define ODD_BAUD        1234567
+
+static volatile int stop = 0;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Dispositivo: devuelve por el maestro todo lo que llega
+static void *echo_thread(void *arg) {
+    int master = *(int *)arg;
+    unsigned char buf[4096];
+
+    while (!stop) {
+        struct pollfd pfd = { .fd = master, .events = POLLIN };
+        if (poll(&pfd, 1, 50) <= 0) continue;
+
+        ssize_t n = read(master, buf, sizeof(buf));
+        if (n <= 0) continue;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(master, buf + done, (size_t)(n - done));
+            if (w > 0) done += w;
+            else if (errno != EAGAIN && errno != EINTR) return NULL;
+        }
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Ida y vuelta de una trama de size bytes; devuelve los microsegundos o -1 si no volvió igual
+static double round_trip(transport *t, const unsigned char *frame, unsigned char *back, size_t size) {
+    double start = now_us();
+
+    if (transport_write(t, frame, size, NULL) != 0 || transport_flush(t, NULL) != 0) return -1;
+
+    size_t got = 0;
+    while (got < size) {
+        int n = transport_read(t, back + got, size - got, 1000);
+        if (n <= 0) return -1;
+        got += (size_t)n;
+    }
+
+    double us = now_us() - start;
+    return memcmp(frame, back, size) == 0 ? us : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    if (iterations < 1) iterations = 1;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    const char *slave = ptsname(master);
+    transport t;
+    if (!slave || transport_open(&t, slave) != 0) {
+        fprintf(stderr, "Can't open the pty slave\n");
+        return 1;
+    }
+
+    int baud_ok = transport_set_baud(&t, ODD_BAUD) == 0;
+    printf("pty %s: low latency %s, %d baud %s\n", slave,
+           t.low_latency ? "on" : "not supported", ODD_BAUD, baud_ok ? "accepted" : "rejected");
+
+    pthread_t echo;
+    pthread_create(&echo, NULL, echo_thread, &master);
+
+    static const struct {
+        const char *name;
+        size_t      size;
+    } frames[] = {
+        { "sync",   46 },                           // SYNC con su cabecera SLIP
+        { "block",  1024 + 16 + 8 + 2 + 32 },       // FLASH_DATA de 1 KB con algunos escapes
+        { "large",  3 * TRANSPORT_TX_SIZE + 100 },  // cruza varias veces el buffer de salida
+    };
+
+    unsigned char *frame = malloc(frames[2].size);
+    unsigned char *back = malloc(frames[2].size);
+    double *samples = malloc(iterations * sizeof(double));
+    if (!frame || !back || !samples) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < frames[2].size; i++) frame[i] = (unsigned char)(i * 131 + 7);
+
+    int failed = 0;
+    printf("\n%-8s %8s %12s %10s %10s %10s\n", "frame", "bytes", "median us", "p99 us", "max us", "MB/s");
+    for (size_t f = 0; f < sizeof(frames) / sizeof(frames[0]); f++) {
+        int count = 0;
+        for (int i = 0; i < iterations; i++) {
+            double us = round_trip(&t, frame, back, frames[f].size);
+            if (us < 0) {
+                failed++;
+                transport_discard_input(&t);
+                continue;
+            }
+            samples[count++] = us;
+        }
+        if (count == 0) {
+            printf("%-8s %8zu %12s\n", frames[f].name, frames[f].size, "failed");
+            continue;
+        }
+
+        qsort(samples, count, sizeof(double), compare_double);
+        double median = samples[count / 2];
+        printf("%-8s %8zu %12.1f %10.1f %10.1f %10.2f\n", frames[f].name, frames[f].size, median,
+               samples[count * 99 / 100], samples[count - 1], 2.0 * frames[f].size / median);
+    }
+
+    stop = 1;
+    pthread_join(echo, NULL);
+    transport_close(&t);
+    close(master);
+    free(samples);
+    free(back);
+    free(frame);
+
+    if (failed || !baud_ok) {
+        printf("\n%d round trips failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+/*
+ * Buffer de bytes que crece de forma geométrica y conoce su longitud.
+ * El contenido siempre termina en '\0' para poder usarlo como cadena.
+ */
+typedef struct {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+} byte_buffer;
+
+void byte_buffer_init(byte_buffer *buf);
+
+/**
+ * @brief Agrega bytes al final del buffer.
+ *
+ * @return 0 si se agregaron, -1 si no hay memoria.
+ */
+int byte_buffer_append(byte_buffer *buf, const void *data, size_t len);
+
+void byte_buffer_free(byte_buffer *buf);
+
+#endif // BUFFER_H
@@ -0,0 +1,390 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <direct.h>
+    #include <process.h>
+    #define make_dir(path)  _mkdir(path)
+    #define getpid          _getpid
+#else
+    #include <unistd.h>
+    #define make_dir(path)  mkdir(path, 0755)
+#endif
+
+#include "cache.h"
+
+static char cache_root[1024];
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int temp_counter = 0;
+
+// Crea un directorio y todos sus padres
+static int make_dirs(const char *path) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            char c = *p;
+            *p = '\0';
+            if (make_dir(tmp) != 0 && errno != EEXIST) return -1;
+            *p = c;
+        }
+    }
+    if (make_dir(tmp) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+static void init_cache_dir(void) {
+    const char *dir = getenv("ESPECCY_CACHE_DIR");
+    char path[1024];
+
+    if (dir && *dir) {
+        snprintf(path, sizeof(path), "%s", dir);
+    } else {
+#if defined(_WIN32) || defined(_WIN64)
+        const char *base = getenv("LOCALAPPDATA");
+        if (!base) return;
+        snprintf(path, sizeof(path), "%s\\especcy_flash_tool", base);
+#else
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if (xdg && *xdg) {
+            snprintf(path, sizeof(path), "%s/especcy_flash_tool", xdg);
+        } else if (home && *home) {
+            snprintf(path, sizeof(path), "%s/.cache/especcy_flash_tool", home);
+        } else {
+            return;
+        }
+#endif
+    }
+
+    char objects[1100], releases[1100], partial[1100];
+    snprintf(objects, sizeof(objects), "%s/objects", path);
+    snprintf(releases, sizeof(releases), "%s/releases", path);
+    snprintf(partial, sizeof(partial), "%s/partial", path);
+    // Sin directorio cache_dir() devuelve NULL y quien descarga lo informa
+    if (make_dirs(objects) != 0 || make_dirs(releases) != 0 || make_dirs(partial) != 0) return;
+
+    snprintf(cache_root, sizeof(cache_root), "%s", path);
+}
+
+const char *cache_dir(void) {
+    pthread_once(&cache_once, init_cache_dir);
+    return cache_root[0] ? cache_root : NULL;
+}
+
+static void object_path(const char *sha256, char *path, size_t size) {
+    snprintf(path, size, "%s/objects/%s", cache_root, sha256);
+}
+
+// Los campos vacíos se guardan como "-" para mantener el formato por columnas
+static const char *field_out(const char *value) {
+    return (value && *value) ? value : "-";
+}
+
+static void field_in(char *dest, size_t size, const char *value) {
+    snprintf(dest, size, "%s", strcmp(value, "-") == 0 ? "" : value);
+}
+
+// Separa una línea del índice en sus 7 campos (modifica la línea)
+static int split_line(char *line, char *fields[7]) {
+    line[strcspn(line, "\r\n")] = '\0';
+    int n = 0;
+    char *p = line;
+    while (n < 7) {
+        fields[n++] = p;
+        p = strchr(p, '\t');
+        if (!p) break;
+        *p++ = '\0';
+    }
+    return n == 7 ? 0 : -1;
+}
+
+int cache_lookup(const char *repo, const char *tag, const char *asset, cache_entry *entry) {
+    if (!cache_dir()) return 1;
+
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/index", cache_root);
+
+    pthread_mutex_lock(&index_lock);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        pthread_mutex_unlock(&index_lock);
+        return 1;
+    }
+
+    int found = 0;
+    char line[2048];
+    while (fgets(line, sizeof(line), fp)) {
+        char *f[7];
+        if (split_line(line, f) != 0) continue;
+        if (strcmp(f[0], repo) || strcmp(f[1], tag) || strcmp(f[2], asset)) continue;
+
+        snprintf(entry->sha256, sizeof(entry->sha256), "%s", f[3]);
+        entry->size = atoll(f[4]);
+        field_in(entry->etag, sizeof(entry->etag), f[5]);
+        field_in(entry->last_modified, sizeof(entry->last_modified), f[6]);
+        found = 1;
+    }
+    fclose(fp);
+    pthread_mutex_unlock(&index_lock);
+
+    if (!found) return 1;
+
+    // El objeto tiene que existir y tener el tamaño registrado
+    struct stat st;
+    object_path(entry->sha256, path, sizeof(path));
+    if (stat(path, &st) != 0 || (long long)st.st_size != entry->size) return 1;
+
+    return 0;
+}
+
+// Reemplaza los caracteres que no sirven en un nombre de archivo
+static void safe_name(char *name) {
+    for (char *p = name; *p; p++) {
+        if (*p == '/' || *p == '\\' || *p == ':' || *p == '\t') *p = '_';
+    }
+}
+
+int cache_partial_path(const char *repo, const char *tag, const char *asset, char *path, size_t size) {
+    if (!cache_dir()) return 1;
+
+    char name[512];
+    snprintf(name, sizeof(name), "%s_%s_%s", repo, tag, asset);
+    safe_name(name);
+
+    snprintf(path, size, "%s/partial/%s", cache_root, name);
+    return 0;
+}
+
+// Reescribe el índice reemplazando la entrada de repo/tag/asset
+static int update_index(const char *repo, const char *tag, const char *asset, const cache_entry *entry) {
+    char path[1100], temp[1200];
+    snprintf(path, sizeof(path), "%s/index", cache_root);
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *out = fopen(temp, "w");
+    if (!out) return 1;
+
+    FILE *in = fopen(path, "r");
+    if (in) {
+        char line[2048], copy[2048];
+        while (fgets(line, sizeof(line), in)) {
+            char *f[7];
+            snprintf(copy, sizeof(copy), "%s", line);
+            if (split_line(copy, f) != 0) continue;
+            if (!strcmp(f[0], repo) && !strcmp(f[1], tag) && !strcmp(f[2], asset)) continue;
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s\t%s\t%s\t%s\t%lld\t%s\t%s\n", repo, tag, asset, entry->sha256, entry->size,
+            field_out(entry->etag), field_out(entry->last_modified));
+
+    if (fclose(out) != 0) {
+        remove(temp);
+        return 1;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    remove(path);
+#endif
+    if (rename(temp, path) != 0) {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+int cache_store(const char *repo, const char *tag, const char *asset, const char *temp_path, const cache_entry *entry) {
+    if (!cache_dir()) {
+        remove(temp_path);
+        return 1;
+    }
+
+    char path[1100];
+    object_path(entry->sha256, path, sizeof(path));
+
+    // Mismo contenido, mismo objeto: si ya existe basta con el índice
+    struct stat st;
+    if (stat(path, &st) == 0 && (long long)st.st_size == entry->size) {
+        remove(temp_path);
+    } else {
+#if defined(_WIN32) || defined(_WIN64)
+        remove(path);
+#endif
+        if (rename(temp_path, path) != 0) {
+            remove(temp_path);
+            return 1;
+        }
+    }
+
+    pthread_mutex_lock(&index_lock);
+    int ret = update_index(repo, tag, asset, entry);
+    pthread_mutex_unlock(&index_lock);
+
+    return ret;
+}
+
+int cache_materialize(const char *sha256, const char *dest) {
+    if (!cache_dir()) return 1;
+
+    char path[1100];
+    object_path(sha256, path, sizeof(path));
+
+    remove(dest);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    // Un enlace duro evita copiar el contenido
+    if (link(path, dest) == 0) return 0;
+#endif
+
+    FILE *in = fopen(path, "rb");
+    if (!in) return 1;
+
+    FILE *out = fopen(dest, "wb");
+    if (!out) {
+        fclose(in);
+        return 1;
+    }
+
+    char buffer[65536];
+    size_t n;
+    int ret = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            ret = 1;
+            break;
+        }
+    }
+
+    fclose(in);
+    if (fclose(out) != 0) ret = 1;
+    if (ret) remove(dest);
+
+    return ret;
+}
+
+// Archivo de metadatos de un repositorio ("owner/repo" -> "owner_repo")
+static void release_path(const char *repo, char *path, size_t size) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s", repo);
+    safe_name(name);
+    snprintf(path, size, "%s/releases/%s", cache_root, name);
+}
+
+int cache_load_release(const char *repo, release_info *info, long *age) {
+    if (!cache_dir()) return 1;
+
+    char path[1400];
+    release_path(repo, path, sizeof(path));
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 1;
+
+    long long fetched = -1;
+    char line[1024];
+
+    info->tag[0] = '\0';
+    info->asset_count = 0;
+
+    // Formato: "fetched <unix time>", "tag <tag>" y "asset <nombre>\t<url>[\t<digest>]"
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "fetched ", 8) == 0) {
+            fetched = atoll(line + 8);
+        } else if (strncmp(line, "tag ", 4) == 0) {
+            snprintf(info->tag, sizeof(info->tag), "%s", line + 4);
+        } else if (strncmp(line, "asset ", 6) == 0 && info->asset_count < RELEASE_MAX_ASSETS) {
+            char *url = strchr(line + 6, '\t');
+            if (!url) continue;
+            *url++ = '\0';
+            char *digest = strchr(url, '\t');
+            if (digest) *digest++ = '\0';
+            release_asset *asset = &info->assets[info->asset_count++];
+            snprintf(asset->name, sizeof(asset->name), "%s", line + 6);
+            snprintf(asset->url, sizeof(asset->url), "%s", url);
+            snprintf(asset->digest, sizeof(asset->digest), "%s", digest ? digest : "");
+        }
+    }
+    fclose(fp);
+
+    if (fetched < 0 || !info->tag[0]) return 1;
+
+    *age = (long)((long long)time(NULL) - fetched);
+    return 0;
+}
+
+int cache_store_release(const char *repo, const release_info *info) {
+    if (!cache_dir()) return 1;
+
+    char path[1400], temp[1500];
+    release_path(repo, path, sizeof(path));
+
+    pthread_mutex_lock(&index_lock);
+    unsigned int n = ++temp_counter;
+    pthread_mutex_unlock(&index_lock);
+    snprintf(temp, sizeof(temp), "%s.%d.%u.tmp", path, (int)getpid(), n);
+
+    FILE *fp = fopen(temp, "w");
+    if (!fp) return 1;
+
+    fprintf(fp, "fetched %lld\n", (long long)time(NULL));
+    fprintf(fp, "tag %s\n", info->tag);
+    for (int i = 0; i < info->asset_count; i++) {
+        const release_asset *asset = &info->assets[i];
+        if (asset->digest[0]) fprintf(fp, "asset %s\t%s\t%s\n", asset->name, asset->url, asset->digest);
+        else fprintf(fp, "asset %s\t%s\n", asset->name, asset->url);
+    }
+
+    if (fclose(fp) != 0) {
+        remove(temp);
+        return 1;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    remove(path);
+#endif
+    if (rename(temp, path) != 0) {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "release_json.h"
+
+/*
+ * Caché local de artefactos descargados y de metadatos de release.
+ *
+ * Los archivos se guardan por contenido en <cache>/objects/<sha256> y un índice
+ * de texto (<cache>/index) relaciona repo, tag y asset con el objeto y con los
+ * validadores HTTP (ETag / Last-Modified) de la última descarga. Los metadatos
+ * de la última release de cada repositorio se guardan en <cache>/releases.
+ *
+ * El directorio se toma de ESPECCY_CACHE_DIR, o de $XDG_CACHE_HOME/especcy_flash_tool,
+ * o de ~/.cache/especcy_flash_tool (%LOCALAPPDATA%\especcy_flash_tool en Windows).
+ */
+
+typedef struct {
+    char        sha256[65];
+    long long   size;
+    char        etag[128];
+    char        last_modified[64];
+} cache_entry;
+
+/**
+ * @brief Devuelve el directorio de la caché, creándolo si no existe.
+ *
+ * @return Ruta del directorio, o NULL si no se pudo crear.
+ */
+const char *cache_dir(void);
+
+/**
+ * @brief Busca un artefacto en el índice.
+ *
+ * @return 0 si la entrada existe y su objeto está en la caché, 1 si no.
+ */
+int cache_lookup(const char *repo, const char *tag, const char *asset, cache_entry *entry);
+
+/**
+ * @brief Ruta fija del archivo parcial de una descarga dentro de la caché.
+ *
+ * Al ser siempre la misma para repo/tag/asset, una descarga interrumpida se
+ * puede reanudar en la siguiente ejecución.
+ *
+ * @return 0 si la caché está disponible.
+ */
+int cache_partial_path(const char *repo, const char *tag, const char *asset, char *path, size_t size);
+
+/**
+ * @brief Mueve un archivo descargado a su objeto y actualiza el índice.
+ *
+ * @return 0 si se guardó, 1 si falló (el temporal se elimina igualmente).
+ */
+int cache_store(const char *repo, const char *tag, const char *asset, const char *temp_path, const cache_entry *entry);
+
+/**
+ * @brief Copia (o enlaza) un objeto de la caché al destino indicado.
+ *
+ * @return 0 si el destino quedó con el contenido del objeto.
+ */
+int cache_materialize(const char *sha256, const char *dest);
+
+/**
+ * @brief Carga los metadatos de release guardados para un repositorio.
+ *
+ * @param age Recibe la antigüedad de los datos en segundos.
+ * @return 0 si hay metadatos en la caché, 1 si no.
+ */
+int cache_load_release(const char *repo, release_info *info, long *age);
+
+/**
+ * @brief Guarda los metadatos de release de un repositorio con la hora actual.
+ *
+ * @return 0 si se guardaron.
+ */
+int cache_store_release(const char *repo, const release_info *info);
+
+#endif // CACHE_H
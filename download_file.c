@@ -28,44 +28,86 @@
  *
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <curl/curl.h>
 #include <jansson.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "buffer.h"
+#include "cache.h"
+#include "download_file.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "release_json.h"
+#include "transfer.h"
+
+// Respuesta de la API: se guarda completa (para jansson) y a la vez se pasa
+// por el parser incremental, que suele bastar para obtener los datos
+typedef struct {
+    byte_buffer     buffer;
+    release_parser  parser;
+} json_response;
+
 // Callback para recibir los datos JSON de la API de GitHub y almacenarlos en memoria
 size_t write_json(void *ptr, size_t size, size_t nmemb, void *data) {
     size_t real_size = size * nmemb;
-    char **response = (char **)data;
-    int curr_size = strlen(*response);
+    json_response *response = (json_response *)data;
 
-    *response = realloc(*response, curr_size + real_size + 1);
-    if (*response == NULL) {
-        printf("not enough memory!\n");
-        return 0;
-    }
+    // Sin memoria curl corta con CURLE_WRITE_ERROR y fetch_release_info() lo informa
+    if (byte_buffer_append(&response->buffer, ptr, real_size) != 0) return 0;
 
-    strncat(*response, ptr, real_size);
+    release_parser_feed(&response->parser, ptr, real_size);
     return real_size;
 }
 
-// Función para obtener la URL de la última release de GitHub
-int fetch_latest_release_url(const char *repo, char *download_url, const char *asset_name, char *release_tag) {
+// Inicialización global de libcurl (antes de lanzar descargas en paralelo)
+int download_global_init(void) {
+    return curl_global_init(CURL_GLOBAL_DEFAULT) == CURLE_OK ? 0 : 1;
+}
+
+// Configuración actual de las descargas
+static download_config config = { NULL, RELEASE_TTL_DEFAULT, 0, TRANSFER_CONNECTIONS_DEFAULT, 0 };
+
+void download_configure(const download_config *cfg) {
+    config = *cfg;
+}
+
+static const char *api_base_url(void) {
+    if (config.api_url && *config.api_url) return config.api_url;
+
+    const char *api_base = getenv("ESPECCY_API_URL");
+    return (api_base && *api_base) ? api_base : GITHUB_API_URL;
+}
+
+// Consulta la API de GitHub y extrae el tag y los assets de la última release
+static int fetch_release_info(const char *repo, release_info *info, const volatile int *cancel, const log_sink *log) {
     CURL *curl;
     CURLcode res;
-    char *response = malloc(1);  // Reserva inicial para la respuesta
-    response[0] = '\0';  // Asegura que la cadena esté vacía
+    json_response response;
     char api_url[512];
 
+    byte_buffer_init(&response.buffer);
+    release_parser_init(&response.parser, info);
+
     // Construir la URL de la API para obtener la última release
-    snprintf(api_url, sizeof(api_url), "https://api.github.com/repos/%s/releases/latest", repo);
+    snprintf(api_url, sizeof(api_url), "%s/repos/%s/releases/latest", api_base_url(), repo);
 
     // Inicializar libcurl
     curl = curl_easy_init();
     if (!curl) {
-        fprintf(stderr, "comm error!\n");
-        free(response);
+        log_message(log, LOG_SINK_ERROR, "comm error!");
         return 1;
     }
 
@@ -74,10 +116,8 @@ int fetch_latest_release_url(const char *repo, char *download_url, const char *a
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_json);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");  // Para evitar problemas con la API de GitHub
-
-    // Deshabilitar la verificación del certificado SSL
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);  // No verificar el certificado del servidor
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);  // No verificar el nombre del host
+    transfer_set_cancel(curl, cancel);
+    transfer_set_tls(curl, config.insecure);
 
     // Realizar la solicitud
     res = curl_easy_perform(curl);
@@ -85,139 +125,370 @@ int fetch_latest_release_url(const char *repo, char *download_url, const char *a
     // Comprobar si la solicitud fue exitosa
     long http_code = 0;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_cleanup(curl);
     if (res != CURLE_OK || http_code != 200) {
-        fprintf(stderr, "error getting last release %ld (%s)\n", http_code, curl_easy_strerror(res));
-        free(response);
-        curl_easy_cleanup(curl);
+        if (res != CURLE_ABORTED_BY_CALLBACK) log_message(log, LOG_SINK_ERROR, "error getting last release %ld (%s)", http_code, curl_easy_strerror(res));
+        byte_buffer_free(&response.buffer);
         return 1;
     }
 
-    // Parsear el JSON para obtener la URL de descarga
+    // El parser incremental ya extrajo los datos mientras llegaba la respuesta
+    if (release_parser_finish(&response.parser) == 0) {
+        byte_buffer_free(&response.buffer);
+        return 0;
+    }
+
+    // Si no pudo, parsear el JSON completo con jansson
     json_t *root;
     json_error_t error;
-    root = json_loads(response, 0, &error);
+    root = json_loadb(response.buffer.data ? response.buffer.data : "", response.buffer.len, 0, &error);
+    byte_buffer_free(&response.buffer);
 
     if (!root) {
-        fprintf(stderr, "json parser error: %s\n", error.text);
-        free(response);
-        curl_easy_cleanup(curl);
+        log_message(log, LOG_SINK_ERROR, "json parser error: %s", error.text);
         return 1;
     }
 
     // Obtener el tag de la release
     json_t *tag = json_object_get(root, "tag_name");
     if (json_is_string(tag)) {
-        snprintf(release_tag, 128, "%s", json_string_value(tag)); // Asume que release_tag tiene suficiente espacio
+        snprintf(info->tag, sizeof(info->tag), "%s", json_string_value(tag));
     } else {
-        fprintf(stderr, "Error: tag_name not found in the release data\n");
+        log_message(log, LOG_SINK_ERROR, "Error: tag_name not found in the release data");
         json_decref(root);
-        free(response);
-        curl_easy_cleanup(curl);
         return 1;
     }
 
-    // Buscar el asset que nos interesa (archivo .bin)
     json_t *assets = json_object_get(root, "assets");
     if (!json_is_array(assets)) {
-        fprintf(stderr, "Error: no assets for download in this release\n");
+        log_message(log, LOG_SINK_ERROR, "Error: no assets for download in this release");
         json_decref(root);
-        free(response);
-        curl_easy_cleanup(curl);
         return 1;
     }
 
-    // Recorrer los assets y buscar el archivo .bin
+    // Guardar nombre, URL y digest de todos los assets
     size_t index;
     json_t *asset;
+    info->asset_count = 0;
     json_array_foreach(assets, index, asset) {
         const char *name = json_string_value(json_object_get(asset, "name"));
-        if (strstr(name, asset_name)) {
-            const char *url = json_string_value(json_object_get(asset, "browser_download_url"));
-            snprintf(download_url, 512, "%s", url);
-            break;
-        }
+        const char *url = json_string_value(json_object_get(asset, "browser_download_url"));
+        const char *digest = json_string_value(json_object_get(asset, "digest"));
+        if (!name || !url || info->asset_count == RELEASE_MAX_ASSETS) continue;
+
+        release_asset *dest = &info->assets[info->asset_count++];
+        snprintf(dest->name, sizeof(dest->name), "%s", name);
+        snprintf(dest->url, sizeof(dest->url), "%s", url);
+        snprintf(dest->digest, sizeof(dest->digest), "%s", digest ? digest : "");
     }
 
     json_decref(root);
-    free(response);
-    curl_easy_cleanup(curl);
+    return 0;
+}
+
+// Archivos de checksums que acompañan a los artefactos en una release
+static int is_checksum_name(const char *name) {
+    size_t len = strlen(name);
+    return (len > 7 && strcasecmp(name + len - 7, ".sha256") == 0) ||
+           strcasecmp(name, "SHA256SUMS") == 0 || strcasecmp(name, "SHA256SUMS.txt") == 0;
+}
 
+// Copia los 64 dígitos hex de un SHA-256 en minúsculas; 0 si el texto empieza con uno
+static int parse_sha256(const char *text, char *hex) {
+    for (int i = 0; i < 64; i++) {
+        if (!isxdigit((unsigned char)text[i])) return 1;
+        hex[i] = (char)tolower((unsigned char)text[i]);
+    }
+    if (isxdigit((unsigned char)text[64])) return 1;
+    hex[64] = '\0';
     return 0;
 }
 
-// Callback para escribir datos binarios en el archivo
-size_t write_data(void *ptr, size_t size, size_t nmemb, void *data) {
+/*
+ * Busca el hash de asset_name en un archivo de checksums con líneas
+ * "<hex>  <nombre>" (formato de sha256sum) o con el hash solo.
+ */
+static int parse_checksums(char *text, const char *asset_name, char *hex) {
+    for (char *line = strtok(text, "\r\n"); line; line = strtok(NULL, "\r\n")) {
+        while (*line == ' ' || *line == '\t') line++;
+        char candidate[65];
+        if (parse_sha256(line, candidate) != 0) continue;
+
+        const char *name = line + 64;
+        while (*name == ' ' || *name == '\t' || *name == '*') name++;
+        if (!*name || strcmp(name, asset_name) == 0) {
+            memcpy(hex, candidate, sizeof(candidate));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static size_t write_text(void *ptr, size_t size, size_t nmemb, void *data) {
     size_t real_size = size * nmemb;
-    FILE *fp = (FILE *)data;
+    return byte_buffer_append((byte_buffer *)data, ptr, real_size) == 0 ? real_size : 0;
+}
+
+// Descarga un archivo de checksums y extrae el hash de asset_name
+static int fetch_sidecar_digest(const char *url, const char *asset_name, char *hex, const volatile int *cancel) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return 1;
 
-    // Escribir los datos binarios directamente al archivo
-    size_t written = fwrite(ptr, size, nmemb, fp);
+    byte_buffer text;
+    byte_buffer_init(&text);
 
-    printf(".");
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_text);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &text);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+    transfer_set_cancel(curl, cancel);
+    transfer_set_tls(curl, config.insecure);
+
+    CURLcode res = curl_easy_perform(curl);
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_cleanup(curl);
 
-    return written;
+    int ret = 1;
+    if (res == CURLE_OK && http_code == 200 && byte_buffer_append(&text, "", 1) == 0) {
+        ret = parse_checksums((char *)text.data, asset_name, hex);
+    }
+    byte_buffer_free(&text);
+    return ret;
+}
+
+/*
+ * Obtiene el SHA-256 publicado para un asset: el "digest" que da la API o,
+ * si no está, el de un "<asset>.sha256" o "SHA256SUMS" de la misma release.
+ * Un hash sacado de un archivo de checksums se guarda en el asset para no
+ * volver a pedirlo mientras los metadatos sigan en la caché.
+ */
+static int asset_digest(const char *repo, release_info *info, release_asset *asset, char *hex, int fresh,
+                        const volatile int *cancel) {
+    if (strncasecmp(asset->digest, "sha256:", 7) == 0 && parse_sha256(asset->digest + 7, hex) == 0) return 0;
+    if (config.offline) return 1;
+
+    char sidecar[sizeof(asset->name) + 8];
+    snprintf(sidecar, sizeof(sidecar), "%s.sha256", asset->name);
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < info->asset_count; i++) {
+            const char *name = info->assets[i].name;
+            int match = pass == 0 ? strcasecmp(name, sidecar) == 0
+                                  : (strcasecmp(name, "SHA256SUMS") == 0 || strcasecmp(name, "SHA256SUMS.txt") == 0);
+            if (!match || fetch_sidecar_digest(info->assets[i].url, asset->name, hex, cancel) != 0) continue;
+
+            snprintf(asset->digest, sizeof(asset->digest), "sha256:%s", hex);
+            if (fresh) cache_store_release(repo, info);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Función para obtener la URL de la última release de GitHub.
+// Usa los metadatos de la caché mientras no superen el TTL; en modo offline
+// nunca consulta la API. sha256 recibe el hash publicado del asset, o queda
+// vacío si la release no publica ninguno.
+int fetch_latest_release_url(const char *repo, char *download_url, const char *asset_name, char *release_tag,
+                             char *sha256, const volatile int *cancel, const log_sink *log) {
+    release_info *info = malloc(sizeof(release_info));
+    if (!info) return 1;
+
+    long age = -1;
+    int cached = cache_load_release(repo, info, &age) == 0;
+    int fetched = 0;
+
+    if (config.offline) {
+        if (!cached) {
+            log_message(log, LOG_SINK_ERROR, "No cached release data for %s (offline mode)", repo);
+            free(info);
+            return 1;
+        }
+    } else if (!cached || age < 0 || age >= config.release_ttl) {
+        release_info *fresh = malloc(sizeof(release_info));
+        double start = metrics_now();
+        fetched = fresh && fetch_release_info(repo, fresh, cancel, log) == 0;
+        metrics_phase(METRICS_METADATA, repo, start, 0, fetched);
+        if (fetched) {
+            cache_store_release(repo, fresh);
+            free(info);
+            info = fresh;
+        } else {
+            free(fresh);
+            if (!cached || (cancel && *cancel)) {
+                free(info);
+                return 1;
+            }
+            // Sin red se sigue con los metadatos vencidos
+            log_message(log, LOG_SINK_WARNING, "Using cached release data for %s (%s)", repo, info->tag);
+        }
+    }
+
+    snprintf(release_tag, 128, "%s", info->tag); // Asume que release_tag tiene suficiente espacio
+
+    // Recorrer los assets y buscar el archivo .bin: primero por nombre exacto,
+    // después el primero que lo contenga (sin contar los archivos de checksums)
+    release_asset *asset = NULL;
+    for (int i = 0; i < info->asset_count && !asset; i++) {
+        if (strcmp(info->assets[i].name, asset_name) == 0) asset = &info->assets[i];
+    }
+    for (int i = 0; i < info->asset_count && !asset; i++) {
+        if (strstr(info->assets[i].name, asset_name) && !is_checksum_name(info->assets[i].name)) asset = &info->assets[i];
+    }
+
+    if (!asset) {
+        log_message(log, LOG_SINK_ERROR, "Error: %s not found in release %s", asset_name, release_tag);
+        free(info);
+        return 1;
+    }
+
+    snprintf(download_url, 512, "%s", asset->url);
+    if (asset_digest(repo, info, asset, sha256, fetched, cancel) != 0) sha256[0] = '\0';
+    free(info);
+
+    return 0;
+}
+
+static int download_asset(const char *repo, const char *asset_name, image_stream *stream, const volatile int *cancel,
+                          const log_sink *log);
+
+// Publica en el stream una copia local ya completa del artefacto
+static int publish_local(image_stream *stream, const char *path, const char *sha256) {
+    if (!stream) return 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+    int fd = open(path, O_RDONLY | O_BINARY);
+#else
+    int fd = open(path, O_RDONLY);
+#endif
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || image_stream_attach(stream, fd, (long long)st.st_size) != 0) {
+        if (fd >= 0) close(fd);
+        image_stream_finish(stream, 0, NULL, NULL);
+        return 1;
+    }
+    close(fd);
+
+    image_stream_finish(stream, 1, sha256, NULL);
+    return 0;
 }
 
 // Función para descargar el archivo binario
-int download_file(const char *repo, const char *asset_name) {
+int download_file(const char *repo, const char *asset_name, const volatile int *cancel, const log_sink *log) {
+    return download_file_stream(repo, asset_name, NULL, cancel, log);
+}
+
+int download_file_stream(const char *repo, const char *asset_name, image_stream *stream, const volatile int *cancel,
+                         const log_sink *log) {
+    int ret = download_asset(repo, asset_name, stream, cancel, log);
+
+    // Ante cualquier fallo, quien consume el stream no debe quedar esperando
+    if (ret != 0 && stream) image_stream_finish(stream, 0, NULL, NULL);
+    return ret;
+}
+
+static int download_asset(const char *repo, const char *asset_name, image_stream *stream, const volatile int *cancel,
+                          const log_sink *log) {
     char url[512];
     char release_tag[128];
+    char sha256[65];
 
     // Obtener la URL de la última release
-    if (fetch_latest_release_url(repo, url, asset_name, release_tag) != 0) {
-        fprintf(stderr, "Can't download file\n");
+    if (fetch_latest_release_url(repo, url, asset_name, release_tag, sha256, cancel, log) != 0) {
+        if (!cancel || !*cancel) log_message(log, LOG_SINK_ERROR, "Can't download file");
         return 1;
     }
 
-    printf("Downloading %s (%s)", asset_name, release_tag);
+    // Si la caché tiene el artefacto se revalida con una petición condicional
+    cache_entry cached;
+    int have_cached = cache_lookup(repo, release_tag, asset_name, &cached) == 0;
 
-    CURL *curl;
-    CURLcode res;
-    FILE *fp;
+    // Una copia que no coincide con el hash publicado no se usa
+    if (have_cached && sha256[0] && strcasecmp(cached.sha256, sha256) != 0) {
+        log_message(log, LOG_SINK_WARNING, "Cached %s (%s) does not match the published checksum", asset_name, release_tag);
+        have_cached = 0;
+    }
 
-    // Abrir el archivo de salida en modo binario
-    fp = fopen(asset_name, "wb");
-    if (!fp) {
-        perror(" error writting file!\n");
-        return 1;
+    if (config.offline) {
+        if (!have_cached || cache_materialize(cached.sha256, asset_name) != 0) {
+            log_message(log, LOG_SINK_ERROR, "%s (%s) is not in the cache (offline mode)", asset_name, release_tag);
+            return 1;
+        }
+        log_message(log, LOG_SINK_INFO, "Using cached %s (%s)", asset_name, release_tag);
+        return publish_local(stream, asset_name, cached.sha256);
     }
 
-    // Inicializar libcurl
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, " download error!\n");
-        fclose(fp);
+    log_message(log, LOG_SINK_INFO, "Downloading %s (%s)", asset_name, release_tag);
+
+    // Descargar en un parcial con nombre fijo, así se puede reanudar si se corta
+    char partial[1200];
+    int use_cache = cache_partial_path(repo, release_tag, asset_name, partial, sizeof(partial)) == 0;
+    if (!use_cache) {
+        log_message(log, LOG_SINK_WARNING, "No cache directory, %s will not be cached", asset_name);
+        snprintf(partial, sizeof(partial), "%s.part", asset_name);
+    }
+
+    transfer_request request = {
+        url, partial,
+        have_cached ? cached.etag : NULL,
+        have_cached ? cached.last_modified : NULL,
+        config.connections, cancel, stream,
+        sha256[0] ? sha256 : NULL, config.insecure
+    };
+    transfer_result result;
+
+    double start = metrics_now();
+    int ret = transfer_download(&request, &result);
+    metrics_phase(METRICS_DOWNLOAD, asset_name, start, ret == 0 && !result.not_modified ? result.size - result.resumed : 0, ret == 0);
+    if (ret != 0) {
+        if (result.error[0]) log_message(log, LOG_SINK_ERROR, "%s: %s", asset_name, result.error);
+        if (result.corrupt) remove(partial);
         return 1;
     }
 
-    // Configuración de curl
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);  // Seguir redirecciones si es necesario
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+    if (result.not_modified) {
+        remove(partial);
+        if (cache_materialize(cached.sha256, asset_name) != 0) {
+            log_message(log, LOG_SINK_ERROR, "error writting %s: %s", asset_name, strerror(errno));
+            return 1;
+        }
+        log_message(log, LOG_SINK_INFO, "%s not modified, using cached copy", asset_name);
+        return publish_local(stream, asset_name, cached.sha256);
+    }
 
-    // Deshabilitar la verificación del certificado SSL
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);  // No verificar el certificado del servidor
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);  // No verificar el nombre del host
+    if (sha256[0]) log_message(log, LOG_SINK_INFO, "%s checksum verified", asset_name);
 
-    // Realizar la descarga
-    res = curl_easy_perform(curl);
+    if (!use_cache) {
+        remove(asset_name);
+        if (rename(partial, asset_name) != 0) {
+            log_message(log, LOG_SINK_ERROR, "error writting %s: %s", asset_name, strerror(errno));
+            return 1;
+        }
+        log_message(log, LOG_SINK_INFO, "%s done!", asset_name);
+        return 0;
+    }
 
-    // Comprobar si la descarga fue exitosa
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    if (res != CURLE_OK || http_code != 200) {
-        fprintf(stderr, " download error %ld (%s)\n", http_code, curl_easy_strerror(res));
-        fclose(fp);
-        curl_easy_cleanup(curl);
+    // Guardar en la caché con el hash calculado durante la descarga
+    cache_entry entry;
+    snprintf(entry.sha256, sizeof(entry.sha256), "%s", result.sha256);
+    entry.size = result.size;
+    snprintf(entry.etag, sizeof(entry.etag), "%s", result.etag);
+    snprintf(entry.last_modified, sizeof(entry.last_modified), "%s", result.last_modified);
+
+    if (cache_store(repo, release_tag, asset_name, partial, &entry) != 0 ||
+        cache_materialize(entry.sha256, asset_name) != 0) {
+        log_message(log, LOG_SINK_ERROR, "error writting %s: %s", asset_name, strerror(errno));
         return 1;
     }
 
-    // Cerrar el archivo y limpiar
-    printf(" done!\n");
-    fclose(fp);
-    curl_easy_cleanup(curl);
-
+    if (result.segments > 1 && result.resumed) {
+        log_message(log, LOG_SINK_INFO, "%s done! (%d connections, %lld bytes resumed)", asset_name, result.segments, result.resumed);
+    } else if (result.segments > 1) {
+        log_message(log, LOG_SINK_INFO, "%s done! (%d connections)", asset_name, result.segments);
+    } else {
+        log_message(log, LOG_SINK_INFO, "%s done!", asset_name);
+    }
     return 0;
 }
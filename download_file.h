@@ -31,6 +31,28 @@
 #ifndef DOWNLOAD_FILE_H
 #define DOWNLOAD_FILE_H
 
+#include "image_stream.h"
+#include "log_sink.h"
+
+// URL base de la API de GitHub; se puede cambiar con ESPECCY_API_URL o -api
+#define GITHUB_API_URL          "https://api.github.com"
+
+// Tiempo de validez por defecto de los metadatos de release en caché (segundos)
+#define RELEASE_TTL_DEFAULT     600
+
+typedef struct {
+    const char *api_url;        // URL base de la API (NULL para la de GitHub)
+    long        release_ttl;    // segundos que se reutilizan los metadatos de la caché
+    int         offline;        // 1: no usar la red, solo la caché
+    int         connections;    // conexiones simultáneas por archivo
+    int         insecure;       // 1: no verificar los certificados TLS
+} download_config;
+
+/**
+ * @brief Cambia la configuración de las descargas (antes de lanzarlas).
+ */
+void download_configure(const download_config *config);
+
 /**
  * @brief Descarga un archivo desde GitHub.
  *
@@ -39,8 +61,27 @@
  *
  * @param repo Nombre del repositorio en GitHub (ej. "SplinterGU/ESPeccy").
  * @param asset_name Nombre del archivo que deseas descargar (ej. "complete_firmware-nopsram.bin").
+ * @param cancel Bandera de cancelación (puede ser NULL); si pasa a 1 se aborta la descarga.
+ * @param log Recibe el avance y los errores (puede ser NULL).
  * @return 0 si la descarga fue exitosa, o un código de error si falló.
  */
-int download_file(const char *repo, const char *asset_name);
+int download_file(const char *repo, const char *asset_name, const volatile int *cancel, const log_sink *log);
+
+/**
+ * @brief Descarga un archivo desde GitHub publicándolo a medida que llega.
+ *
+ * Igual que download_file(), pero los bytes recibidos se publican en el
+ * stream para que el flasheo pueda empezar antes de que termine la descarga.
+ * Si el archivo sale de la caché se publica completo de una vez.
+ */
+int download_file_stream(const char *repo, const char *asset_name, image_stream *stream, const volatile int *cancel,
+                         const log_sink *log);
+
+/**
+ * @brief Inicializa libcurl; llamar una vez antes de lanzar descargas en paralelo.
+ *
+ * @return 0 si la inicialización fue exitosa.
+ */
+int download_global_init(void);
 
 #endif // DOWNLOAD_FILE_H
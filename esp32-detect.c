@@ -34,17 +34,94 @@
 #include <unistd.h>
 #include <stdlib.h>
 
-#if defined(_WIN32) || defined(_WIN64)
-    #include <windows.h>
-    #define FD HANDLE
-#else
+#if !defined(_WIN32) && !defined(_WIN64)
     #include <fcntl.h>
     #include <termios.h>
     #include <sys/ioctl.h>
     #include <dirent.h>
-    #define FD int
+    #include <time.h>
+#endif
+
+#include <pthread.h>
+
+#include "esp32_detect.h"
+#include "esp_loader.h"
+#include "log_sink.h"
+#include "metrics.h"
+#include "registry.h"
+#include "reset.h"
+#include "serial_enum.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+// Calcula el instante que está ms milisegundos en el futuro según el reloj indicado
+static void timespec_after(struct timespec *ts, clockid_t clock, int ms) {
+    clock_gettime(clock, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
 #endif
 
+int get_baud_rate(int baud) {
+#ifdef _WIN32
+    // En Windows, solo devolvemos el valor porque se usa directamente
+    switch (baud) {
+        case 9600:
+        case 19200:
+        case 38400:
+        case 57600:
+        case 115200:
+        case 230400:
+        case 460800:
+        case 500000:
+        case 576000:
+        case 921600:
+        case 1000000:
+        case 1152000:
+        case 1500000:
+        case 2000000:
+        case 2500000:
+        case 3000000:
+        case 3500000:
+        case 4000000:
+            return baud;
+    }
+#else
+    // En Unix-like, retornamos las constantes definidas en termios.h
+    switch (baud) {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+#ifndef __APPLE__
+        case 460800:  return B460800;
+        case 500000:  return B500000;
+        case 576000:  return B576000;
+        case 921600:  return B921600;
+        case 1000000: return B1000000;
+        case 1152000: return B1152000;
+        case 1500000: return B1500000;
+        case 2000000: return B2000000;
+        case 2500000: return B2500000;
+        case 3000000: return B3000000;
+        case 3500000: return B3500000;
+        case 4000000: return B4000000;
+#endif
+    }
+#endif
+    // Sin mensajes: transport_baud_supported() la usa como consulta y quien llama informa
+    return -1;
+}
+
 // Configuración de puerto serie
 int configure_port(FD fd) {
 #if defined(_WIN32) || defined(_WIN64)
@@ -108,144 +185,433 @@ int configure_port(FD fd) {
 
 // Función para reiniciar el ESP32
 void reset_esp32(FD fd) {
-#if 1
+    reset_strategy classic = { RESET_CLASSIC, 100, 50 };
+    reset_apply(fd, &classic);
+}
+
+// Reset por EN (RTS) con IO0 liberado (DTR), para arrancar el firmware grabado
+void hard_reset_esp32(FD fd) {
 #if defined(_WIN32) || defined(_WIN64)
-    // Windows-specific reset using DTR and RTS control
-    Sleep(100);                         // Esperar 100 ms
     EscapeCommFunction(fd, CLRDTR);     // Clear DTR
     EscapeCommFunction(fd, SETRTS);     // Set RTS
     Sleep(100);                         // Esperar 100 ms
-    EscapeCommFunction(fd, SETDTR);     // Set DTR
     EscapeCommFunction(fd, CLRRTS);     // Clear RTS
-    Sleep(100);                         // Esperar 50 ms
-    EscapeCommFunction(fd, CLRDTR);     // Clear RTS
 #else
-    // Linux-specific reset using ioctl
     int dtr_flag = TIOCM_DTR;
     int rts_flag = TIOCM_RTS;
-    usleep(100000);                     // Esperar 100 ms
     ioctl(fd, TIOCMBIC, &dtr_flag);     // Clear DTR
     ioctl(fd, TIOCMBIS, &rts_flag);     // Set RTS
     usleep(100000);                     // Esperar 100 ms
-    ioctl(fd, TIOCMBIS, &dtr_flag);     // Set DTR
-    ioctl(fd, TIOCMBIC, &rts_flag);     // Clear RTS
-    usleep(50000);                      // Esperar 50 ms
-    ioctl(fd, TIOCMBIS, &dtr_flag);     // Clear RTS
-#endif
-#else
-#if defined(_WIN32) || defined(_WIN64)
-    // Windows-specific reset using DTR and RTS control
-    EscapeCommFunction(fd, CLRDTR);     // Clear DTR
-    EscapeCommFunction(fd, CLRRTS);     // Clear RTS
-    Sleep(100);                         // Esperar 100 ms
-    EscapeCommFunction(fd, SETRTS);     // Set RTS
-#else
-    // Linux-specific reset using ioctl
-    int dtr_flag = TIOCM_DTR;
-    int rts_flag = TIOCM_RTS;
-    ioctl(fd, TIOCMBIC, &dtr_flag);     // Clear DTR
     ioctl(fd, TIOCMBIC, &rts_flag);     // Clear RTS
-    usleep(100000);                     // Esperar 100 ms
-    ioctl(fd, TIOCMBIS, &rts_flag);     // Set RTS
 #endif
+}
+
+// Lista de rutas de puertos protegida por ports_lock
+typedef struct {
+    char  **paths;
+    int     count;
+} port_list;
+
+static pthread_mutex_t ports_lock = PTHREAD_MUTEX_INITIALIZER;
+static port_list claims;        // en uso por un flasheo de este proceso: la búsqueda no los toca
+
+static int port_list_find(const port_list *list, const char *port) {
+    for (int i = 0; i < list->count; i++) {
+        if (strcmp(list->paths[i], port) == 0) return i;
+    }
+    return -1;
+}
+
+static int port_list_add(port_list *list, const char *port) {
+    char **paths = realloc(list->paths, (list->count + 1) * sizeof(char *));
+    if (!paths) return -1;
+    list->paths = paths;
+    list->paths[list->count] = strdup(port);
+    if (!list->paths[list->count]) return -1;
+    list->count++;
+    return 0;
+}
+
+static void port_list_remove(port_list *list, const char *port) {
+    int i = port_list_find(list, port);
+    if (i < 0) return;
+    free(list->paths[i]);
+    list->paths[i] = list->paths[--list->count];
+}
+
+int esp32_claim_port(const char *port) {
+    pthread_mutex_lock(&ports_lock);
+    int ret = port_list_find(&claims, port) < 0 ? port_list_add(&claims, port) : -1;
+    pthread_mutex_unlock(&ports_lock);
+    return ret;
+}
+
+void esp32_release_port(const char *port) {
+    pthread_mutex_lock(&ports_lock);
+    port_list_remove(&claims, port);
+    pthread_mutex_unlock(&ports_lock);
+}
+
+int esp32_port_claimed(const char *port) {
+    pthread_mutex_lock(&ports_lock);
+    int claimed = port_list_find(&claims, port) >= 0;
+    pthread_mutex_unlock(&ports_lock);
+    return claimed;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+// Una búsqueda que vuelve con la primera detección deja sondas en curso: la
+// siguiente espera a que terminen antes de resetear el mismo puerto
+static pthread_cond_t probes_done = PTHREAD_COND_INITIALIZER;
+static port_list probing;
+
+static void begin_probe(const char *port) {
+    pthread_mutex_lock(&ports_lock);
+    while (port_list_find(&probing, port) >= 0) pthread_cond_wait(&probes_done, &ports_lock);
+    port_list_add(&probing, port);
+    pthread_mutex_unlock(&ports_lock);
+}
+
+static void end_probe(const char *port) {
+    pthread_mutex_lock(&ports_lock);
+    port_list_remove(&probing, port);
+    pthread_cond_broadcast(&probes_done);
+    pthread_mutex_unlock(&ports_lock);
+}
 #endif
+
+// Abre el puerto, entra al ROM loader con un solo reset y lee qué chip es
+static int probe_port(const char *port, esp_chip_info *info) {
+    esp_loader loader;
+    if (esp_loader_open(&loader, port, NULL) != ESP_LOADER_OK) return 0;
+
+    int detected = esp_loader_probe(&loader) == ESP_LOADER_OK &&
+                   esp_loader_identify(&loader, info) == ESP_LOADER_OK &&
+                   info->magic == ESP_CHIP_MAGIC_ESP32;
+
+    esp_loader_close(&loader);
+    return detected;
+}
+
+int identify_esp32(const char *port, esp_chip_info *info) {
+    double start = metrics_now();
+    int detected = probe_port(port, info);
+    metrics_phase(METRICS_PROBE, port, start, 0, detected);
+    return detected;
 }
 
 // Función para verificar si es un ESP32
 int is_esp32(const char *port) {
-    FD fd;
-#if defined(_WIN32) || defined(_WIN64)
-    fd = CreateFile(port, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-    if (fd == INVALID_HANDLE_VALUE) return 0;
-#else
-    fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
-    if (fd == -1) return 0; // Could not open port
-#endif
+    esp_chip_info info;
+    return identify_esp32(port, &info);
+}
 
-    if (configure_port(fd) == -1) {
-    #if defined(_WIN32) || defined(_WIN64)
-        CloseHandle(fd);  // Close for Windows
-    #else
-        close(fd);  // Close for Linux
-    #endif
-        return 0;
+#if !defined(_WIN32) && !defined(_WIN64)
+// Estado compartido entre el hilo que escanea y las sondas de cada puerto.
+// Se libera cuando la última referencia (escáner o sonda) lo suelta, así el
+// escáner puede volver al cumplirse el plazo sin esperar a sondas colgadas.
+typedef struct {
+    char            path[256];
+    int             is_esp32;
+    int             known;      // ya identificado en el registro, no se sondea
+    struct probe_set *set;
+} probe_slot;
+
+typedef struct probe_set {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             refs;       // referencias vivas: escáner + sondas
+    int             pending;    // sondas que aún no terminaron
+    int             found;      // sondas que detectaron un ESP32
+    int             first;      // índice de la primera detección (-1 si ninguna)
+    int             count;
+    probe_slot     *slots;
+} probe_set;
+
+static void probe_set_release(probe_set *set) {
+    pthread_mutex_lock(&set->lock);
+    int refs = --set->refs;
+    pthread_mutex_unlock(&set->lock);
+
+    if (refs == 0) {
+        pthread_mutex_destroy(&set->lock);
+        pthread_cond_destroy(&set->cond);
+        free(set->slots);
+        free(set);
     }
+}
 
-    // Reset ESP32
-    reset_esp32(fd);
+static void *probe_thread(void *arg) {
+    probe_slot *slot = (probe_slot *)arg;
+    probe_set *set = slot->set;
 
-    // Leer respuesta
-    char buffer[1024];
-    memset(buffer, 0, sizeof(buffer));
+    begin_probe(slot->path);
+    int result = is_esp32(slot->path);
+    end_probe(slot->path);
 
-#if defined(_WIN32) || defined(_WIN64)
-    DWORD bytesRead;
-    ReadFile(fd, buffer, sizeof(buffer) - 1, &bytesRead, NULL);
-#else
-    ssize_t bytesRead = read(fd, buffer, sizeof(buffer) - 1);
-#endif
+    pthread_mutex_lock(&set->lock);
+    slot->is_esp32 = result;
+    if (result) {
+        if (set->first < 0) set->first = (int)(slot - set->slots);
+        set->found++;
+    }
+    set->pending--;
+    pthread_cond_broadcast(&set->cond);
+    pthread_mutex_unlock(&set->lock);
 
-#if defined(_WIN32) || defined(_WIN64)
-    CloseHandle(fd);  // Close for Windows
-#else
-    close(fd);  // Close for Linux
-#endif
+    probe_set_release(set);
+    return NULL;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(((const probe_slot *)a)->path, ((const probe_slot *)b)->path);
+}
+
+static probe_slot *add_slot(probe_set *set, int *capacity) {
+    if (set->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        probe_slot *slots = realloc(set->slots, *capacity * sizeof(probe_slot));
+        if (!slots) return NULL;
+        set->slots = slots;
+    }
 
-    if (bytesRead > 0) {
-        if (strstr(buffer, "ets Jun") || strstr(buffer, "rst:0x")
-            || strstr(buffer, "ESP-IDF") // detecta 2do stage de bootloader
-           ) {
-            return 1; // ESP32 detectado
+    probe_slot *slot = &set->slots[set->count++];
+    memset(slot, 0, sizeof(*slot));
+    return slot;
+}
+
+// Recolecta los ttyUSB*/ttyACM* candidatos. Si sysfs está disponible se usa su
+// clasificación para no tocar módems, GPS ni otros MCUs; si no, se listan
+// todos los nodos de /dev (o de ESPECCY_DEV_DIR, para puertos simulados).
+static probe_set *collect_candidates(const log_sink *log) {
+    probe_set *set = calloc(1, sizeof(probe_set));
+    if (!set) return NULL;
+    set->first = -1;
+
+    int capacity = 0;
+
+    serial_port_info *ports;
+    int count = enumerate_serial_ports(NULL, &ports);
+    if (count >= 0) {
+        for (int i = 0; i < count; i++) {
+            if (ports[i].rank < 0) {
+                log_message(log, LOG_SINK_INFO, "Skipping %s (%04x:%04x %s)", ports[i].path, ports[i].vid, ports[i].pid,
+                            ports[i].driver[0] ? ports[i].driver : adapter_type_name(ports[i].type));
+                continue;
+            }
+            if (esp32_port_claimed(ports[i].path)) {
+                log_message(log, LOG_SINK_INFO, "Skipping %s (in use)", ports[i].path);
+                continue;
+            }
+            probe_slot *slot = add_slot(set, &capacity);
+            if (!slot) break;
+            snprintf(slot->path, sizeof(slot->path), "%s", ports[i].path);
         }
+        free(ports);
+        return set;
     }
-    return 0; // No es ESP32
+
+    const char *dev_dir = getenv("ESPECCY_DEV_DIR");
+    if (!dev_dir || !*dev_dir) dev_dir = "/dev";
+
+    DIR *dir = opendir(dev_dir);
+    if (!dir) {
+        log_message(log, LOG_SINK_ERROR, "Failed to open %s directory: %s", dev_dir, strerror(errno));
+        free(set);
+        return NULL;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "ttyUSB", 6) != 0 && strncmp(entry->d_name, "ttyACM", 6) != 0) continue;
+
+        char path[256];
+        snprintf(path, sizeof(path), "%.120s/%.120s", dev_dir, entry->d_name);
+        if (esp32_port_claimed(path)) {
+            log_message(log, LOG_SINK_INFO, "Skipping %s (in use)", path);
+            continue;
+        }
+
+        probe_slot *slot = add_slot(set, &capacity);
+        if (!slot) break;
+        snprintf(slot->path, sizeof(slot->path), "%s", path);
+    }
+    closedir(dir);
+
+    if (set->count > 1) qsort(set->slots, set->count, sizeof(probe_slot), compare_paths);
+
+    return set;
 }
+#endif
+
+// Sondea en paralelo todos los puertos candidatos
+static int scan_ports(char ***ports, int find_all, int timeout_ms, const volatile int *cancel, const log_sink *log) {
+    *ports = NULL;
 
-// Listar puertos serie y buscar ESP32
-const char * find_esp32_port() {
 #if defined(_WIN32) || defined(_WIN64)
     // En Windows, puedes usar una librería para detectar los puertos COM disponibles
     // Esto es más complicado porque Windows no tiene un /dev equivalente.
-    printf("Scanning for ESP32 on serial port ");
+    int found = 0;
+    log_message(log, LOG_SINK_INFO, "Scanning for ESP32 on serial ports COM1 to COM63...");
     for (int i = 1; i < 64; i++) {
         char port[20];
         snprintf(port, sizeof(port), "\\\\.\\COM%d", i);
-        printf("%s... ", port+4);
+        if (cancel && *cancel) break;
+        if (esp32_port_claimed(port+4)) continue;
         if (is_esp32(port)) {
-            printf("ESP32 found!\n");
-            return strdup(port+4);
+            log_message(log, LOG_SINK_INFO, "%s ESP32 found!", port+4);
+            char **list = realloc(*ports, (found + 1) * sizeof(char *));
+            if (!list) break;
+            *ports = list;
+            (*ports)[found++] = strdup(port+4);
+            if (!find_all) return found;
         }
-        for (int j = 0; j < strlen(port); j++) putchar('\b');
     }
+    if (!found) log_message(log, LOG_SINK_INFO, "ESP32 not found!");
+    return found;
 #else
-    struct dirent *entry;
-    DIR *dir = opendir("/dev");
+    probe_set *set = collect_candidates(log);
+    if (!set) return -1;
 
-    if (!dir) {
-        perror("Failed to open /dev directory");
-        return NULL;
+    if (set->count == 0) {
+        log_message(log, LOG_SINK_INFO, "Scanning for ESP32... no serial ports found!");
+        free(set->slots);
+        free(set);
+        return 0;
     }
 
-    printf("Scanning for ESP32 on serial port ");
+    // Las placas del registro no se resetean para sondearlas
+    int known = 0;
+    for (int i = 0; i < set->count; i++) {
+        device_record record;
+        if (registry_lookup(set->slots[i].path, &record) != 0) continue;
+        set->slots[i].known = set->slots[i].is_esp32 = 1;
+        if (set->first < 0) set->first = i;
+        known++;
+    }
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (strncmp(entry->d_name, "ttyUSB", 6) == 0 || strncmp(entry->d_name, "ttyACM", 6) == 0) {
-            char port_path[256] = "";
-            if (port_path[0]) for (int j = 0; j < strlen(port_path) + 4; j++) putchar('\b');
-            snprintf(port_path, sizeof(port_path), "/dev/%s", entry->d_name);
-            printf("%s... ", port_path);
-            if (is_esp32(port_path)) {
-                printf("ESP32 found!\n");
-                closedir(dir);
-                return strdup(port_path);
+    if (known && !find_all) {
+        char **list = malloc(sizeof(char *));
+        if (list) list[0] = strdup(set->slots[set->first].path);
+        free(set->slots);
+        free(set);
+        if (!list) return -1;
+
+        log_message(log, LOG_SINK_INFO, "Using known ESP32 on %s", list[0]);
+        *ports = list;
+        return 1;
+    }
+
+    if (known == set->count) {
+        log_message(log, LOG_SINK_INFO, "Checking %d known ESP32...", known);
+    } else if (known) {
+        log_message(log, LOG_SINK_INFO, "Scanning %d serial port%s for ESP32 (%d known)...", set->count - known,
+                    set->count - known == 1 ? "" : "s", known);
+    } else {
+        log_message(log, LOG_SINK_INFO, "Scanning %d serial port%s for ESP32...", set->count, set->count == 1 ? "" : "s");
+    }
+
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->cond, NULL);
+    set->refs = 1;
+    set->found = known;
+
+    // Lanzar una sonda por puerto; cada una abre, resetea y lee por su cuenta
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_mutex_lock(&set->lock);
+    for (int i = 0; i < set->count; i++) {
+        pthread_t thread;
+        if (set->slots[i].known) continue;
+        set->slots[i].set = set;
+        set->refs++;
+        set->pending++;
+        if (pthread_create(&thread, &attr, probe_thread, &set->slots[i]) != 0) {
+            set->refs--;
+            set->pending--;
+        }
+    }
+
+    struct timespec deadline;
+    timespec_after(&deadline, CLOCK_REALTIME, timeout_ms);
+
+    // Esperar hasta la primera detección (o todas), o hasta agotar el plazo.
+    // Se despierta periódicamente para atender la cancelación.
+    while (set->pending > 0 && (find_all || set->found == 0) && !(cancel && *cancel)) {
+        struct timespec slice;
+        timespec_after(&slice, CLOCK_REALTIME, 50);
+        if (!timespec_before(&slice, &deadline)) {
+            if (pthread_cond_timedwait(&set->cond, &set->lock, &deadline) == ETIMEDOUT) break;
+        } else {
+            pthread_cond_timedwait(&set->cond, &set->lock, &slice);
+        }
+    }
+
+    if (cancel && *cancel) {
+        pthread_mutex_unlock(&set->lock);
+        pthread_attr_destroy(&attr);
+        probe_set_release(set);
+        log_message(log, LOG_SINK_INFO, "Scan cancelled");
+        return 0;
+    }
+
+    int found = 0;
+    char **list = set->found ? malloc(set->found * sizeof(char *)) : NULL;
+    if (list) {
+        if (find_all) {
+            for (int i = 0; i < set->count; i++) {
+                if (set->slots[i].is_esp32) list[found++] = strdup(set->slots[i].path);
             }
+        } else {
+            list[found++] = strdup(set->slots[set->first].path);
         }
     }
+    pthread_mutex_unlock(&set->lock);
+    pthread_attr_destroy(&attr);
 
-    closedir(dir);
+    // Las sondas que sigan vivas liberan el estado al terminar
+    probe_set_release(set);
+
+    if (!found) {
+        free(list);
+        log_message(log, LOG_SINK_INFO, "ESP32 not found!");
+        return 0;
+    }
+
+    char names[512] = "";
+    for (int i = 0; i < found; i++) {
+        size_t len = strlen(names);
+        snprintf(names + len, sizeof(names) - len, "%s%s", i ? ", " : "", list[i]);
+    }
+    log_message(log, LOG_SINK_INFO, "%s ESP32 found!", names);
+
+    *ports = list;
+    return found;
 #endif
+}
 
-    printf("ESP32 not found!\n");
+int find_esp32_ports(char ***ports, int find_all, int timeout_ms, const volatile int *cancel, const log_sink *log) {
+    double start = metrics_now();
+    int found = scan_ports(ports, find_all, timeout_ms, cancel, log);
+    metrics_phase(METRICS_SCAN, NULL, start, 0, found > 0);
+    return found;
+}
 
-    return NULL;
+// Libera la lista devuelta por find_esp32_ports()
+void free_esp32_ports(char **ports, int count) {
+    for (int i = 0; i < count; i++) free(ports[i]);
+    free(ports);
+}
+
+// Listar puertos serie y buscar ESP32
+const char * find_esp32_port() {
+    char **ports;
+    int found = find_esp32_ports(&ports, 0, ESP32_PROBE_TIMEOUT_MS, NULL, NULL);
+    if (found <= 0) return NULL;
+
+    const char *port = ports[0];
+    free(ports);
+    return port;
 }
@@ -31,6 +31,114 @@
 #ifndef ESP32_DETECT_H
 #define ESP32_DETECT_H
 
+#include <stddef.h>
+
+#include "log_sink.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+    #define FD HANDLE
+#else
+    #define FD int
+#endif
+
+// Plazo máximo para sondear todos los puertos candidatos
+#define ESP32_PROBE_TIMEOUT_MS  3000
+
+// Velocidad del puerto con la que arranca el ROM del ESP32
+#define ESP32_ROM_BAUD          115200
+
+/**
+ * @brief Traduce una velocidad en baudios a la constante del sistema.
+ *
+ * Solo las velocidades estándar; en Linux transport_set_baud() acepta
+ * cualquiera (ver transport_baud_supported()).
+ *
+ * @return La constante de termios (el valor tal cual en Windows), o -1 si no está
+ * soportada; no escribe nada, así sirve para consultar.
+ */
+int get_baud_rate(int baud);
+
+/**
+ * @brief Configura el puerto en 8N1 a ESP32_ROM_BAUD, en modo binario.
+ *
+ * @return 0 si se pudo configurar, -1 en caso de error.
+ */
+int configure_port(FD fd);
+
+/**
+ * @brief Resetea el ESP32 con DTR/RTS dejándolo en modo descarga (ROM loader).
+ *
+ * Usa la secuencia clásica con las esperas seguras; para probar otras
+ * secuencias y esperas más cortas según el adaptador, ver reset.h.
+ */
+void reset_esp32(FD fd);
+
+/**
+ * @brief Resetea el ESP32 con RTS para que arranque el firmware grabado.
+ */
+void hard_reset_esp32(FD fd);
+
+/**
+ * @brief Verifica si hay un ESP32 en el puerto indicado.
+ *
+ * Resetea el dispositivo en modo descarga, se sincroniza con el ROM loader
+ * y lee el registro mágico; un puerto que no contesta al SYNC se descarta
+ * en cuanto vencen los reintentos de un solo reset.
+ *
+ * @return 1 si se detectó un ESP32, 0 en caso contrario.
+ */
+int is_esp32(const char *port);
+
+struct esp_chip_info;
+
+/**
+ * @brief Como is_esp32(), y además deja en info lo leído del chip
+ * (ver esp_loader_identify()).
+ */
+int identify_esp32(const char *port, struct esp_chip_info *info);
+
+/**
+ * @brief Busca dispositivos ESP32 sondeando todos los puertos serie a la vez.
+ *
+ * Cada puerto candidato se abre, se resetea y se sondea en su propio hilo, de modo
+ * que el tiempo de detección no depende de la cantidad de puertos conectados.
+ * Los puertos reservados con esp32_claim_port() se saltean.
+ *
+ * @param ports Recibe la lista de puertos detectados (liberar con free_esp32_ports()).
+ * @param find_all 0 para volver con la primera detección, 1 para esperar a todas.
+ * @param timeout_ms Plazo máximo total de la búsqueda en milisegundos.
+ * @param cancel Bandera de cancelación (puede ser NULL); si pasa a 1 la búsqueda se abandona.
+ * @param log Recibe el avance de la búsqueda y los puertos descartados (puede ser NULL).
+ * @return Cantidad de puertos con ESP32 encontrados, o -1 si hubo un error.
+ */
+int find_esp32_ports(char ***ports, int find_all, int timeout_ms, const volatile int *cancel, const log_sink *log);
+
+/**
+ * @brief Reserva un puerto para un flasheo de este proceso.
+ *
+ * Mientras está reservado, find_esp32_ports() no lo sondea ni lo devuelve,
+ * así dos trabajos que buscan el puerto a la vez no eligen la misma placa.
+ *
+ * @return 0 si se reservó, -1 si ya estaba reservado (o no hay memoria).
+ */
+int esp32_claim_port(const char *port);
+
+/**
+ * @brief Libera un puerto reservado con esp32_claim_port().
+ */
+void esp32_release_port(const char *port);
+
+/**
+ * @brief 1 si el puerto está reservado por un flasheo de este proceso.
+ */
+int esp32_port_claimed(const char *port);
+
+/**
+ * @brief Libera la lista devuelta por find_esp32_ports().
+ */
+void free_esp32_ports(char **ports, int count);
+
 const char * find_esp32_port();
 
 #endif // ESP32_DETECT_H
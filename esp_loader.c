@@ -0,0 +1,1336 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <time.h>
+#endif
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "buffer.h"
+#include "esp_loader.h"
+#include "image_map.h"
+#include "md5.h"
+#include "metrics.h"
+#include "sha256.h"
+
+#define SLIP_END                0xC0
+#define SLIP_ESC                0xDB
+#define SLIP_ESC_END            0xDC
+#define SLIP_ESC_ESC            0xDD
+
+// Las esperas se cortan en tramos de este largo para atender la cancelación
+#define WAIT_SLICE_MS           100
+
+static long long now_ms(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    return (long long)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+static int cancelled(const esp_loader *l) {
+    return l->cancel && *l->cancel;
+}
+
+static const char *command_name(uint8_t op) {
+    switch (op) {
+        case ESP_FLASH_BEGIN:       return "FLASH_BEGIN";
+        case ESP_FLASH_DATA:        return "FLASH_DATA";
+        case ESP_FLASH_END:         return "FLASH_END";
+        case ESP_SYNC:              return "SYNC";
+        case ESP_WRITE_REG:         return "WRITE_REG";
+        case ESP_READ_REG:          return "READ_REG";
+        case ESP_SPI_SET_PARAMS:    return "SPI_SET_PARAMS";
+        case ESP_SPI_ATTACH:        return "SPI_ATTACH";
+        case ESP_CHANGE_BAUDRATE:   return "CHANGE_BAUDRATE";
+        case ESP_FLASH_DEFL_BEGIN:  return "FLASH_DEFL_BEGIN";
+        case ESP_FLASH_DEFL_DATA:   return "FLASH_DEFL_DATA";
+        case ESP_FLASH_DEFL_END:    return "FLASH_DEFL_END";
+        case ESP_SPI_FLASH_MD5:     return "SPI_FLASH_MD5";
+    }
+    return "command";
+}
+
+// Códigos de error que devuelve el ROM en el segundo byte de estado
+static const char *rom_error_name(uint8_t error) {
+    switch (error) {
+        case 0x05: return "invalid message";
+        case 0x06: return "failed to act on message";
+        case 0x07: return "invalid CRC";
+        case 0x08: return "flash write error";
+        case 0x09: return "flash read error";
+        case 0x0a: return "flash read length error";
+        case 0x0b: return "deflate error";
+    }
+    return "unknown error";
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t checksum(const uint8_t *data, size_t len) {
+    uint32_t sum = ESP_CHECKSUM_SEED;
+    for (size_t i = 0; i < len; i++) sum ^= data[i];
+    return sum;
+}
+
+static void flush_input(esp_loader *l) {
+    transport_discard_input(&l->link);
+    l->rx_pos = l->rx_len = 0;
+}
+
+// Trae más bytes del puerto; 1 si llegaron, 0 si se agotó el plazo, -1 si hubo error
+static int fill_rx(esp_loader *l, long long deadline) {
+    for (;;) {
+        if (cancelled(l)) return -1;
+
+        long long remaining = deadline - now_ms();
+        if (remaining <= 0) return 0;
+        if (remaining > WAIT_SLICE_MS) remaining = WAIT_SLICE_MS;
+
+        int n = transport_read(&l->link, l->rx, sizeof(l->rx), (int)remaining);
+        if (n < 0) return -1;
+        if (n > 0) {
+            l->rx_pos = 0;
+            l->rx_len = (size_t)n;
+            return 1;
+        }
+    }
+}
+
+/*
+ * Lee la próxima trama SLIP completa en l->frame.
+ *
+ * Lo que llega fuera de una trama (el texto del arranque del ROM) se descarta,
+ * igual que las tramas mal escapadas o demasiado largas.
+ */
+static int recv_frame(esp_loader *l, long long deadline) {
+    int in_frame = 0, escape = 0;
+
+    for (;;) {
+        if (l->rx_pos == l->rx_len) {
+            int ret = fill_rx(l, deadline);
+            if (ret <= 0) return ret < 0 ? ESP_LOADER_ERROR : ESP_LOADER_TIMEOUT;
+        }
+
+        uint8_t b = l->rx[l->rx_pos++];
+
+        if (b == SLIP_END) {
+            if (in_frame && l->frame_len > 0) return ESP_LOADER_OK;
+            in_frame = 1;
+            escape = 0;
+            l->frame_len = 0;
+            continue;
+        }
+        if (!in_frame) continue;
+
+        if (escape) {
+            escape = 0;
+            if (b == SLIP_ESC_END) b = SLIP_END;
+            else if (b == SLIP_ESC_ESC) b = SLIP_ESC;
+            else {
+                in_frame = 0;
+                continue;
+            }
+        } else if (b == SLIP_ESC) {
+            escape = 1;
+            continue;
+        }
+
+        if (l->frame_len == sizeof(l->frame)) {
+            in_frame = 0;
+            continue;
+        }
+        l->frame[l->frame_len++] = b;
+    }
+}
+
+// Escapa data y la pasa al buffer de salida del transporte; la trama se envía entera con transport_flush()
+static int slip_write(esp_loader *l, const uint8_t *data, size_t len) {
+    uint8_t out[256];
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (n > sizeof(out) - 2) {
+            if (transport_write(&l->link, out, n, l->cancel) != 0) return -1;
+            n = 0;
+        }
+        if (data[i] == SLIP_END) {
+            out[n++] = SLIP_ESC;
+            out[n++] = SLIP_ESC_END;
+        } else if (data[i] == SLIP_ESC) {
+            out[n++] = SLIP_ESC;
+            out[n++] = SLIP_ESC_ESC;
+        } else {
+            out[n++] = data[i];
+        }
+    }
+    return transport_write(&l->link, out, n, l->cancel);
+}
+
+static int send_packet(esp_loader *l, uint8_t op, const uint8_t *data, size_t len, uint32_t chk) {
+    static const uint8_t end = SLIP_END;
+    uint8_t header[8];
+    header[0] = 0x00;
+    header[1] = op;
+    header[2] = (uint8_t)len;
+    header[3] = (uint8_t)(len >> 8);
+    put_le32(header + 4, chk);
+
+    // La trama entera sale en una sola escritura al final
+    if (transport_write(&l->link, &end, 1, l->cancel) != 0 ||
+        slip_write(l, header, sizeof(header)) != 0 ||
+        slip_write(l, data, len) != 0 ||
+        transport_write(&l->link, &end, 1, l->cancel) != 0 ||
+        transport_flush(&l->link, l->cancel) != 0) {
+        snprintf(l->error, sizeof(l->error), "%s: can't write to the port", command_name(op));
+        return ESP_LOADER_ERROR;
+    }
+    return ESP_LOADER_OK;
+}
+
+/*
+ * Envía un comando y espera su respuesta.
+ *
+ * Las respuestas de otros comandos (por ejemplo las réplicas extra de SYNC) se
+ * ignoran. Si body no es NULL recibe los datos de la respuesta sin los bytes de
+ * estado, que quedan en l->frame hasta el próximo comando.
+ */
+static int command(esp_loader *l, uint8_t op, const uint8_t *data, size_t len, uint32_t chk, int timeout_ms,
+                   uint32_t *value, const uint8_t **body, size_t *body_len) {
+    int ret = send_packet(l, op, data, len, chk);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    long long deadline = now_ms() + timeout_ms;
+
+    for (;;) {
+        ret = recv_frame(l, deadline);
+        if (ret != ESP_LOADER_OK) {
+            if (cancelled(l)) {
+                snprintf(l->error, sizeof(l->error), "%s: cancelled", command_name(op));
+                return ESP_LOADER_CANCELLED;
+            }
+            snprintf(l->error, sizeof(l->error), "%s: %s", command_name(op),
+                     ret == ESP_LOADER_TIMEOUT ? "no response" : "can't read from the port");
+            return ret;
+        }
+
+        if (l->frame_len < 8 || l->frame[0] != 0x01 || l->frame[1] != op) continue;
+
+        size_t size = (size_t)l->frame[2] | ((size_t)l->frame[3] << 8);
+        size_t n = l->frame_len - 8;
+        if (size < n) n = size;
+
+        // El ROM del ESP32 cierra cada respuesta con 4 bytes de estado
+        if (n < 4) {
+            snprintf(l->error, sizeof(l->error), "%s: short response", command_name(op));
+            return ESP_LOADER_FAILED;
+        }
+
+        const uint8_t *status = l->frame + 8 + n - 4;
+        if (status[0] != 0) {
+            snprintf(l->error, sizeof(l->error), "%s failed: %s (0x%02x)", command_name(op),
+                     rom_error_name(status[1]), status[1]);
+            return ESP_LOADER_FAILED;
+        }
+
+        if (value) *value = get_le32(l->frame + 4);
+        if (body) *body = l->frame + 8;
+        if (body_len) *body_len = n - 4;
+        return ESP_LOADER_OK;
+    }
+}
+
+// Plazo proporcional al tamaño para los comandos que recorren la flash
+static int timeout_for_size(int per_mb, uint32_t size) {
+    long long ms = (long long)per_mb * size / (1024 * 1024);
+    return ms < ESP_TIMEOUT_DEFAULT ? ESP_TIMEOUT_DEFAULT : (int)ms;
+}
+
+int esp_loader_open(esp_loader *l, const char *port, const volatile int *cancel) {
+    memset(l, 0, sizeof(*l));
+    l->cancel = cancel;
+    l->baud = ESP32_ROM_BAUD;
+    snprintf(l->port, sizeof(l->port), "%s", port);
+
+    if (transport_open(&l->link, port) != 0) {
+#if defined(_WIN32) || defined(_WIN64)
+        snprintf(l->error, sizeof(l->error), "Can't open %s", port);
+#else
+        snprintf(l->error, sizeof(l->error), "Can't open %s: %s", port, strerror(errno));
+#endif
+        return ESP_LOADER_ERROR;
+    }
+    reset_plan_init(&l->reset_plan, l->link.adapter, 0);
+
+    return ESP_LOADER_OK;
+}
+
+void esp_loader_close(esp_loader *l) {
+    transport_close(&l->link);
+}
+
+// Con measure en 0 (sondeos de la detección) no se registran las fases ni se
+// aprende la estrategia: el sondeo usa esperas seguras que no dicen nada de las cortas
+static int sync_rom(esp_loader *l, const reset_plan *plan, int measure) {
+    uint8_t sync[36] = { 0x07, 0x07, 0x12, 0x20 };
+    memset(sync + 4, 0x55, sizeof(sync) - 4);
+
+    if (l->baud != ESP32_ROM_BAUD) {
+        transport_set_baud(&l->link, ESP32_ROM_BAUD);
+        l->baud = ESP32_ROM_BAUD;
+    }
+
+    for (int attempt = 0; attempt < plan->count; attempt++) {
+        const reset_strategy *s = &plan->steps[attempt];
+
+        double start = metrics_now();
+        reset_apply(l->link.fd, s);
+        if (measure) metrics_phase(METRICS_RESET, l->port, start, 0, 1);
+        flush_input(l);
+
+        start = metrics_now();
+        for (int i = 0; i < 5; i++) {
+            int ret = command(l, ESP_SYNC, sync, sizeof(sync), 0, ESP_TIMEOUT_SYNC, NULL, NULL, NULL);
+            if (ret == ESP_LOADER_CANCELLED) return ret;
+            if (ret != ESP_LOADER_OK) continue;
+
+            // El ROM contesta varias veces cada SYNC: descartar las réplicas pendientes
+            long long deadline = now_ms() + ESP_TIMEOUT_SYNC;
+            while (recv_frame(l, deadline) == ESP_LOADER_OK);
+            flush_input(l);
+            if (measure) metrics_phase(METRICS_SYNC, l->port, start, 0, 1);
+
+            l->reset = *s;
+            if (measure) reset_learn(plan->adapter, s);
+            return ESP_LOADER_OK;
+        }
+        if (measure) metrics_phase(METRICS_SYNC, l->port, start, 0, 0);
+    }
+
+    snprintf(l->error, sizeof(l->error), "Can't sync with the ROM loader (no response to SYNC)");
+    return ESP_LOADER_TIMEOUT;
+}
+
+int esp_loader_connect(esp_loader *l) {
+    int ret = sync_rom(l, &l->reset_plan, 1);
+    if (ret == ESP_LOADER_OK) reset_plan_prefer(&l->reset_plan, &l->reset);
+    return ret;
+}
+
+void esp_loader_prefer_reset(esp_loader *l, const reset_strategy *s) {
+    reset_plan_prefer(&l->reset_plan, s);
+}
+
+int esp_loader_probe(esp_loader *l) {
+    reset_plan plan;
+    reset_plan_init(&plan, l->reset_plan.adapter, 1);
+    return sync_rom(l, &plan, 0);
+}
+
+int esp_loader_read_reg(esp_loader *l, uint32_t addr, uint32_t *value) {
+    uint8_t data[4];
+    put_le32(data, addr);
+    return command(l, ESP_READ_REG, data, sizeof(data), 0, ESP_TIMEOUT_DEFAULT, value, NULL, NULL);
+}
+
+int esp_loader_write_reg(esp_loader *l, uint32_t addr, uint32_t value, uint32_t mask, uint32_t delay_us) {
+    uint8_t data[16];
+    put_le32(data, addr);
+    put_le32(data + 4, value);
+    put_le32(data + 8, mask);
+    put_le32(data + 12, delay_us);
+    return command(l, ESP_WRITE_REG, data, sizeof(data), 0, ESP_TIMEOUT_DEFAULT, NULL, NULL, NULL);
+}
+
+int esp_loader_spi_attach(esp_loader *l, uint32_t flash_size) {
+    // Pines SPI por defecto (hspi_arg = 0), no es un chip ESP32 antiguo
+    uint8_t attach[8] = { 0 };
+    int ret = command(l, ESP_SPI_ATTACH, attach, sizeof(attach), 0, ESP_TIMEOUT_DEFAULT, NULL, NULL, NULL);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    uint8_t params[24];
+    put_le32(params, 0);                    // id de la flash
+    put_le32(params + 4, flash_size);
+    put_le32(params + 8, 64 * 1024);        // bloque
+    put_le32(params + 12, ESP_FLASH_SECTOR_SIZE);
+    put_le32(params + 16, 256);             // página
+    put_le32(params + 20, 0xffff);          // máscara de estado
+    return command(l, ESP_SPI_SET_PARAMS, params, sizeof(params), 0, ESP_TIMEOUT_DEFAULT, NULL, NULL, NULL);
+}
+
+// Familias según el registro mágico
+static const struct {
+    uint32_t    magic;
+    const char *family;
+} chip_families[] = {
+    { ESP_CHIP_MAGIC_ESP32, "ESP32" },
+    { 0x000007c6, "ESP32-S2" },
+    { 0x00000009, "ESP32-S3" },
+    { 0x6921506f, "ESP32-C3" },
+    { 0x1b31506f, "ESP32-C3" },
+    { 0x2ce0806f, "ESP32-C6" },
+};
+
+// Encapsulados del ESP32 por CHIP_VER_PKG. Los que traen la flash adentro no
+// tienen pines libres para una PSRAM externa; los V3 con R2 la traen adentro.
+// En los D0WD depende del módulo (WROOM o WROVER) y el ROM no lo puede saber.
+static const struct {
+    const char *name;
+    esp_psram   psram;
+} esp32_packages[] = {
+    { "ESP32-D0WDQ6",       ESP_PSRAM_UNKNOWN },
+    { "ESP32-D0WD",         ESP_PSRAM_UNKNOWN },
+    { "ESP32-D2WD",         ESP_PSRAM_NO },
+    { NULL,                 ESP_PSRAM_UNKNOWN },
+    { "ESP32-U4WDH",        ESP_PSRAM_NO },
+    { "ESP32-PICO-D4",      ESP_PSRAM_NO },
+    { "ESP32-PICO-V3-02",   ESP_PSRAM_YES },
+    { "ESP32-D0WDR2-V3",    ESP_PSRAM_YES },
+};
+
+#define CHIP_FAMILIES   (int)(sizeof(chip_families) / sizeof(chip_families[0]))
+#define ESP32_PACKAGES  (int)(sizeof(esp32_packages) / sizeof(esp32_packages[0]))
+
+// Manda RDID a la flash a través de los registros del SPI1, como esptool
+static int read_flash_id(esp_loader *l, uint32_t *id) {
+    uint32_t usr, usr2, cmd;
+    int ret = esp_loader_read_reg(l, ESP_SPI_USR_REG, &usr);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_read_reg(l, ESP_SPI_USR2_REG, &usr2);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    // Comando de 8 bits sin datos de salida y 24 bits de respuesta
+    ret = esp_loader_write_reg(l, ESP_SPI_MOSI_DLEN_REG, 0, 0xffffffff, 0);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_write_reg(l, ESP_SPI_MISO_DLEN_REG, 24 - 1, 0xffffffff, 0);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_write_reg(l, ESP_SPI_USR_REG, ESP_SPI_USR_COMMAND | ESP_SPI_USR_MISO, 0xffffffff, 0);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_write_reg(l, ESP_SPI_USR2_REG, (7u << 28) | ESP_SPIFLASH_RDID, 0xffffffff, 0);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_write_reg(l, ESP_SPI_W0_REG, 0, 0xffffffff, 0);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_write_reg(l, ESP_SPI_CMD_REG, ESP_SPI_CMD_USR, 0xffffffff, 0);
+
+    // El bit USR se limpia solo al terminar la transferencia
+    for (int i = 0; ret == ESP_LOADER_OK; i++) {
+        ret = esp_loader_read_reg(l, ESP_SPI_CMD_REG, &cmd);
+        if (ret != ESP_LOADER_OK || !(cmd & ESP_SPI_CMD_USR)) break;
+        if (i == 10) {
+            snprintf(l->error, sizeof(l->error), "SPI flash command did not finish");
+            ret = ESP_LOADER_TIMEOUT;
+        }
+    }
+    if (ret == ESP_LOADER_OK) ret = esp_loader_read_reg(l, ESP_SPI_W0_REG, id);
+    if (ret == ESP_LOADER_CANCELLED) return ret;
+
+    // Dejar el controlador como estaba para el ROM
+    int restore = esp_loader_write_reg(l, ESP_SPI_USR_REG, usr, 0xffffffff, 0);
+    if (restore == ESP_LOADER_OK) restore = esp_loader_write_reg(l, ESP_SPI_USR2_REG, usr2, 0xffffffff, 0);
+    return ret != ESP_LOADER_OK ? ret : restore;
+}
+
+int esp_loader_identify(esp_loader *l, esp_chip_info *info) {
+    memset(info, 0, sizeof(*info));
+    info->package = -1;
+
+    double start = metrics_now();
+    int ret = esp_loader_read_reg(l, ESP_CHIP_MAGIC_REG, &info->magic);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    snprintf(info->family, sizeof(info->family), "unknown chip (magic 0x%08x)", info->magic);
+    for (int i = 0; i < CHIP_FAMILIES; i++) {
+        if (chip_families[i].magic == info->magic) snprintf(info->family, sizeof(info->family), "%s", chip_families[i].family);
+    }
+    snprintf(info->name, sizeof(info->name), "%s", info->family);
+
+    // Las direcciones del eFuse y del SPI1 son las del ESP32
+    if (info->magic != ESP_CHIP_MAGIC_ESP32) {
+        metrics_phase(METRICS_IDENTIFY, l->port, start, 0, 1);
+        return ESP_LOADER_OK;
+    }
+
+    uint32_t word;
+    ret = esp_loader_read_reg(l, ESP_EFUSE_BLK0_RDATA3, &word);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    info->package = (int)(((word >> 9) & 0x07) | (((word >> 2) & 0x01) << 3));
+    if (info->package < ESP32_PACKAGES && esp32_packages[info->package].name) {
+        snprintf(info->name, sizeof(info->name), "%s", esp32_packages[info->package].name);
+        info->psram = esp32_packages[info->package].psram;
+    }
+
+    ret = esp_loader_spi_attach(l, ESP_FLASH_SIZE_DEFAULT);
+    if (ret == ESP_LOADER_OK) ret = read_flash_id(l, &info->flash_id);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    // El tercer byte del JEDEC ID es log2 del tamaño (256 KB a 32 MB)
+    int capacity = (int)((info->flash_id >> 16) & 0xff);
+    if (capacity >= 0x12 && capacity <= 0x19) info->flash_size = 1u << capacity;
+    l->flash_size = info->flash_size;
+
+    metrics_phase(METRICS_IDENTIFY, l->port, start, 0, 1);
+    return ESP_LOADER_OK;
+}
+
+void esp_chip_describe(const esp_chip_info *info, char *buf, size_t size) {
+    int len = snprintf(buf, size, "%s", info->name);
+    if (len < 0 || (size_t)len >= size) return;
+
+    if (info->psram == ESP_PSRAM_YES) len += snprintf(buf + len, size - len, ", embedded PSRAM");
+    else if (info->psram == ESP_PSRAM_NO) len += snprintf(buf + len, size - len, ", no PSRAM");
+    if ((size_t)len >= size) return;
+
+    if (info->flash_size >= 1024 * 1024) snprintf(buf + len, size - len, ", %u MB flash", info->flash_size >> 20);
+    else if (info->flash_size) snprintf(buf + len, size - len, ", %u KB flash", info->flash_size >> 10);
+}
+
+int esp_loader_change_baud(esp_loader *l, int baud) {
+    if (baud == l->baud) return ESP_LOADER_OK;
+
+    if (!transport_baud_supported(baud)) {
+        snprintf(l->error, sizeof(l->error), "Unsupported baud rate: %d", baud);
+        return ESP_LOADER_FAILED;
+    }
+
+    // El ROM responde todavía a la velocidad anterior (0 = la del ROM)
+    uint8_t data[8];
+    put_le32(data, (uint32_t)baud);
+    put_le32(data + 4, 0);
+    int ret = command(l, ESP_CHANGE_BAUDRATE, data, sizeof(data), 0, ESP_TIMEOUT_DEFAULT, NULL, NULL, NULL);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    if (transport_set_baud(&l->link, baud) != 0) {
+        snprintf(l->error, sizeof(l->error), "Can't set the port to %d baud", baud);
+        return ESP_LOADER_ERROR;
+    }
+    l->baud = baud;
+
+    // Dejar que el ROM termine de cambiar y descartar lo que llegó mezclado
+#if defined(_WIN32) || defined(_WIN64)
+    Sleep(50);
+#else
+    usleep(50000);
+#endif
+    flush_input(l);
+    return ESP_LOADER_OK;
+}
+
+// Velocidades que prueba la negociación automática, de menor a mayor
+static const int auto_baud_rates[] = {
+    230400,
+#ifndef __APPLE__
+    460800, 921600, 1500000, 2000000, 3000000,
+#endif
+};
+
+#define AUTO_BAUD_RATES (int)(sizeof(auto_baud_rates) / sizeof(auto_baud_rates[0]))
+
+int esp_loader_lower_baud(int baud) {
+    int lower = ESP32_ROM_BAUD;
+    for (int i = 0; i < AUTO_BAUD_RATES && auto_baud_rates[i] < baud; i++) lower = auto_baud_rates[i];
+    return lower;
+}
+
+int esp_loader_link_test(esp_loader *l) {
+    uint8_t reg[4], region[16];
+    put_le32(reg, ESP_CHIP_MAGIC_REG);
+    put_le32(region, 0);
+    put_le32(region + 4, ESP_LINK_TEST_MD5_SIZE);
+    put_le32(region + 8, 0);
+    put_le32(region + 12, 0);
+
+    // Plazos cortos: un enlace que no responde a tiempo ya se considera malo
+    for (int i = 0; i < ESP_LINK_TEST_ROUNDS; i++) {
+        uint32_t magic;
+        int ret = command(l, ESP_READ_REG, reg, sizeof(reg), 0, ESP_TIMEOUT_LINK_TEST, &magic, NULL, NULL);
+        if (ret == ESP_LOADER_CANCELLED) return ret;
+        int ok = ret == ESP_LOADER_OK && magic == l->link_magic;
+
+        // Cada cuatro lecturas, una respuesta larga: el MD5 en hexadecimal
+        if (ok && i % 4 == 3) {
+            const uint8_t *body;
+            size_t len;
+            ret = command(l, ESP_SPI_FLASH_MD5, region, sizeof(region), 0, ESP_TIMEOUT_LINK_TEST, NULL, &body, &len);
+            if (ret == ESP_LOADER_CANCELLED) return ret;
+            ok = ret == ESP_LOADER_OK && len >= 32 && memcmp(body, l->link_md5, 32) == 0;
+        }
+
+        if (!ok) {
+            snprintf(l->error, sizeof(l->error), "Link test failed at %d baud", l->baud);
+            return ESP_LOADER_FAILED;
+        }
+    }
+    return ESP_LOADER_OK;
+}
+
+// Vuelve a una velocidad que funcionó; si el enlace no responde, reconecta desde cero
+static int restore_baud(esp_loader *l, int baud) {
+    if (esp_loader_change_baud(l, baud) == ESP_LOADER_OK && esp_loader_link_test(l) == ESP_LOADER_OK) return ESP_LOADER_OK;
+    if (cancelled(l)) return ESP_LOADER_CANCELLED;
+
+    int ret = esp_loader_connect(l);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_change_baud(l, baud);
+    return ret;
+}
+
+int esp_loader_auto_baud(esp_loader *l, int hint, esp_baud_report_fn report, void *ctx) {
+    // Respuestas de referencia a la velocidad segura
+    int ret = esp_loader_read_reg(l, ESP_CHIP_MAGIC_REG, &l->link_magic);
+    if (ret == ESP_LOADER_OK) ret = esp_loader_spi_attach(l, ESP_FLASH_SIZE_DEFAULT);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    uint8_t region[16];
+    put_le32(region, 0);
+    put_le32(region + 4, ESP_LINK_TEST_MD5_SIZE);
+    put_le32(region + 8, 0);
+    put_le32(region + 12, 0);
+
+    const uint8_t *body;
+    size_t len;
+    ret = command(l, ESP_SPI_FLASH_MD5, region, sizeof(region), 0, ESP_TIMEOUT_DEFAULT, NULL, &body, &len);
+    if (ret != ESP_LOADER_OK) return ret;
+    if (len < 32) {
+        snprintf(l->error, sizeof(l->error), "SPI_FLASH_MD5: short response");
+        return ESP_LOADER_FAILED;
+    }
+    memcpy(l->link_md5, body, 32);
+
+    int best = l->baud;
+
+    // Primero la velocidad que funcionó la última vez; si todavía anda no hace falta subir de a una
+    if (hint > best) {
+        long long start = now_ms();
+        ret = esp_loader_change_baud(l, hint);
+        if (ret == ESP_LOADER_OK) ret = esp_loader_link_test(l);
+        if (ret == ESP_LOADER_CANCELLED) return ret;
+
+        if (report) report(ctx, hint, ret == ESP_LOADER_OK, (int)(now_ms() - start));
+        if (ret == ESP_LOADER_OK) return hint;
+
+        ret = restore_baud(l, best);
+        if (ret != ESP_LOADER_OK) return ret;
+    }
+
+    for (int i = 0; i < AUTO_BAUD_RATES; i++) {
+        if (auto_baud_rates[i] <= best) continue;
+
+        long long start = now_ms();
+        ret = esp_loader_change_baud(l, auto_baud_rates[i]);
+        if (ret == ESP_LOADER_OK) ret = esp_loader_link_test(l);
+        if (ret == ESP_LOADER_CANCELLED) return ret;
+
+        if (report) report(ctx, auto_baud_rates[i], ret == ESP_LOADER_OK, (int)(now_ms() - start));
+
+        if (ret == ESP_LOADER_OK) {
+            best = auto_baud_rates[i];
+            continue;
+        }
+
+        ret = restore_baud(l, best);
+        if (ret != ESP_LOADER_OK) return ret;
+        break;
+    }
+
+    return best;
+}
+
+int esp_loader_flash_begin(esp_loader *l, uint32_t offset, uint32_t size) {
+    uint32_t blocks = (size + ESP_FLASH_BLOCK_SIZE - 1) / ESP_FLASH_BLOCK_SIZE;
+
+    uint8_t data[16];
+    put_le32(data, size);                   // bytes a borrar
+    put_le32(data + 4, blocks);
+    put_le32(data + 8, ESP_FLASH_BLOCK_SIZE);
+    put_le32(data + 12, offset);
+
+    double start = metrics_now();
+    int ret = command(l, ESP_FLASH_BEGIN, data, sizeof(data), 0,
+                      timeout_for_size(ESP_TIMEOUT_ERASE_PER_MB, size), NULL, NULL, NULL);
+    metrics_phase(METRICS_ERASE, l->port, start, size, ret == ESP_LOADER_OK);
+    return ret;
+}
+
+// Envía un bloque de FLASH_DATA o FLASH_DEFL_DATA (los de datos sin comprimir van completos)
+static int send_block(esp_loader *l, uint8_t op, const uint8_t *data, size_t len, uint32_t seq, size_t block_len, int timeout_ms) {
+    uint8_t packet[16 + ESP_FLASH_BLOCK_SIZE];
+
+    if (len > ESP_FLASH_BLOCK_SIZE) len = ESP_FLASH_BLOCK_SIZE;
+    if (block_len < len) block_len = len;
+    memcpy(packet + 16, data, len);
+    memset(packet + 16 + len, 0xff, block_len - len);
+
+    put_le32(packet, (uint32_t)block_len);
+    put_le32(packet + 4, seq);
+    put_le32(packet + 8, 0);
+    put_le32(packet + 12, 0);
+
+    int ret = command(l, op, packet, 16 + block_len, checksum(packet + 16, block_len), timeout_ms, NULL, NULL, NULL);
+    if (ret == ESP_LOADER_FAILED || ret == ESP_LOADER_TIMEOUT) {
+        size_t n = strlen(l->error);
+        snprintf(l->error + n, sizeof(l->error) - n, " (block %u)", seq);
+    }
+    return ret;
+}
+
+int esp_loader_flash_data(esp_loader *l, const uint8_t *data, size_t len, uint32_t seq) {
+    return send_block(l, ESP_FLASH_DATA, data, len, seq, ESP_FLASH_BLOCK_SIZE, ESP_TIMEOUT_DEFAULT);
+}
+
+int esp_loader_flash_end(esp_loader *l, int reboot) {
+    uint8_t data[4];
+    put_le32(data, reboot ? 0 : 1);
+    return command(l, ESP_FLASH_END, data, sizeof(data), 0, ESP_TIMEOUT_DEFAULT, NULL, NULL, NULL);
+}
+
+int esp_loader_flash_defl_begin(esp_loader *l, uint32_t offset, uint32_t size, uint32_t compressed_size) {
+    uint32_t blocks = (compressed_size + ESP_FLASH_BLOCK_SIZE - 1) / ESP_FLASH_BLOCK_SIZE;
+
+    // El ROM espera el tamaño a borrar redondeado a sectores
+    uint32_t erase_size = (size + ESP_FLASH_SECTOR_SIZE - 1) / ESP_FLASH_SECTOR_SIZE * ESP_FLASH_SECTOR_SIZE;
+
+    uint8_t data[16];
+    put_le32(data, erase_size);
+    put_le32(data + 4, blocks);
+    put_le32(data + 8, ESP_FLASH_BLOCK_SIZE);
+    put_le32(data + 12, offset);
+
+    double start = metrics_now();
+    int ret = command(l, ESP_FLASH_DEFL_BEGIN, data, sizeof(data), 0,
+                      timeout_for_size(ESP_TIMEOUT_ERASE_PER_MB, size), NULL, NULL, NULL);
+    metrics_phase(METRICS_ERASE, l->port, start, erase_size, ret == ESP_LOADER_OK);
+    return ret;
+}
+
+int esp_loader_flash_defl_data(esp_loader *l, const uint8_t *data, size_t len, uint32_t seq, uint32_t inflated) {
+    return send_block(l, ESP_FLASH_DEFL_DATA, data, len, seq, len, timeout_for_size(ESP_TIMEOUT_WRITE_PER_MB, inflated));
+}
+
+int esp_loader_flash_defl_end(esp_loader *l, int reboot) {
+    uint8_t data[4];
+    put_le32(data, reboot ? 0 : 1);
+    return command(l, ESP_FLASH_DEFL_END, data, sizeof(data), 0, ESP_TIMEOUT_DEFAULT, NULL, NULL, NULL);
+}
+
+static int hex_value(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int esp_loader_flash_md5(esp_loader *l, uint32_t offset, uint32_t size, uint8_t md5[16]) {
+    uint8_t data[16];
+    put_le32(data, offset);
+    put_le32(data + 4, size);
+    put_le32(data + 8, 0);
+    put_le32(data + 12, 0);
+
+    const uint8_t *body;
+    size_t len;
+    int ret = command(l, ESP_SPI_FLASH_MD5, data, sizeof(data), 0,
+                      timeout_for_size(ESP_TIMEOUT_MD5_PER_MB, size), NULL, &body, &len);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    // El ROM responde el MD5 en hexadecimal; un stub lo devuelve en binario
+    if (len >= 32) {
+        for (int i = 0; i < 16; i++) {
+            int hi = hex_value(body[i * 2]), lo = hex_value(body[i * 2 + 1]);
+            if (hi < 0 || lo < 0) {
+                snprintf(l->error, sizeof(l->error), "SPI_FLASH_MD5: malformed response");
+                return ESP_LOADER_FAILED;
+            }
+            md5[i] = (uint8_t)(hi << 4 | lo);
+        }
+    } else if (len >= 16) {
+        memcpy(md5, body, 16);
+    } else {
+        snprintf(l->error, sizeof(l->error), "SPI_FLASH_MD5: short response");
+        return ESP_LOADER_FAILED;
+    }
+    return ESP_LOADER_OK;
+}
+
+// Falla de la imagen mientras se graba: la descarga abortó o se canceló
+static int image_failed(esp_loader *l) {
+    snprintf(l->error, sizeof(l->error), "Firmware download failed while flashing");
+    return cancelled(l) ? ESP_LOADER_CANCELLED : ESP_LOADER_ERROR;
+}
+
+// Avance acumulado de una escritura que puede tener varios tramos
+typedef struct {
+    esp_progress_fn fn;
+    void           *ctx;
+    uint32_t        done;       // bytes de los tramos anteriores
+    uint32_t        total;      // bytes a escribir en total
+} progress_state;
+
+static void report_progress(progress_state *p, uint32_t done) {
+    if (p->fn) p->fn(p->ctx, p->done + done, p->total);
+}
+
+// Envía los bloques sin comprimir a medida que la descarga los publica
+static int write_plain(esp_loader *l, image_stream *image, uint32_t offset, uint32_t pos, uint32_t size,
+                       md5_ctx *md5, progress_state *progress) {
+    int ret = esp_loader_flash_begin(l, offset + pos, size);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    // Incluye las esperas a la descarga cuando el flasheo la alcanza
+    double start = metrics_now();
+    uint32_t seq = 0;
+    for (uint32_t done = 0; ret == ESP_LOADER_OK && done < size; done += ESP_FLASH_BLOCK_SIZE, seq++) {
+        size_t len = size - done < ESP_FLASH_BLOCK_SIZE ? size - done : ESP_FLASH_BLOCK_SIZE;
+
+        const uint8_t *data = image_stream_wait(image, pos + done, len, l->cancel);
+        if (!data) {
+            ret = image_failed(l);
+            break;
+        }
+
+        if (md5) md5_update(md5, data, len);
+
+        ret = esp_loader_flash_data(l, data, len, seq);
+        if (ret == ESP_LOADER_OK) report_progress(progress, done + (uint32_t)len);
+    }
+    metrics_phase(METRICS_WRITE, l->port, start, size, ret == ESP_LOADER_OK);
+
+    if (ret == ESP_LOADER_OK) progress->done += size;
+    return ret;
+}
+
+// Comprime [pos, pos + size) de la imagen con deflate a medida que llega
+static int compress_image(esp_loader *l, image_stream *image, uint32_t pos, uint32_t size, md5_ctx *md5, byte_buffer *out) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit(&z, ESP_DEFLATE_LEVEL) != Z_OK) {
+        snprintf(l->error, sizeof(l->error), "Can't initialize deflate");
+        return ESP_LOADER_ERROR;
+    }
+
+    int ret = ESP_LOADER_OK;
+    uint8_t chunk[16384];
+    uint32_t done = 0;
+    int flush;
+
+    do {
+        size_t len = size - done < 65536 ? size - done : 65536;
+        const uint8_t *data = image_stream_wait(image, pos + done, len, l->cancel);
+        if (!data) {
+            ret = image_failed(l);
+            break;
+        }
+        if (md5) md5_update(md5, data, len);
+        done += (uint32_t)len;
+
+        z.next_in = (Bytef *)data;
+        z.avail_in = (uInt)len;
+        flush = done == size ? Z_FINISH : Z_NO_FLUSH;
+
+        do {
+            z.next_out = chunk;
+            z.avail_out = sizeof(chunk);
+            deflate(&z, flush);
+            if (byte_buffer_append(out, chunk, sizeof(chunk) - z.avail_out) != 0) {
+                snprintf(l->error, sizeof(l->error), "Out of memory compressing the image");
+                ret = ESP_LOADER_ERROR;
+                break;
+            }
+        } while (z.avail_out == 0);
+    } while (ret == ESP_LOADER_OK && flush != Z_FINISH);
+
+    deflateEnd(&z);
+    return ret;
+}
+
+/*
+ * Envía el flujo zlib en bloques. Cada bloque se descomprime también aquí para
+ * saber cuántos bytes va a grabar el ROM y darle un plazo acorde.
+ */
+static int write_compressed(esp_loader *l, const byte_buffer *packed, uint32_t offset, uint32_t size,
+                            progress_state *progress) {
+    int ret = esp_loader_flash_defl_begin(l, offset, size, (uint32_t)packed->len);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit(&z) != Z_OK) {
+        snprintf(l->error, sizeof(l->error), "Can't initialize inflate");
+        return ESP_LOADER_ERROR;
+    }
+
+    uint8_t scratch[16384];
+    uint32_t written = 0, seq = 0;
+    double start = metrics_now();
+
+    for (size_t pos = 0; pos < packed->len; pos += ESP_FLASH_BLOCK_SIZE, seq++) {
+        size_t len = packed->len - pos < ESP_FLASH_BLOCK_SIZE ? packed->len - pos : ESP_FLASH_BLOCK_SIZE;
+        const uint8_t *block = (const uint8_t *)packed->data + pos;
+
+        uint32_t inflated = 0;
+        z.next_in = (Bytef *)block;
+        z.avail_in = (uInt)len;
+        do {
+            z.next_out = scratch;
+            z.avail_out = sizeof(scratch);
+            if (inflate(&z, Z_NO_FLUSH) < 0) break;
+            inflated += (uint32_t)(sizeof(scratch) - z.avail_out);
+        } while (z.avail_out == 0);
+
+        ret = esp_loader_flash_defl_data(l, block, len, seq, inflated);
+        if (ret != ESP_LOADER_OK) break;
+
+        written += inflated;
+        report_progress(progress, written < size ? written : size);
+    }
+
+    inflateEnd(&z);
+    metrics_phase(METRICS_WRITE, l->port, start, (long long)packed->len, ret == ESP_LOADER_OK);
+    if (ret == ESP_LOADER_OK) progress->done += size;
+    return ret;
+}
+
+// Escribe [pos, pos + size) de la imagen en offset + pos; acumula bytes enviados y tiempo
+static int write_range(esp_loader *l, image_stream *image, uint32_t offset, uint32_t pos, uint32_t size, int compress,
+                       md5_ctx *md5, progress_state *progress, esp_write_stats *stats) {
+    int ret;
+    long long start;
+
+    if (compress) {
+        byte_buffer packed;
+        byte_buffer_init(&packed);
+
+        double begin = metrics_now();
+        ret = compress_image(l, image, pos, size, md5, &packed);
+        metrics_phase(METRICS_COMPRESS, l->port, begin, size, ret == ESP_LOADER_OK);
+
+        start = now_ms();
+        if (ret == ESP_LOADER_OK) ret = write_compressed(l, &packed, offset + pos, size, progress);
+        stats->wire_size += (uint32_t)packed.len;
+
+        byte_buffer_free(&packed);
+    } else {
+        start = now_ms();
+        ret = write_plain(l, image, offset, pos, size, md5, progress);
+        stats->wire_size += size;
+    }
+
+    stats->written += size;
+    stats->seconds += (now_ms() - start) / 1000.0;
+    return ret;
+}
+
+// Largo de la región i del modo diferencial (la última puede ser más corta)
+static uint32_t region_length(uint32_t size, int i) {
+    uint32_t pos = (uint32_t)i * ESP_DIFF_REGION_SIZE;
+    return size - pos < ESP_DIFF_REGION_SIZE ? size - pos : ESP_DIFF_REGION_SIZE;
+}
+
+// Hilo que calcula el MD5 de las regiones first, first + step, ...
+typedef struct {
+    const uint8_t  *data;
+    uint32_t        size;
+    int             first;
+    int             step;
+    int             count;
+    uint8_t       (*digests)[MD5_DIGEST_SIZE];
+} region_hasher;
+
+static void *hash_regions(void *arg) {
+    region_hasher *h = (region_hasher *)arg;
+
+    for (int i = h->first; i < h->count; i += h->step) {
+        md5_ctx md5;
+        md5_init(&md5);
+        md5_update(&md5, h->data + (size_t)i * ESP_DIFF_REGION_SIZE, region_length(h->size, i));
+        md5_final(&md5, h->digests[i]);
+    }
+    return NULL;
+}
+
+// Hilo que calcula el MD5 de la imagen completa, para la verificación final
+typedef struct {
+    const uint8_t  *data;
+    uint32_t        size;
+    uint8_t         digest[MD5_DIGEST_SIZE];
+} image_hasher;
+
+static void *hash_image(void *arg) {
+    image_hasher *h = (image_hasher *)arg;
+
+    md5_ctx md5;
+    md5_init(&md5);
+    md5_update(&md5, h->data, h->size);
+    md5_final(&md5, h->digest);
+    return NULL;
+}
+
+static int cpu_count(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/*
+ * Calcula en paralelo el MD5 de cada región y, si full no es NULL, el de la
+ * imagen completa. Si no se puede crear un hilo su trabajo se hace en el hilo actual.
+ */
+static void hash_local(const uint8_t *data, uint32_t size, int count, uint8_t (*digests)[MD5_DIGEST_SIZE],
+                       uint8_t full[MD5_DIGEST_SIZE]) {
+    int threads = cpu_count();
+    if (threads > ESP_HASH_THREADS_MAX) threads = ESP_HASH_THREADS_MAX;
+    if (threads > count) threads = count;
+
+    region_hasher hashers[ESP_HASH_THREADS_MAX];
+    pthread_t ids[ESP_HASH_THREADS_MAX + 1];
+    int started[ESP_HASH_THREADS_MAX + 1] = { 0 };
+
+    image_hasher whole = { data, size, { 0 } };
+    if (full) started[0] = pthread_create(&ids[0], NULL, hash_image, &whole) == 0;
+
+    for (int t = 0; t < threads; t++) {
+        hashers[t] = (region_hasher){ data, size, t, threads, count, digests };
+        started[t + 1] = pthread_create(&ids[t + 1], NULL, hash_regions, &hashers[t]) == 0;
+        if (!started[t + 1]) hash_regions(&hashers[t]);
+    }
+
+    if (started[0]) pthread_join(ids[0], NULL);
+    else if (full) hash_image(&whole);
+    for (int t = 0; t < threads; t++) {
+        if (started[t + 1]) pthread_join(ids[t + 1], NULL);
+    }
+
+    if (full) memcpy(full, whole.digest, MD5_DIGEST_SIZE);
+}
+
+/*
+ * Compara la flash con la imagen por regiones.
+ *
+ * Los MD5 del chip se piden mientras la descarga sigue; los locales se
+ * calculan cuando la imagen está completa. changed[i] queda en 1 para cada
+ * región distinta y full recibe el MD5 de la imagen completa, el de la
+ * descarga si lo calculó.
+ */
+static int diff_image(esp_loader *l, image_stream *image, uint32_t offset, uint32_t size,
+                      uint8_t *changed, uint8_t full[MD5_DIGEST_SIZE], esp_write_stats *stats) {
+    int count = (int)((size + ESP_DIFF_REGION_SIZE - 1) / ESP_DIFF_REGION_SIZE);
+    uint8_t (*device)[MD5_DIGEST_SIZE] = malloc((size_t)count * MD5_DIGEST_SIZE);
+    uint8_t (*local)[MD5_DIGEST_SIZE] = malloc((size_t)count * MD5_DIGEST_SIZE);
+    int ret = ESP_LOADER_OK;
+
+    if (!device || !local) {
+        snprintf(l->error, sizeof(l->error), "Out of memory comparing the flash");
+        ret = ESP_LOADER_ERROR;
+    }
+
+    long long start = now_ms();
+    double begin = metrics_now();
+    for (int i = 0; ret == ESP_LOADER_OK && i < count; i++) {
+        ret = esp_loader_flash_md5(l, offset + (uint32_t)i * ESP_DIFF_REGION_SIZE, region_length(size, i), device[i]);
+    }
+    metrics_phase(METRICS_DIFF, l->port, begin, size, ret == ESP_LOADER_OK);
+    stats->seconds += (now_ms() - start) / 1000.0;
+
+    const uint8_t *data = NULL;
+    if (ret == ESP_LOADER_OK) {
+        char sha256[65];
+        if (image_stream_wait_complete(image, sha256, l->cancel) != 0 ||
+            !(data = image_stream_wait(image, 0, size, l->cancel))) {
+            ret = image_failed(l);
+        }
+    }
+
+    if (ret == ESP_LOADER_OK) {
+        int downloaded = image_stream_md5(image, full) == 0;
+        hash_local(data, size, count, local, downloaded ? NULL : full);
+        for (int i = 0; i < count; i++) changed[i] = memcmp(device[i], local[i], MD5_DIGEST_SIZE) != 0;
+    }
+
+    free(device);
+    free(local);
+    return ret;
+}
+
+// Compara el MD5 de la flash en [offset, offset + size) con el esperado
+static int verify_flash(esp_loader *l, uint32_t offset, uint32_t size, const uint8_t expected[MD5_DIGEST_SIZE]) {
+    uint8_t actual[MD5_DIGEST_SIZE];
+
+    int ret = esp_loader_flash_md5(l, offset, size, actual);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    if (memcmp(expected, actual, MD5_DIGEST_SIZE) != 0) {
+        char hex_expected[33], hex_actual[33];
+        digest_to_hex(expected, MD5_DIGEST_SIZE, hex_expected);
+        digest_to_hex(actual, MD5_DIGEST_SIZE, hex_actual);
+        snprintf(l->error, sizeof(l->error), "Flash verification failed: MD5 %s, expected %s", hex_actual, hex_expected);
+        return ESP_LOADER_VERIFY;
+    }
+    return ESP_LOADER_OK;
+}
+
+// Tramo de la imagen a escribir
+typedef struct {
+    uint32_t    pos;
+    uint32_t    size;
+} write_span;
+
+/*
+ * Tramos a escribir: los del mapa, y con changed (modo diferencial) solo la
+ * parte de cada uno que cae en regiones distintas.
+ */
+static int plan_spans(const image_map *map, const uint8_t *changed, write_span *spans) {
+    int count = 0;
+
+    for (int i = 0; i < map->extent_count; i++) {
+        uint32_t pos = map->extents[i].offset;
+        uint32_t end = pos + map->extents[i].size;
+
+        if (!changed) {
+            spans[count++] = (write_span){ pos, end - pos };
+            continue;
+        }
+
+        while (pos < end) {
+            uint32_t region_end = (pos / ESP_DIFF_REGION_SIZE + 1) * ESP_DIFF_REGION_SIZE;
+            if (!changed[pos / ESP_DIFF_REGION_SIZE]) {
+                pos = region_end < end ? region_end : end;
+                continue;
+            }
+
+            uint32_t start = pos;
+            while (pos < end && changed[pos / ESP_DIFF_REGION_SIZE]) {
+                region_end = (pos / ESP_DIFF_REGION_SIZE + 1) * ESP_DIFF_REGION_SIZE;
+                pos = region_end < end ? region_end : end;
+            }
+            spans[count++] = (write_span){ start, pos - start };
+        }
+    }
+    return count;
+}
+
+// Escritura dispersa: solo los tramos del mapa de la imagen, verificados uno por uno
+static int write_extents(esp_loader *l, image_stream *image, uint32_t offset, uint32_t size,
+                         const esp_write_options *options, esp_write_stats *stats) {
+    // La tabla y las cabeceras describen toda la imagen: el mapa necesita la descarga completa
+    char sha256[65];
+    const uint8_t *data = NULL;
+    if (image_stream_wait_complete(image, sha256, l->cancel) != 0 ||
+        !(data = image_stream_wait(image, 0, size, l->cancel))) {
+        return image_failed(l);
+    }
+
+    int regions = (int)((size + ESP_DIFF_REGION_SIZE - 1) / ESP_DIFF_REGION_SIZE);
+    image_map *map = malloc(sizeof(image_map));
+    uint8_t *changed = options->diff ? calloc((size_t)regions, 1) : NULL;
+    write_span *spans = NULL;
+    int ret = ESP_LOADER_OK;
+
+    if (!map || (options->diff && !changed)) {
+        snprintf(l->error, sizeof(l->error), "Out of memory mapping the image");
+        ret = ESP_LOADER_ERROR;
+    } else if (image_map_build(data, size, options->only, map) != 0) {
+        snprintf(l->error, sizeof(l->error), "%s", map->error);
+        ret = ESP_LOADER_FAILED;
+    } else {
+        stats->extents = map->extent_count;
+        stats->skipped = size - map->mapped;
+        spans = malloc((size_t)(map->extent_count + regions) * sizeof(write_span));
+        if (!spans) {
+            snprintf(l->error, sizeof(l->error), "Out of memory mapping the image");
+            ret = ESP_LOADER_ERROR;
+        }
+    }
+
+    if (ret == ESP_LOADER_OK && changed) {
+        uint8_t full[MD5_DIGEST_SIZE];
+        ret = diff_image(l, image, offset, size, changed, full, stats);
+    }
+
+    int count = ret == ESP_LOADER_OK ? plan_spans(map, changed, spans) : 0;
+
+    // MD5 de cada tramo, calculado en la misma pasada que lo envía
+    uint8_t (*digests)[MD5_DIGEST_SIZE] = count ? malloc((size_t)count * MD5_DIGEST_SIZE) : NULL;
+    if (count && !digests) {
+        snprintf(l->error, sizeof(l->error), "Out of memory mapping the image");
+        ret = ESP_LOADER_ERROR;
+    }
+
+    progress_state progress = { options->progress, options->ctx, 0, 0 };
+    for (int i = 0; i < count; i++) progress.total += spans[i].size;
+
+    for (int i = 0; ret == ESP_LOADER_OK && i < count; i++) {
+        md5_ctx md5;
+        md5_init(&md5);
+        ret = write_range(l, image, offset, spans[i].pos, spans[i].size, options->compress, &md5, &progress, stats);
+        md5_final(&md5, digests[i]);
+    }
+
+    // Cada tramo escrito se compara con su MD5; las regiones iguales ya las
+    // verificó la comparación y lo que quedó fuera del mapa no se tocó
+    if (ret == ESP_LOADER_OK && stats->written > 0) {
+        long long start = now_ms();
+        double begin = metrics_now();
+        for (int i = 0; ret == ESP_LOADER_OK && i < count; i++) {
+            ret = verify_flash(l, offset + spans[i].pos, spans[i].size, digests[i]);
+        }
+        metrics_phase(METRICS_VERIFY, l->port, begin, progress.total, ret == ESP_LOADER_OK);
+        stats->seconds += (now_ms() - start) / 1000.0;
+
+        if (ret == ESP_LOADER_OK && stats->written > 0) {
+            ret = options->compress ? esp_loader_flash_defl_end(l, 0) : esp_loader_flash_end(l, 0);
+        }
+    }
+
+    free(digests);
+    free(spans);
+    free(changed);
+    free(map);
+    return ret;
+}
+
+int esp_loader_write_image(esp_loader *l, image_stream *image, uint32_t offset,
+                           const esp_write_options *options, esp_write_stats *stats) {
+    esp_write_stats local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+
+    long long size = image_stream_wait_size(image, l->cancel);
+    if (size < 0) {
+        snprintf(l->error, sizeof(l->error), "Firmware image not available");
+        return cancelled(l) ? ESP_LOADER_CANCELLED : ESP_LOADER_ERROR;
+    }
+    if (size == 0 || (long long)offset + size > 16 * 1024 * 1024) {
+        snprintf(l->error, sizeof(l->error), "Invalid image size: %lld bytes at 0x%x", size, offset);
+        return ESP_LOADER_FAILED;
+    }
+    stats->size = (uint32_t)size;
+
+    // Con el tamaño leído de la flash, una imagen que no entra se rechaza antes de borrar nada
+    uint32_t flash_size = l->flash_size;
+    if (flash_size && (long long)offset + size > flash_size) {
+        snprintf(l->error, sizeof(l->error), "Image of %lld bytes at 0x%x does not fit in the %u KB flash",
+                 size, offset, flash_size >> 10);
+        return ESP_LOADER_FAILED;
+    }
+    if (!flash_size) {
+        flash_size = ESP_FLASH_SIZE_DEFAULT;
+        while ((long long)offset + size > flash_size) flash_size <<= 1;
+    }
+
+    int ret = esp_loader_spi_attach(l, flash_size);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    if (options->sparse || options->only) return write_extents(l, image, offset, (uint32_t)size, options, stats);
+
+    progress_state progress = { options->progress, options->ctx, 0, (uint32_t)size };
+    uint8_t expected[MD5_DIGEST_SIZE];
+
+    if (options->diff) {
+        int count = (int)((size + ESP_DIFF_REGION_SIZE - 1) / ESP_DIFF_REGION_SIZE);
+        uint8_t *changed = calloc((size_t)count, 1);
+        if (!changed) {
+            snprintf(l->error, sizeof(l->error), "Out of memory comparing the flash");
+            return ESP_LOADER_ERROR;
+        }
+
+        ret = diff_image(l, image, offset, (uint32_t)size, changed, expected, stats);
+
+        progress.total = 0;
+        for (int i = 0; i < count; i++) {
+            if (changed[i]) progress.total += region_length((uint32_t)size, i);
+        }
+
+        // Cada tramo de regiones distintas consecutivas se borra y se escribe de una vez
+        for (int i = 0; ret == ESP_LOADER_OK && i < count; ) {
+            if (!changed[i]) {
+                i++;
+                continue;
+            }
+            int j = i;
+            while (j < count && changed[j]) j++;
+
+            uint32_t pos = (uint32_t)i * ESP_DIFF_REGION_SIZE;
+            uint32_t end = (uint32_t)(j - 1) * ESP_DIFF_REGION_SIZE + region_length((uint32_t)size, j - 1);
+            ret = write_range(l, image, offset, pos, end - pos, options->compress, NULL, &progress, stats);
+            i = j;
+        }
+        free(changed);
+        if (ret != ESP_LOADER_OK) return ret;
+
+        // Nada que escribir: la comparación por regiones ya verificó la flash
+        if (stats->written == 0) return ESP_LOADER_OK;
+    } else {
+        md5_ctx md5;
+        md5_init(&md5);
+
+        ret = write_range(l, image, offset, 0, (uint32_t)size, options->compress, &md5, &progress, stats);
+        if (ret != ESP_LOADER_OK) return ret;
+
+        // No confirmar nada hasta que la descarga completa esté verificada
+        char sha256[65];
+        if (image_stream_wait_complete(image, sha256, l->cancel) != 0) return image_failed(l);
+
+        // La flash se compara con el MD5 de lo que llegó por la red, así la
+        // verificación cubre también la copia local; sin él, con lo enviado
+        md5_final(&md5, expected);
+        image_stream_md5(image, expected);
+    }
+
+    long long start = now_ms();
+    double begin = metrics_now();
+    ret = verify_flash(l, offset, (uint32_t)size, expected);
+    metrics_phase(METRICS_VERIFY, l->port, begin, size, ret == ESP_LOADER_OK);
+    stats->seconds += (now_ms() - start) / 1000.0;
+    if (ret != ESP_LOADER_OK) return ret;
+
+    return options->compress ? esp_loader_flash_defl_end(l, 0) : esp_loader_flash_end(l, 0);
+}
+
+void esp_loader_reboot(esp_loader *l) {
+    hard_reset_esp32(l->link.fd);
+}
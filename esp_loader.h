@@ -0,0 +1,368 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef ESP_LOADER_H
+#define ESP_LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp32_detect.h"
+#include "image_stream.h"
+#include "reset.h"
+#include "transport.h"
+
+// Comandos del protocolo del ROM loader
+#define ESP_FLASH_BEGIN         0x02
+#define ESP_FLASH_DATA          0x03
+#define ESP_FLASH_END           0x04
+#define ESP_SYNC                0x08
+#define ESP_WRITE_REG           0x09
+#define ESP_READ_REG            0x0a
+#define ESP_SPI_SET_PARAMS      0x0b
+#define ESP_SPI_ATTACH          0x0d
+#define ESP_CHANGE_BAUDRATE     0x0f
+#define ESP_FLASH_DEFL_BEGIN    0x10
+#define ESP_FLASH_DEFL_DATA     0x11
+#define ESP_FLASH_DEFL_END      0x12
+#define ESP_SPI_FLASH_MD5       0x13
+
+// Registro con el valor mágico del chip (0x00f01d83 en el ESP32)
+#define ESP_CHIP_MAGIC_REG      0x40001000
+#define ESP_CHIP_MAGIC_ESP32    0x00f01d83
+
+// eFuse del ESP32 con el encapsulado del chip (CHIP_VER_PKG)
+#define ESP_EFUSE_BLK0_RDATA3   0x3ff5a00c
+
+// Controlador SPI1 del ESP32, para mandarle comandos a la flash
+#define ESP_SPI_BASE            0x3ff42000
+#define ESP_SPI_CMD_REG         (ESP_SPI_BASE + 0x00)
+#define ESP_SPI_USR_REG         (ESP_SPI_BASE + 0x1c)
+#define ESP_SPI_USR2_REG        (ESP_SPI_BASE + 0x24)
+#define ESP_SPI_MOSI_DLEN_REG   (ESP_SPI_BASE + 0x28)
+#define ESP_SPI_MISO_DLEN_REG   (ESP_SPI_BASE + 0x2c)
+#define ESP_SPI_W0_REG          (ESP_SPI_BASE + 0x80)
+#define ESP_SPI_CMD_USR         (1u << 18)
+#define ESP_SPI_USR_COMMAND     (1u << 31)
+#define ESP_SPI_USR_MISO        (1u << 28)
+
+// Comando JEDEC de la flash: fabricante, tipo y capacidad
+#define ESP_SPIFLASH_RDID       0x9f
+
+// Semilla del checksum de los bloques de datos
+#define ESP_CHECKSUM_SEED       0xEF
+
+// Tamaño de bloque de FLASH_DATA que acepta el ROM
+#define ESP_FLASH_BLOCK_SIZE    0x400
+
+// Tamaño de sector que borra FLASH_BEGIN
+#define ESP_FLASH_SECTOR_SIZE   0x1000
+
+// Granularidad del modo diferencial: se compara y reescribe por regiones de este tamaño
+#define ESP_DIFF_REGION_SIZE    0x10000
+
+// Máximo de hilos para calcular los MD5 locales
+#define ESP_HASH_THREADS_MAX    8
+
+// Nivel de deflate para la escritura comprimida
+#define ESP_DEFLATE_LEVEL       9
+
+// Tamaño de flash asumido si la imagen entra en él
+#define ESP_FLASH_SIZE_DEFAULT  (4 * 1024 * 1024)
+
+// Plazos de los comandos (ms)
+#define ESP_TIMEOUT_DEFAULT     3000
+#define ESP_TIMEOUT_SYNC        100
+#define ESP_TIMEOUT_ERASE_PER_MB 30000
+#define ESP_TIMEOUT_WRITE_PER_MB 40000
+#define ESP_TIMEOUT_MD5_PER_MB  8000
+
+// Velocidad pedida con -b auto: se negocia la más alta que pase la prueba del enlace
+#define ESP_BAUD_AUTO           0
+
+// Prueba del enlace: lecturas del registro mágico y MD5 de la flash que se repiten
+#define ESP_LINK_TEST_ROUNDS    8
+#define ESP_LINK_TEST_MD5_SIZE  0x1000
+#define ESP_TIMEOUT_LINK_TEST   250
+
+// Códigos de error
+#define ESP_LOADER_OK           0
+#define ESP_LOADER_ERROR        -1      // error de E/S en el puerto
+#define ESP_LOADER_TIMEOUT      -2      // el ROM no respondió a tiempo
+#define ESP_LOADER_FAILED       -3      // el ROM rechazó el comando
+#define ESP_LOADER_CANCELLED    -4
+#define ESP_LOADER_VERIFY       -5      // el MD5 de la flash no coincide con la imagen
+
+// Una trama SLIP decodificada nunca supera esto (respuestas del ROM)
+#define ESP_LOADER_MAX_RESPONSE 256
+
+/*
+ * Sesión con el ROM loader del ESP32 a través del puerto serie.
+ *
+ * Los paquetes van en tramas SLIP: cabecera de 8 bytes (dirección, comando,
+ * tamaño y checksum/valor) seguida de los datos. Cada comando recibe una
+ * respuesta con el mismo código cuyo estado está en los últimos 4 bytes.
+ */
+typedef struct {
+    transport           link;
+    int                 baud;
+    const volatile int *cancel;
+    char                port[64];       // nombre del puerto, para las mediciones
+
+    // Recepción: lo leído del puerto y la trama en decodificación
+    uint8_t             rx[512];
+    size_t              rx_pos;
+    size_t              rx_len;
+    uint8_t             frame[ESP_LOADER_MAX_RESPONSE];
+    size_t              frame_len;
+
+    // Respuestas esperadas en la prueba del enlace, tomadas a la velocidad del ROM
+    uint32_t            link_magic;
+    uint8_t             link_md5[32];           // MD5 en hexadecimal, como lo envía el ROM
+
+    uint32_t            flash_size;     // tamaño leído por esp_loader_identify() (0 si no se conoce)
+
+    // Estrategias de reset por probar según el adaptador, y la que funcionó la última vez
+    reset_plan          reset_plan;
+    reset_strategy      reset;
+
+    char                error[160];     // descripción del último error
+} esp_loader;
+
+typedef enum {
+    ESP_PSRAM_UNKNOWN = 0,      // depende del módulo (PSRAM externa), no se ve desde el ROM
+    ESP_PSRAM_NO,
+    ESP_PSRAM_YES,
+} esp_psram;
+
+// Lo que se sabe del chip conectado sin correr código en él
+typedef struct esp_chip_info {
+    uint32_t    magic;          // valor de ESP_CHIP_MAGIC_REG
+    char        family[32];     // "ESP32", "ESP32-S3"...
+    char        name[32];       // familia y encapsulado, ej. "ESP32-D0WDQ6"
+    int         package;        // CHIP_VER_PKG, -1 si no se conoce
+    esp_psram   psram;
+    uint32_t    flash_id;       // JEDEC ID (fabricante en el byte bajo), 0 si no se leyó
+    uint32_t    flash_size;     // bytes, 0 si no se conoce
+} esp_chip_info;
+
+// Resultado de una escritura, para informar compresión y velocidad
+typedef struct {
+    uint32_t    size;           // bytes de la imagen
+    uint32_t    written;        // bytes reescritos (menos que size en modo diferencial)
+    uint32_t    wire_size;      // bytes de datos enviados (comprimidos o no)
+    uint32_t    skipped;        // bytes de relleno que no se borraron ni escribieron
+    int         extents;        // tramos del mapa disperso (0 sin mapa)
+    double      seconds;        // tiempo de trabajo con el chip, sin esperas de la descarga
+} esp_write_stats;
+
+/**
+ * @brief Notificación del avance de la escritura.
+ *
+ * @param ctx Contexto entregado a esp_loader_write_image().
+ * @param done Bytes de la imagen ya escritos.
+ * @param total Tamaño total de la imagen.
+ */
+typedef void (*esp_progress_fn)(void *ctx, uint32_t done, uint32_t total);
+
+/**
+ * @brief Resultado de probar una velocidad durante la negociación.
+ *
+ * @param ok 1 si el enlace funcionó sin errores a esa velocidad.
+ * @param ms Duración del cambio de velocidad más la prueba.
+ */
+typedef void (*esp_baud_report_fn)(void *ctx, int baud, int ok, int ms);
+
+// Opciones de esp_loader_write_image()
+typedef struct {
+    int             compress;       // enviar la imagen comprimida con deflate
+    int             diff;           // reescribir solo las regiones que cambiaron
+    esp_progress_fn progress;       // puede ser NULL
+    void           *ctx;            // contexto de progress
+    int             sparse;         // grabar solo los tramos con contenido (ver image_map.h)
+    const char     *only;           // partes a grabar, separadas por comas (o NULL)
+} esp_write_options;
+
+/**
+ * @brief Abre y configura el puerto para hablar con el ROM.
+ *
+ * @param cancel Bandera de cancelación (puede ser NULL) que se revisa durante las esperas.
+ * @return ESP_LOADER_OK o ESP_LOADER_ERROR.
+ */
+int esp_loader_open(esp_loader *l, const char *port, const volatile int *cancel);
+
+void esp_loader_close(esp_loader *l);
+
+/**
+ * @brief Resetea el chip en modo descarga y se sincroniza con el ROM.
+ *
+ * Recorre el plan de reset del adaptador (ver reset.h) hasta que el ROM
+ * contesta al SYNC; la estrategia que funcionó queda en l->reset y pasa a
+ * ser la primera para las reconexiones.
+ *
+ * El puerto vuelve a ESP32_ROM_BAUD, así sirve también para recuperarse
+ * de un enlace que falló a una velocidad más alta.
+ */
+int esp_loader_connect(esp_loader *l);
+
+/**
+ * @brief Prueba s antes que el resto del plan (p. ej. la registrada para la placa).
+ */
+void esp_loader_prefer_reset(esp_loader *l, const reset_strategy *s);
+
+/**
+ * @brief Como esp_loader_connect(), pero con el plan corto de un sondeo y sin
+ * registrar las fases.
+ *
+ * Sirve para sondear puertos: lo que no contesta al SYNC no es un ESP32.
+ */
+int esp_loader_probe(esp_loader *l);
+
+/**
+ * @brief Identifica el chip: familia por el registro mágico y, en el ESP32,
+ * el encapsulado por eFuse (de ahí si trae PSRAM) y la flash por su JEDEC ID.
+ *
+ * Deja l->flash_size con el tamaño leído para las escrituras siguientes.
+ */
+int esp_loader_identify(esp_loader *l, esp_chip_info *info);
+
+/**
+ * @brief Descripción del chip para mostrar, ej. "ESP32-D0WDQ6, 4 MB flash".
+ */
+void esp_chip_describe(const esp_chip_info *info, char *buf, size_t size);
+
+int esp_loader_read_reg(esp_loader *l, uint32_t addr, uint32_t *value);
+int esp_loader_write_reg(esp_loader *l, uint32_t addr, uint32_t value, uint32_t mask, uint32_t delay_us);
+
+/**
+ * @brief Conecta la flash SPI y le indica al ROM su geometría.
+ */
+int esp_loader_spi_attach(esp_loader *l, uint32_t flash_size);
+
+/**
+ * @brief Pasa el ROM y el puerto a otra velocidad.
+ */
+int esp_loader_change_baud(esp_loader *l, int baud);
+
+/**
+ * @brief Verifica que el enlace funciona a la velocidad actual.
+ *
+ * Repite lecturas del registro mágico y el MD5 del primer sector de la flash
+ * y compara con lo obtenido a la velocidad del ROM en esp_loader_auto_baud().
+ */
+int esp_loader_link_test(esp_loader *l);
+
+/**
+ * @brief Sube la velocidad paso a paso mientras el enlace pase la prueba.
+ *
+ * Se llama recién conectado. Si una velocidad falla se vuelve a la última
+ * buena (reconectando si hace falta) y se termina la búsqueda.
+ *
+ * @param hint Velocidad a probar antes que las demás, p. ej. la registrada
+ *             para la placa (0 si no hay); si pasa la prueba se usa directamente.
+ * @param report Se llama con el resultado de cada velocidad (puede ser NULL).
+ * @return La velocidad elegida, o un código de error negativo.
+ */
+int esp_loader_auto_baud(esp_loader *l, int hint, esp_baud_report_fn report, void *ctx);
+
+/**
+ * @brief Velocidad de la negociación inmediatamente inferior a baud.
+ *
+ * @return La velocidad inferior, o ESP32_ROM_BAUD si no hay otra.
+ */
+int esp_loader_lower_baud(int baud);
+
+/**
+ * @brief Borra la región [offset, offset + size) y prepara la escritura por bloques.
+ */
+int esp_loader_flash_begin(esp_loader *l, uint32_t offset, uint32_t size);
+
+/**
+ * @brief Envía un bloque de ESP_FLASH_BLOCK_SIZE bytes (el último se rellena con 0xFF).
+ */
+int esp_loader_flash_data(esp_loader *l, const uint8_t *data, size_t len, uint32_t seq);
+
+/**
+ * @brief Termina la escritura; reboot 0 deja al chip en el ROM loader.
+ */
+int esp_loader_flash_end(esp_loader *l, int reboot);
+
+/**
+ * @brief Borra la región y prepara la escritura de size bytes enviados comprimidos.
+ *
+ * @param compressed_size Tamaño del flujo zlib que se enviará en bloques.
+ */
+int esp_loader_flash_defl_begin(esp_loader *l, uint32_t offset, uint32_t size, uint32_t compressed_size);
+
+/**
+ * @brief Envía un bloque del flujo zlib; el ROM lo descomprime y lo graba.
+ *
+ * @param inflated Bytes que produce el bloque al descomprimirse (para el plazo).
+ */
+int esp_loader_flash_defl_data(esp_loader *l, const uint8_t *data, size_t len, uint32_t seq, uint32_t inflated);
+
+int esp_loader_flash_defl_end(esp_loader *l, int reboot);
+
+/**
+ * @brief Pide al ROM el MD5 de una región de la flash.
+ */
+int esp_loader_flash_md5(esp_loader *l, uint32_t offset, uint32_t size, uint8_t md5[16]);
+
+/**
+ * @brief Graba la imagen en offset a medida que llega la descarga.
+ *
+ * Sin compresión cada bloque se envía en cuanto está disponible en el
+ * stream. Con compresión la imagen se comprime a medida que llega y se
+ * envía al terminar, porque FLASH_DEFL_BEGIN necesita la cantidad de
+ * bloques comprimidos.
+ *
+ * En modo diferencial se pide al ROM el MD5 de cada región de
+ * ESP_DIFF_REGION_SIZE mientras la descarga sigue, se calculan los de la
+ * imagen en varios hilos y solo se borran y escriben las regiones distintas.
+ *
+ * Antes de terminar se espera a que la descarga esté completa y se compara
+ * el MD5 que calcula el ROM sobre la flash con el de la imagen.
+ *
+ * Con sparse (u only) la imagen se analiza al completarse la descarga y solo
+ * se borran y escriben los tramos del mapa; cada tramo se verifica por su
+ * cuenta y la flash fuera de ellos no se toca. Se combina con diff.
+ *
+ * @param stats Recibe tamaños y duración de la escritura (puede ser NULL).
+ * @return ESP_LOADER_OK o uno de los códigos de error (ver l->error).
+ */
+int esp_loader_write_image(esp_loader *l, image_stream *image, uint32_t offset,
+                           const esp_write_options *options, esp_write_stats *stats);
+
+/**
+ * @brief Sale del ROM loader reseteando el chip para que arranque el firmware.
+ */
+void esp_loader_reboot(esp_loader *l);
+
+#endif // ESP_LOADER_H
@@ -0,0 +1,482 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "especcyflash.h"
+#include "esp32_detect.h"
+#include "metrics.h"
+#include "registry.h"
+
+struct especcy_firmware {
+    char                repo[128];
+    char                asset_name[128];
+    image_stream        stream;
+    volatile int        cancel;
+    pthread_t           thread;
+    int                 started;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    especcy_state       state;
+    especcy_event_fn    on_event;
+    void               *ctx;
+    log_sink            log;            // mensajes de la descarga, como ESPECCY_EVENT_LOG
+};
+
+struct especcy_flash {
+    especcy_firmware       *firmware;
+    especcy_flash_config    config;
+    volatile int            cancel;
+    pthread_t               thread;
+    int                     started;
+    int                     percent;        // último avance notificado en el intento actual
+    log_sink                log;            // mensajes de la detección, como ESPECCY_EVENT_LOG
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    especcy_flash_status    status;         // protegido por lock
+};
+
+int especcy_init(const download_config *config) {
+    download_configure(config);
+    return download_global_init();
+}
+
+/* ---------------------------------------------------------------- firmware */
+
+static void firmware_log(void *ctx, log_level level, const char *text) {
+    especcy_firmware *fw = (especcy_firmware *)ctx;
+    if (!fw->on_event) return;
+
+    especcy_event event = { .type = ESPECCY_EVENT_LOG, .state = ESPECCY_DOWNLOADING, .asset = fw->asset_name,
+                            .level = level, .message = text };
+    fw->on_event(fw->ctx, &event);
+}
+
+especcy_firmware *especcy_firmware_create(const char *repo, const char *asset_name, especcy_event_fn on_event, void *ctx) {
+    especcy_firmware *fw = calloc(1, sizeof(especcy_firmware));
+    if (!fw) return NULL;
+
+    snprintf(fw->repo, sizeof(fw->repo), "%s", repo);
+    snprintf(fw->asset_name, sizeof(fw->asset_name), "%s", asset_name);
+    fw->on_event = on_event;
+    fw->ctx = ctx;
+    fw->log.fn = firmware_log;
+    fw->log.ctx = fw;
+    image_stream_init(&fw->stream);
+    pthread_mutex_init(&fw->lock, NULL);
+    pthread_cond_init(&fw->cond, NULL);
+    fw->state = ESPECCY_IDLE;
+    return fw;
+}
+
+static void firmware_set_state(especcy_firmware *fw, especcy_state state) {
+    pthread_mutex_lock(&fw->lock);
+    fw->state = state;
+    pthread_cond_broadcast(&fw->cond);
+    pthread_mutex_unlock(&fw->lock);
+}
+
+static void *firmware_thread(void *arg) {
+    especcy_firmware *fw = (especcy_firmware *)arg;
+
+    int ret = download_file_stream(fw->repo, fw->asset_name, &fw->stream, &fw->cancel, &fw->log);
+    firmware_set_state(fw, ret == 0 ? ESPECCY_DONE : fw->cancel ? ESPECCY_CANCELLED : ESPECCY_FAILED);
+    return NULL;
+}
+
+int especcy_firmware_start(especcy_firmware *fw) {
+    // Varios flasheos pueden pedir a la vez el firmware alternativo: solo uno lo arranca
+    pthread_mutex_lock(&fw->lock);
+    int idle = !fw->started && fw->state == ESPECCY_IDLE;
+    if (idle) fw->started = 1;
+    pthread_mutex_unlock(&fw->lock);
+    if (!idle) return -1;
+
+    firmware_set_state(fw, ESPECCY_DOWNLOADING);
+    if (pthread_create(&fw->thread, NULL, firmware_thread, fw) != 0) {
+        fw->started = 0;
+        image_stream_finish(&fw->stream, 0, NULL, NULL);
+        firmware_set_state(fw, ESPECCY_FAILED);
+        return -1;
+    }
+    return 0;
+}
+
+especcy_state especcy_firmware_poll(especcy_firmware *fw, long long *received, long long *size) {
+    if (received || size) {
+        pthread_mutex_lock(&fw->stream.lock);
+        if (received) *received = fw->stream.ready;
+        if (size) *size = fw->stream.state == STREAM_WAITING ? -1 : fw->stream.size;
+        pthread_mutex_unlock(&fw->stream.lock);
+    }
+
+    pthread_mutex_lock(&fw->lock);
+    especcy_state state = fw->state;
+    pthread_mutex_unlock(&fw->lock);
+    return state;
+}
+
+void especcy_firmware_cancel(especcy_firmware *fw) {
+    fw->cancel = 1;
+    __sync_synchronize();
+}
+
+especcy_state especcy_firmware_wait(especcy_firmware *fw) {
+    pthread_mutex_lock(&fw->lock);
+    while (!ESPECCY_FINISHED(fw->state) && fw->state != ESPECCY_IDLE) pthread_cond_wait(&fw->cond, &fw->lock);
+    especcy_state state = fw->state;
+    pthread_mutex_unlock(&fw->lock);
+    return state;
+}
+
+void especcy_firmware_destroy(especcy_firmware *fw) {
+    if (!fw) return;
+
+    if (fw->started) {
+        especcy_firmware_cancel(fw);
+        pthread_join(fw->thread, NULL);
+    }
+    image_stream_destroy(&fw->stream);
+    pthread_mutex_destroy(&fw->lock);
+    pthread_cond_destroy(&fw->cond);
+    free(fw);
+}
+
+/* ------------------------------------------------------------------ flasheo */
+
+static void emit(especcy_flash *f, especcy_event *event) {
+    if (!f->config.on_event) return;
+    event->port = f->status.port;
+    f->config.on_event(f->config.ctx, event);
+}
+
+static void flash_log(void *ctx, log_level level, const char *text) {
+    especcy_flash *f = (especcy_flash *)ctx;
+
+    especcy_event event = { .type = ESPECCY_EVENT_LOG, .state = f->status.state, .level = level, .message = text };
+    emit(f, &event);
+}
+
+especcy_flash *especcy_flash_create(especcy_firmware *fw, const especcy_flash_config *config) {
+    especcy_flash *f = calloc(1, sizeof(especcy_flash));
+    if (!f) return NULL;
+
+    f->firmware = fw;
+    f->config = *config;
+    f->config.port = NULL;          // la copia vive en status.port
+    if (config->port) snprintf(f->status.port, sizeof(f->status.port), "%s", config->port);
+    f->status.state = ESPECCY_IDLE;
+    f->status.baud = ESP32_ROM_BAUD;
+    f->log.fn = flash_log;
+    f->log.ctx = f;
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->cond, NULL);
+    return f;
+}
+
+static void set_state(especcy_flash *f, especcy_state state) {
+    pthread_mutex_lock(&f->lock);
+    f->status.state = state;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+
+    especcy_event event = { .type = ESPECCY_EVENT_STATE, .state = state };
+    if (state == ESPECCY_FAILED) event.message = f->status.error;
+    if (state == ESPECCY_DONE) event.stats = &f->status.stats;
+    emit(f, &event);
+}
+
+// Avance de esp_loader_write_image(): se guarda siempre, se notifica por punto porcentual
+static void on_progress(void *ctx, uint32_t done, uint32_t total) {
+    especcy_flash *f = (especcy_flash *)ctx;
+
+    pthread_mutex_lock(&f->lock);
+    f->status.done = done;
+    f->status.total = total;
+    pthread_mutex_unlock(&f->lock);
+
+    int percent = (int)((unsigned long long)done * 100 / total);
+    if (percent == f->percent) return;
+    f->percent = percent;
+
+    especcy_event event = { .type = ESPECCY_EVENT_PROGRESS, .state = ESPECCY_WRITING, .done = done, .total = total };
+    emit(f, &event);
+}
+
+static void on_baud_test(void *ctx, int baud, int ok, int ms) {
+    especcy_flash *f = (especcy_flash *)ctx;
+
+    especcy_event event = { .type = ESPECCY_EVENT_BAUD_TEST, .state = ESPECCY_NEGOTIATING, .baud = baud, .ok = ok, .ms = ms };
+    emit(f, &event);
+}
+
+static void set_baud(especcy_flash *f, int baud, const char *reason) {
+    pthread_mutex_lock(&f->lock);
+    f->status.baud = baud;
+    pthread_mutex_unlock(&f->lock);
+
+    especcy_event event = { .type = ESPECCY_EVENT_BAUD, .state = f->status.state, .baud = baud, .message = reason };
+    emit(f, &event);
+}
+
+// Errores que pueden venir de un enlace que no aguanta la velocidad
+static int link_error(int ret) {
+    return ret == ESP_LOADER_TIMEOUT || ret == ESP_LOADER_FAILED || ret == ESP_LOADER_VERIFY;
+}
+
+// Con ESP_BAUD_AUTO, si el enlace falla durante la escritura se baja la velocidad y se reintenta
+static int write_with_fallback(especcy_flash *f, esp_loader *loader, int hint) {
+    int ret;
+
+    if (f->config.baud == ESP_BAUD_AUTO) {
+        set_state(f, ESPECCY_NEGOTIATING);
+        ret = esp_loader_auto_baud(loader, hint, on_baud_test, f);
+        if (ret < 0) return ret;
+        set_baud(f, ret, NULL);
+    } else {
+        ret = esp_loader_change_baud(loader, f->config.baud);
+        if (ret != ESP_LOADER_OK) return ret;
+        set_baud(f, loader->baud, NULL);
+    }
+
+    esp_write_options options = { f->config.compress, f->config.diff, on_progress, f, f->config.sparse, f->config.only };
+    esp_write_stats stats;
+    set_state(f, ESPECCY_WRITING);
+
+    for (;;) {
+        f->percent = -1;
+        ret = esp_loader_write_image(loader, &f->firmware->stream, 0x0, &options, &stats);
+
+        pthread_mutex_lock(&f->lock);
+        f->status.stats = stats;
+        pthread_mutex_unlock(&f->lock);
+
+        if (f->config.baud != ESP_BAUD_AUTO || !link_error(ret) || loader->baud == ESP32_ROM_BAUD) return ret;
+
+        int lower = esp_loader_lower_baud(loader->baud);
+        char reason[sizeof(loader->error)];
+        snprintf(reason, sizeof(reason), "%s", loader->error);
+
+        ret = esp_loader_connect(loader);
+        if (ret == ESP_LOADER_OK) ret = esp_loader_change_baud(loader, lower);
+        if (ret != ESP_LOADER_OK) return ret;
+        set_baud(f, lower, reason);
+    }
+}
+
+// Identifica el chip recién conectado y elige el firmware que le corresponde
+static int check_chip(especcy_flash *f, esp_loader *loader, device_record *record) {
+    esp_chip_info chip;
+    int ret = esp_loader_identify(loader, &chip);
+    if (ret != ESP_LOADER_OK) return ret;
+
+    especcy_event event = { .type = ESPECCY_EVENT_CHIP, .state = ESPECCY_CONNECTING, .chip = &chip };
+
+    if (chip.magic != ESP_CHIP_MAGIC_ESP32) {
+        emit(f, &event);
+        snprintf(loader->error, sizeof(loader->error), "Unsupported chip %s, the firmware is for the ESP32", chip.family);
+        return ESP_LOADER_FAILED;
+    }
+
+    if (chip.psram == ESP_PSRAM_NO && f->config.nopsram && f->firmware != f->config.nopsram) {
+        pthread_mutex_lock(&f->lock);
+        f->firmware = f->config.nopsram;
+        pthread_mutex_unlock(&f->lock);
+        especcy_firmware_start(f->firmware);
+        event.message = f->firmware->asset_name;
+    }
+    emit(f, &event);
+
+    snprintf(record->chip, sizeof(record->chip), "%s", chip.name);
+    return ESP_LOADER_OK;
+}
+
+static void fail(especcy_flash *f, const char *error) {
+    pthread_mutex_lock(&f->lock);
+    snprintf(f->status.error, sizeof(f->status.error), "%s", error);
+    pthread_mutex_unlock(&f->lock);
+    set_state(f, f->cancel ? ESPECCY_CANCELLED : ESPECCY_FAILED);
+}
+
+// Las búsquedas de varios flasheos van de a una: dos sondas a la vez en el mismo puerto se estorban
+static pthread_mutex_t detect_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Sin puerto indicado, el primer ESP32 que responda y que no esté usando otro flasheo
+static int detect_port(especcy_flash *f) {
+    set_state(f, ESPECCY_DETECTING);
+
+    for (;;) {
+        char **ports;
+        pthread_mutex_lock(&detect_lock);
+        if (find_esp32_ports(&ports, 0, ESP32_PROBE_TIMEOUT_MS, &f->cancel, &f->log) <= 0) {
+            pthread_mutex_unlock(&detect_lock);
+            fail(f, "ESP32 not found");
+            return -1;
+        }
+
+        // Un flasheo con el puerto indicado pudo reservarlo durante la búsqueda: se busca de nuevo sin él
+        int claimed = esp32_claim_port(ports[0]) == 0;
+        pthread_mutex_unlock(&detect_lock);
+        if (claimed) {
+            pthread_mutex_lock(&f->lock);
+            snprintf(f->status.port, sizeof(f->status.port), "%s", ports[0]);
+            pthread_mutex_unlock(&f->lock);
+        }
+        free_esp32_ports(ports, 1);
+        if (claimed) return 0;
+    }
+}
+
+static void *flash_thread(void *arg) {
+    especcy_flash *f = (especcy_flash *)arg;
+
+    int detected = !f->status.port[0];
+    if (detected && detect_port(f) != 0) return NULL;
+    if (!detected && esp32_claim_port(f->status.port) != 0) {
+        fail(f, "The port is in use by another job");
+        return NULL;
+    }
+
+    double start = metrics_now();
+    esp_loader loader;
+    int ret, connected;
+
+    for (;;) {
+        device_record record;
+        memset(&record, 0, sizeof(record));
+        int known = registry_lookup(f->status.port, &record) == 0;
+
+        set_state(f, ESPECCY_CONNECTING);
+
+        connected = 0;
+        ret = esp_loader_open(&loader, f->status.port, &f->cancel);
+        if (ret == ESP_LOADER_OK) {
+            reset_strategy reset;
+            if (known && reset_parse(record.reset, &reset) == 0) esp_loader_prefer_reset(&loader, &reset);
+
+            ret = esp_loader_connect(&loader);
+            if (ret == ESP_LOADER_OK) {
+                connected = 1;
+                ret = check_chip(f, &loader, &record);
+            }
+            if (ret == ESP_LOADER_OK) ret = write_with_fallback(f, &loader, known ? record.baud : 0);
+            if (ret == ESP_LOADER_OK) esp_loader_reboot(&loader);
+            esp_loader_close(&loader);
+        }
+
+        if (ret == ESP_LOADER_OK) {
+            // La velocidad final ya contempla las bajadas por errores durante la escritura
+            if (f->config.baud == ESP_BAUD_AUTO) record.baud = loader.baud;
+            else if (!known) record.baud = 0;
+            reset_format(&loader.reset, record.reset, sizeof(record.reset));
+            registry_store(f->status.port, &record);
+            break;
+        }
+        if (ret == ESP_LOADER_CANCELLED || !known) break;
+
+        // Los datos registrados ya no sirven; si el puerto se eligió solo, se vuelve a buscar
+        registry_forget(f->status.port);
+        if (connected || !detected) break;
+
+        log_message(&f->log, LOG_SINK_INFO, "Known ESP32 on %s did not answer, scanning again", f->status.port);
+        esp32_release_port(f->status.port);
+        if (detect_port(f) != 0) return NULL;
+    }
+
+    esp32_release_port(f->status.port);
+
+    pthread_mutex_lock(&f->lock);
+    f->status.seconds = metrics_now() - start;
+    f->status.baud = loader.baud;
+    snprintf(f->status.error, sizeof(f->status.error), "%s", ret == ESP_LOADER_OK ? "" : loader.error);
+    pthread_mutex_unlock(&f->lock);
+
+    set_state(f, ret == ESP_LOADER_OK ? ESPECCY_DONE : ret == ESP_LOADER_CANCELLED ? ESPECCY_CANCELLED : ESPECCY_FAILED);
+    return NULL;
+}
+
+int especcy_flash_start(especcy_flash *f) {
+    if (f->started || f->status.state != ESPECCY_IDLE) return -1;
+
+    if (pthread_create(&f->thread, NULL, flash_thread, f) != 0) {
+        pthread_mutex_lock(&f->lock);
+        snprintf(f->status.error, sizeof(f->status.error), "Can't start a worker thread");
+        pthread_mutex_unlock(&f->lock);
+        set_state(f, ESPECCY_FAILED);
+        return -1;
+    }
+    f->started = 1;
+    return 0;
+}
+
+especcy_state especcy_flash_poll(especcy_flash *f, especcy_flash_status *status) {
+    pthread_mutex_lock(&f->lock);
+    especcy_state state = f->status.state;
+    if (status) *status = f->status;
+    pthread_mutex_unlock(&f->lock);
+    return state;
+}
+
+void especcy_flash_cancel(especcy_flash *f) {
+    f->cancel = 1;
+    __sync_synchronize();
+}
+
+especcy_firmware *especcy_flash_firmware(especcy_flash *f) {
+    pthread_mutex_lock(&f->lock);
+    especcy_firmware *fw = f->firmware;
+    pthread_mutex_unlock(&f->lock);
+    return fw;
+}
+
+especcy_state especcy_flash_wait(especcy_flash *f) {
+    if (!f->started) return especcy_flash_poll(f, NULL);
+
+    pthread_mutex_lock(&f->lock);
+    while (!ESPECCY_FINISHED(f->status.state)) pthread_cond_wait(&f->cond, &f->lock);
+    especcy_state state = f->status.state;
+    pthread_mutex_unlock(&f->lock);
+    return state;
+}
+
+void especcy_flash_destroy(especcy_flash *f) {
+    if (!f) return;
+
+    if (f->started) {
+        especcy_flash_cancel(f);
+        pthread_join(f->thread, NULL);
+    }
+    pthread_mutex_destroy(&f->lock);
+    pthread_cond_destroy(&f->cond);
+    free(f);
+}
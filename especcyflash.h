@@ -0,0 +1,212 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef ESPECCYFLASH_H
+#define ESPECCYFLASH_H
+
+/*
+ * libespeccyflash: detección, descarga y flasheo del firmware de ESPeccy.
+ *
+ * Un especcy_firmware descarga un asset de la última release una sola vez y
+ * lo comparte; cada especcy_flash graba esa imagen en un equipo. Las dos
+ * clases de objetos trabajan en su propio hilo: *_start() vuelve enseguida,
+ * *_poll() devuelve el estado sin bloquear, *_cancel() pide abandonar y
+ * *_wait() espera el final. Así un solo proceso puede llevar muchos
+ * flasheos a la vez.
+ *
+ * Los eventos (cambios de estado, avance, negociación de la velocidad) se
+ * entregan al callback desde el hilo del flasheo: tiene que ser rápido y no
+ * llamar a especcy_flash_wait() ni a especcy_flash_destroy() del mismo objeto.
+ * La biblioteca no escribe en la consola: los mensajes de la búsqueda del
+ * puerto y de la descarga llegan también como eventos ESPECCY_EVENT_LOG, del
+ * flasheo (con port) o del firmware (con asset).
+ */
+
+#include <stdint.h>
+
+#include "download_file.h"
+#include "esp_loader.h"
+#include "log_sink.h"
+
+typedef enum {
+    ESPECCY_IDLE = 0,           // creado, sin arrancar
+    ESPECCY_DETECTING,          // buscando el ESP32 (sin puerto indicado)
+    ESPECCY_DOWNLOADING,        // descargando el firmware
+    ESPECCY_CONNECTING,         // reset al modo descarga y SYNC con el ROM
+    ESPECCY_NEGOTIATING,        // probando velocidades (ESP_BAUD_AUTO)
+    ESPECCY_WRITING,            // comparando, borrando, escribiendo y verificando
+    ESPECCY_DONE,               // terminó bien
+    ESPECCY_FAILED,
+    ESPECCY_CANCELLED
+} especcy_state;
+
+// Estados finales: el trabajo ya no hace nada más
+#define ESPECCY_FINISHED(state) ((state) >= ESPECCY_DONE)
+
+typedef enum {
+    ESPECCY_EVENT_STATE = 0,    // cambió state (con FAILED, message trae el error)
+    ESPECCY_EVENT_PROGRESS,     // avance de la escritura, a lo sumo uno por punto porcentual
+    ESPECCY_EVENT_BAUD_TEST,    // resultado de probar baud durante la negociación
+    ESPECCY_EVENT_BAUD,         // velocidad elegida; con message, se bajó tras ese error
+    ESPECCY_EVENT_CHIP,         // chip identificado; con message, el asset sin PSRAM que se graba en su lugar
+    ESPECCY_EVENT_LOG,          // mensaje de texto (message) de la búsqueda del puerto o de la descarga
+} especcy_event_type;
+
+typedef struct {
+    especcy_event_type      type;
+    especcy_state           state;
+    const char             *port;       // vacío mientras se busca el puerto; NULL en los eventos del firmware
+    const char             *asset;      // eventos del firmware: el asset que se descarga
+    log_level               level;      // LOG
+    uint32_t                done;       // PROGRESS: bytes escritos de total
+    uint32_t                total;
+    int                     baud;       // BAUD_TEST, BAUD
+    int                     ok;         // BAUD_TEST: 1 si el enlace funcionó
+    int                     ms;         // BAUD_TEST: duración de la prueba
+    const char             *message;
+    const esp_write_stats  *stats;      // STATE con DONE
+    const esp_chip_info    *chip;       // CHIP
+} especcy_event;
+
+typedef void (*especcy_event_fn)(void *ctx, const especcy_event *event);
+
+typedef struct especcy_firmware especcy_firmware;
+typedef struct especcy_flash especcy_flash;
+
+typedef struct {
+    const char         *port;           // NULL: usar el primer ESP32 que se encuentre
+    int                 baud;           // velocidad de escritura, o ESP_BAUD_AUTO
+    int                 compress;
+    int                 diff;
+    int                 sparse;         // solo los tramos con contenido de la imagen
+    const char         *only;           // partes a grabar (ver image_map_build), o NULL
+    especcy_event_fn    on_event;       // puede ser NULL
+    void               *ctx;            // contexto de on_event
+    especcy_firmware   *nopsram;        // se graba en los chips sin PSRAM (o NULL); se descarga al necesitarlo
+} especcy_flash_config;
+
+// Foto del estado de un flasheo
+typedef struct {
+    especcy_state       state;
+    char                port[256];
+    uint32_t            done;           // bytes escritos en el intento actual
+    uint32_t            total;
+    int                 baud;           // velocidad actual (o final)
+    esp_write_stats     stats;          // al terminar
+    double              seconds;        // desde la conexión hasta el final
+    char                error[160];
+} especcy_flash_status;
+
+/**
+ * @brief Configura las descargas e inicializa la red; llamar una vez al empezar.
+ *
+ * @return 0 si se pudo inicializar.
+ */
+int especcy_init(const download_config *config);
+
+/**
+ * @brief Crea la descarga de un asset de la última release de repo.
+ *
+ * @param on_event Recibe los eventos ESPECCY_EVENT_LOG de la descarga, desde su hilo (puede ser NULL).
+ * @param ctx Contexto de on_event.
+ * @return El objeto, o NULL si no hay memoria.
+ */
+especcy_firmware *especcy_firmware_create(const char *repo, const char *asset_name, especcy_event_fn on_event, void *ctx);
+
+/**
+ * @brief Lanza la descarga en segundo plano.
+ *
+ * @return 0 si se lanzó.
+ */
+int especcy_firmware_start(especcy_firmware *fw);
+
+/**
+ * @brief Estado de la descarga, sin bloquear.
+ *
+ * @param received Recibe los bytes disponibles desde el principio (puede ser NULL).
+ * @param size Recibe el tamaño total, o -1 si todavía no se conoce (puede ser NULL).
+ */
+especcy_state especcy_firmware_poll(especcy_firmware *fw, long long *received, long long *size);
+
+void especcy_firmware_cancel(especcy_firmware *fw);
+
+/**
+ * @brief Espera a que termine la descarga.
+ */
+especcy_state especcy_firmware_wait(especcy_firmware *fw);
+
+/**
+ * @brief Cancela si hace falta, espera al hilo y libera el objeto.
+ *
+ * Los flasheos que usan este firmware tienen que destruirse antes.
+ */
+void especcy_firmware_destroy(especcy_firmware *fw);
+
+/**
+ * @brief Crea un flasheo de fw; puede crearse antes de que termine la descarga.
+ *
+ * @return El objeto, o NULL si no hay memoria.
+ */
+especcy_flash *especcy_flash_create(especcy_firmware *fw, const especcy_flash_config *config);
+
+/**
+ * @brief Lanza el flasheo en segundo plano: detección si hace falta,
+ * conexión, negociación de la velocidad, escritura y reinicio del chip.
+ *
+ * @return 0 si se lanzó.
+ */
+int especcy_flash_start(especcy_flash *f);
+
+/**
+ * @brief Estado del flasheo, sin bloquear.
+ *
+ * @param status Recibe la foto completa del estado (puede ser NULL).
+ */
+especcy_state especcy_flash_poll(especcy_flash *f, especcy_flash_status *status);
+
+void especcy_flash_cancel(especcy_flash *f);
+
+/**
+ * @brief Firmware que se está grabando: el de create, o config.nopsram si el
+ * chip resultó no tener PSRAM.
+ */
+especcy_firmware *especcy_flash_firmware(especcy_flash *f);
+
+/**
+ * @brief Espera a que termine el flasheo.
+ */
+especcy_state especcy_flash_wait(especcy_flash *f);
+
+/**
+ * @brief Cancela si hace falta, espera al hilo y libera el objeto.
+ */
+void especcy_flash_destroy(especcy_flash *f);
+
+#endif // ESPECCYFLASH_H
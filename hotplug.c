@@ -0,0 +1,97 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__linux__)
+    #include <sys/inotify.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+#include "hotplug.h"
+
+// Cada cuánto se revisa la cancelación mientras no hay eventos
+#define HOTPLUG_POLL_MS         200
+
+#if defined(__linux__)
+static int is_serial_node(const char *name) {
+    return strncmp(name, "ttyUSB", 6) == 0 || strncmp(name, "ttyACM", 6) == 0;
+}
+#endif
+
+int hotplug_watch(hotplug_fn fn, void *ctx, const volatile int *cancel) {
+#if defined(__linux__)
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+
+    // udev crea el nodo (o un enlace) y a veces lo renombra desde un temporal
+    if (inotify_add_watch(fd, HOTPLUG_DEV_DIR, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (!*cancel) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ret = poll(&pfd, 1, HOTPLUG_POLL_MS);
+        if (ret < 0 && errno != EINTR) break;
+        if (ret <= 0) continue;
+
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if (len <= 0) continue;
+
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (!event->len || !is_serial_node(event->name)) continue;
+
+            char path[300];
+            snprintf(path, sizeof(path), "%s/%s", HOTPLUG_DEV_DIR, event->name);
+            fn(ctx, path, (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0);
+        }
+    }
+
+    close(fd);
+    return 0;
+#else
+    (void)fn;
+    (void)ctx;
+    (void)cancel;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
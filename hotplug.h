@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+// Directorio donde aparecen los nodos de los puertos serie
+#define HOTPLUG_DEV_DIR         "/dev"
+
+/**
+ * @brief Aviso de un puerto serie que apareció o desapareció.
+ *
+ * @param ctx Contexto entregado a hotplug_watch().
+ * @param path Ruta del nodo, ej. "/dev/ttyUSB0".
+ * @param added 1 si el nodo se creó, 0 si se borró.
+ */
+typedef void (*hotplug_fn)(void *ctx, const char *path, int added);
+
+/**
+ * @brief Vigila la creación y el borrado de nodos ttyUSB* y ttyACM*.
+ *
+ * En Linux usa inotify sobre HOTPLUG_DEV_DIR, así no hace falta volver a
+ * recorrer el directorio. Los puertos que ya existían no se informan.
+ *
+ * @param cancel Bandera que termina la vigilancia al pasar a 1.
+ * @return 0 al cancelarse, -1 si no se pudo vigilar el directorio (con errno;
+ * ENOSYS fuera de Linux).
+ */
+int hotplug_watch(hotplug_fn fn, void *ctx, const volatile int *cancel);
+
+#endif // HOTPLUG_H
@@ -0,0 +1,274 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_map.h"
+
+// Cómo se decide qué grabar de cada parte de la imagen
+typedef enum {
+    PART_IMAGE,     // imagen con cabecera: hasta el final de la imagen
+    PART_TABLE,     // la tabla de particiones: su sector completo
+    PART_DATA,      // datos: completa si tiene contenido, nada si está vacía
+    PART_FORCED,    // completa siempre, aunque esté vacía (otadata)
+    PART_SCAN       // sin estructura conocida: los sectores con contenido
+} part_kind;
+
+typedef struct {
+    uint32_t    start;
+    uint32_t    end;
+    part_kind   kind;
+    int         app;            // partición de tipo aplicación
+    char        name[17];
+} component;
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t sector_align(uint32_t value) {
+    return (value + IMAGE_SECTOR_SIZE - 1) & ~(uint32_t)(IMAGE_SECTOR_SIZE - 1);
+}
+
+static int is_blank(const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] != 0xFF) return 0;
+    }
+    return 1;
+}
+
+int image_map_partitions(const uint8_t *data, uint32_t size, image_map *map) {
+    map->partition_count = 0;
+
+    for (int i = 0; i < IMAGE_MAX_PARTITIONS; i++) {
+        uint32_t pos = IMAGE_PARTITION_TABLE + (uint32_t)i * IMAGE_PARTITION_ENTRY_SIZE;
+        if (pos + IMAGE_PARTITION_ENTRY_SIZE > size) break;
+
+        // La tabla termina en una entrada vacía o en la del MD5
+        const uint8_t *p = data + pos;
+        if (get_le16(p) != IMAGE_PARTITION_MAGIC) break;
+
+        image_partition *part = &map->partitions[map->partition_count++];
+        part->type = p[2];
+        part->subtype = p[3];
+        part->offset = get_le32(p + 4);
+        part->size = get_le32(p + 8);
+        memcpy(part->label, p + 12, 16);
+        part->label[16] = '\0';
+    }
+
+    return map->partition_count;
+}
+
+uint32_t image_app_length(const uint8_t *data, uint32_t size, uint32_t offset) {
+    if (offset >= size || size - offset < IMAGE_APP_HEADER_SIZE || data[offset] != IMAGE_APP_MAGIC) return 0;
+
+    int segments = data[offset + 1];
+    if (segments == 0 || segments > IMAGE_APP_MAX_SEGMENTS) return 0;
+
+    uint32_t pos = offset + IMAGE_APP_HEADER_SIZE;
+    for (int i = 0; i < segments; i++) {
+        if (size - pos < 8) return 0;
+        uint32_t len = get_le32(data + pos + 4);
+        pos += 8;
+        if (len > size - pos) return 0;
+        pos += len;
+    }
+
+    // Relleno hasta que el checksum quede en el último byte de un bloque de 16
+    uint32_t length = ((pos - offset) | 15) + 1;
+    if (data[offset + 23] == 1) length += 32;   // SHA-256 de la imagen al final
+
+    if (length > size - offset) return 0;
+    return length;
+}
+
+// Busca un nombre en una lista separada por comas
+static int in_list(const char *list, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = list; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) return 1;
+    }
+    return 0;
+}
+
+// Una parte entra si only la nombra, o nombra "app" y es una aplicación
+static int is_selected(const char *only, const component *c) {
+    return !only || in_list(only, c->name) || (c->app && in_list(only, "app"));
+}
+
+// Cada nombre de only tiene que existir en la imagen
+static int check_selection(const char *only, const component *parts, int count, image_map *map) {
+    for (const char *p = only; p; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+        size_t len = strcspn(p, ",");
+        char name[32];
+        snprintf(name, sizeof(name), "%.*s", (int)len, p);
+
+        int found = 0;
+        for (int i = 0; i < count && !found; i++) {
+            found = strcmp(name, parts[i].name) == 0 || (parts[i].app && strcmp(name, "app") == 0);
+        }
+        if (!found) {
+            snprintf(map->error, sizeof(map->error), "The firmware has no '%s' partition", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void add_extent(image_map *map, uint32_t offset, uint32_t end, const char *name) {
+    if (end <= offset) return;
+
+    // Sin lugar en la tabla, el último tramo crece hasta cubrir este
+    if (map->extent_count == IMAGE_MAX_EXTENTS) {
+        image_extent *last = &map->extents[IMAGE_MAX_EXTENTS - 1];
+        map->mapped += end - (last->offset + last->size);
+        last->size = end - last->offset;
+        return;
+    }
+
+    image_extent *e = &map->extents[map->extent_count++];
+    e->offset = offset;
+    e->size = end - offset;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    map->mapped += e->size;
+}
+
+// Sectores con contenido de [start, end); los huecos cortos no cortan el tramo
+static void scan_sectors(const uint8_t *data, uint32_t start, uint32_t end, const char *name, image_map *map) {
+    uint32_t run = 0, last = 0;
+    int open = 0;
+
+    for (uint32_t pos = start; pos < end; pos += IMAGE_SECTOR_SIZE) {
+        uint32_t len = end - pos < IMAGE_SECTOR_SIZE ? end - pos : IMAGE_SECTOR_SIZE;
+        if (is_blank(data + pos, len)) continue;
+
+        if (open && pos - last > IMAGE_MERGE_GAP) {
+            add_extent(map, run, last, name);
+            open = 0;
+        }
+        if (!open) {
+            run = pos;
+            open = 1;
+        }
+        last = pos + len;
+    }
+    if (open) add_extent(map, run, last, name);
+}
+
+static void map_component(const uint8_t *data, const component *c, image_map *map) {
+    switch (c->kind) {
+    case PART_IMAGE: {
+        uint32_t length = image_app_length(data, c->end, c->start);
+        if (length) {
+            uint32_t end = c->start + sector_align(length);
+            add_extent(map, c->start, end < c->end ? end : c->end, c->name);
+        } else {
+            scan_sectors(data, c->start, c->end, c->name, map);
+        }
+        break;
+    }
+    case PART_DATA:
+        if (!is_blank(data + c->start, c->end - c->start)) add_extent(map, c->start, c->end, c->name);
+        break;
+    case PART_TABLE:
+    case PART_FORCED:
+        add_extent(map, c->start, c->end, c->name);
+        break;
+    case PART_SCAN:
+        scan_sectors(data, c->start, c->end, c->name, map);
+        break;
+    }
+}
+
+static int compare_components(const void *a, const void *b) {
+    const component *x = (const component *)a, *y = (const component *)b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+int image_map_build(const uint8_t *data, uint32_t size, const char *only, image_map *map) {
+    map->extent_count = 0;
+    map->mapped = 0;
+    map->error[0] = '\0';
+
+    if (image_map_partitions(data, size, map) == 0) {
+        if (only) {
+            snprintf(map->error, sizeof(map->error), "The firmware has no partition table to select partitions from");
+            return -1;
+        }
+        add_extent(map, 0, size, "image");
+        return 0;
+    }
+
+    component parts[IMAGE_MAX_PARTITIONS + 2];
+    int count = 0;
+
+    // El bootloader está en 0x1000 en el ESP32 y en 0x0 en los chips más nuevos
+    uint32_t boot = data[0] == IMAGE_APP_MAGIC ? 0 : IMAGE_BOOTLOADER_OFFSET;
+    parts[count++] = (component){ boot, IMAGE_PARTITION_TABLE, PART_IMAGE, 0, "bootloader" };
+
+    uint32_t table_end = IMAGE_PARTITION_TABLE + sector_align(IMAGE_PARTITION_TABLE_SIZE);
+    parts[count++] = (component){ IMAGE_PARTITION_TABLE, table_end < size ? table_end : size, PART_TABLE, 0, "partitions" };
+
+    for (int i = 0; i < map->partition_count; i++) {
+        const image_partition *p = &map->partitions[i];
+        if (p->offset < table_end || p->offset >= size) continue;
+
+        component *c = &parts[count++];
+        c->start = p->offset;
+        c->end = p->size < size - p->offset ? p->offset + p->size : size;
+        c->app = p->type == IMAGE_PARTITION_APP;
+        c->kind = c->app ? PART_IMAGE
+                : (p->type == IMAGE_PARTITION_DATA && p->subtype == IMAGE_SUBTYPE_OTA) ? PART_FORCED
+                : PART_DATA;
+        snprintf(c->name, sizeof(c->name), "%s", p->label);
+    }
+
+    if (only && check_selection(only, parts, count, map) != 0) return -1;
+
+    qsort(parts, count, sizeof(component), compare_components);
+
+    // Lo que no pertenece a ninguna parte se recorre por sectores
+    uint32_t covered = 0;
+    for (int i = 0; i < count; i++) {
+        if (!only && parts[i].start > covered) scan_sectors(data, covered, parts[i].start, "", map);
+        if (is_selected(only, &parts[i])) map_component(data, &parts[i], map);
+        if (parts[i].end > covered) covered = parts[i].end;
+    }
+    if (!only && covered < size) scan_sectors(data, covered, size, "", map);
+
+    return 0;
+}
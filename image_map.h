@@ -0,0 +1,133 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef IMAGE_MAP_H
+#define IMAGE_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dónde espera el ROM del ESP32 cada parte de una imagen combinada
+#define IMAGE_BOOTLOADER_OFFSET     0x1000
+#define IMAGE_PARTITION_TABLE       0x8000
+#define IMAGE_PARTITION_TABLE_SIZE  0xC00
+
+// Entradas de la tabla de particiones (32 bytes cada una)
+#define IMAGE_PARTITION_MAGIC       0x50AA
+#define IMAGE_PARTITION_MD5_MAGIC   0xEBEB
+#define IMAGE_PARTITION_ENTRY_SIZE  32
+#define IMAGE_MAX_PARTITIONS        (IMAGE_PARTITION_TABLE_SIZE / IMAGE_PARTITION_ENTRY_SIZE)
+
+// Tipos y subtipos que importan para decidir qué grabar
+#define IMAGE_PARTITION_APP         0x00
+#define IMAGE_PARTITION_DATA        0x01
+#define IMAGE_SUBTYPE_OTA           0x00
+
+// Cabecera de una imagen de aplicación (y del bootloader)
+#define IMAGE_APP_MAGIC             0xE9
+#define IMAGE_APP_HEADER_SIZE       24
+#define IMAGE_APP_MAX_SEGMENTS      16
+
+// Granularidad del mapa: lo que borra el ROM
+#define IMAGE_SECTOR_SIZE           0x1000
+
+// Huecos vacíos menores que esto dentro de una zona sin estructura no cortan el tramo
+#define IMAGE_MERGE_GAP             0x4000
+
+#define IMAGE_MAX_EXTENTS           256
+
+typedef struct {
+    char        label[17];
+    uint8_t     type;
+    uint8_t     subtype;
+    uint32_t    offset;
+    uint32_t    size;
+} image_partition;
+
+// Tramo de la imagen que hay que borrar y grabar
+typedef struct {
+    uint32_t    offset;
+    uint32_t    size;
+    char        name[17];       // parte de la imagen a la que pertenece
+} image_extent;
+
+/*
+ * Mapa disperso de una imagen combinada (bootloader + tabla + particiones).
+ *
+ * Con la tabla de particiones y las cabeceras de las aplicaciones se sabe
+ * qué bytes importan: el bootloader y cada aplicación hasta el final de su
+ * imagen, la tabla, y las particiones de datos que traen contenido. El resto
+ * es relleno 0xFF que no hace falta enviar ni borrar; lo que haya en la
+ * flash en esas zonas queda como está.
+ *
+ * Excepción: la partición otadata se borra aunque esté vacía, porque vacía
+ * significa "arrancar la primera aplicación" y dejar la anterior podría
+ * arrancar otra. Una partición de datos con contenido se graba entera, ya
+ * que sus sectores vacíos también forman parte de su estado.
+ */
+typedef struct {
+    int             partition_count;
+    image_partition partitions[IMAGE_MAX_PARTITIONS];
+    int             extent_count;
+    image_extent    extents[IMAGE_MAX_EXTENTS];
+    uint32_t        mapped;         // bytes cubiertos por los tramos
+    char            error[160];
+} image_map;
+
+/**
+ * @brief Lee la tabla de particiones de una imagen combinada.
+ *
+ * @return Cantidad de particiones, 0 si la imagen no tiene tabla.
+ */
+int image_map_partitions(const uint8_t *data, uint32_t size, image_map *map);
+
+/**
+ * @brief Largo de la imagen de aplicación que empieza en offset.
+ *
+ * Recorre los segmentos de la cabecera y suma el relleno, el checksum y el
+ * SHA-256 opcional del final.
+ *
+ * @return Largo en bytes, 0 si en offset no hay una imagen válida.
+ */
+uint32_t image_app_length(const uint8_t *data, uint32_t size, uint32_t offset);
+
+/**
+ * @brief Construye el mapa de tramos a grabar.
+ *
+ * @param only Lista separada por comas de partes a grabar: "bootloader",
+ *             "partitions", "app" (todas las aplicaciones) o el nombre de
+ *             una partición. NULL para todas.
+ * @return 0 si se pudo construir; -1 con map->error si no (p. ej. only pide
+ *         algo que la imagen no tiene). Sin tabla de particiones y sin only,
+ *         el mapa es la imagen completa.
+ */
+int image_map_build(const uint8_t *data, uint32_t size, const char *only, image_map *map);
+
+#endif // IMAGE_MAP_H
@@ -0,0 +1,250 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <io.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+#include "image_stream.h"
+
+void image_stream_init(image_stream *s) {
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+}
+
+void image_stream_destroy(image_stream *s) {
+#if defined(_WIN32) || defined(_WIN64)
+    free((void *)s->data);
+#else
+    if (s->data) munmap((void *)s->data, (size_t)s->size);
+#endif
+    free(s->page_fill);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+// Sin mmap: copia en memoria de lo que ya tiene el archivo. Un mapeo de Windows
+// impediría renombrar el archivo parcial al terminar la descarga.
+static uint8_t *load_image(int fd, long long size) {
+    uint8_t *data = malloc((size_t)size);
+    if (!data) return NULL;
+
+    if (_lseeki64(fd, 0, SEEK_SET) < 0) {
+        free(data);
+        return NULL;
+    }
+
+    // Lo que todavía no se escribió (archivo recién reservado) queda en cero
+    long long done = 0;
+    while (done < size) {
+        long long chunk = size - done < 0x40000000 ? size - done : 0x40000000;
+        int n = _read(fd, data + done, (unsigned int)chunk);
+        if (n < 0) {
+            free(data);
+            return NULL;
+        }
+        if (n == 0) break;
+        done += n;
+    }
+    memset(data + done, 0, (size_t)(size - done));
+
+    return data;
+}
+#endif
+
+int image_stream_attach(image_stream *s, int fd, long long size) {
+    if (size <= 0) return -1;
+
+#if defined(_WIN32) || defined(_WIN64)
+    uint8_t *data = load_image(fd, size);
+    if (!data) return -1;
+#else
+    // El mapeo sigue siendo válido aunque luego se cierre o renombre el archivo
+    void *data = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) return -1;
+#endif
+
+    uint16_t *fill = calloc((size_t)((size + IMAGE_STREAM_PAGE - 1) / IMAGE_STREAM_PAGE), sizeof(uint16_t));
+    if (!fill) {
+#if defined(_WIN32) || defined(_WIN64)
+        free(data);
+#else
+        munmap(data, (size_t)size);
+#endif
+        return -1;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->data = data;
+    s->size = size;
+    s->page_fill = fill;
+    s->ready = 0;
+    s->state = STREAM_RECEIVING;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+
+    return 0;
+}
+
+static long long page_size_at(const image_stream *s, long long page) {
+    long long start = page * IMAGE_STREAM_PAGE;
+    return (s->size - start < IMAGE_STREAM_PAGE) ? s->size - start : IMAGE_STREAM_PAGE;
+}
+
+void image_stream_publish(image_stream *s, long long offset, size_t len) {
+    pthread_mutex_lock(&s->lock);
+    if (s->state != STREAM_RECEIVING) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+
+    long long end = offset + (long long)len;
+    if (end > s->size) end = s->size;
+
+    // Sumar lo recibido a cada página que toca el tramo
+    while (offset < end) {
+        long long page = offset / IMAGE_STREAM_PAGE;
+        long long page_end = (page + 1) * IMAGE_STREAM_PAGE;
+        long long n = (end < page_end ? end : page_end) - offset;
+        s->page_fill[page] += (uint16_t)n;
+        offset += n;
+    }
+
+    // Avanzar el prefijo contiguo
+    long long before = s->ready;
+    while (s->ready < s->size) {
+        long long page = s->ready / IMAGE_STREAM_PAGE;
+        if (s->page_fill[page] < page_size_at(s, page)) break;
+        s->ready = page * IMAGE_STREAM_PAGE + page_size_at(s, page);
+    }
+
+    if (s->ready != before) pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void image_stream_write(image_stream *s, long long offset, const void *data, size_t len) {
+#if defined(_WIN32) || defined(_WIN64)
+    // Los bytes todavía no publicados no los lee nadie: se copian sin el lock
+    if (s->data && offset >= 0 && offset < s->size) {
+        size_t n = offset + (long long)len > s->size ? (size_t)(s->size - offset) : len;
+        memcpy((uint8_t *)s->data + offset, data, n);
+    }
+#else
+    (void)data;
+#endif
+    image_stream_publish(s, offset, len);
+}
+
+void image_stream_finish(image_stream *s, int ok, const char *sha256, const uint8_t *md5) {
+    pthread_mutex_lock(&s->lock);
+    if (s->state == STREAM_COMPLETE || s->state == STREAM_FAILED) {
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    if (ok && s->data) {
+        s->ready = s->size;
+        snprintf(s->sha256, sizeof(s->sha256), "%s", sha256);
+        if (md5) memcpy(s->md5, md5, MD5_DIGEST_SIZE);
+        s->has_md5 = md5 != NULL;
+        s->state = STREAM_COMPLETE;
+    } else {
+        s->state = STREAM_FAILED;
+    }
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Espera al próximo cambio; se despierta periódicamente para atender la cancelación
+static void wait_change(image_stream *s) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100 * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&s->cond, &s->lock, &ts);
+}
+
+long long image_stream_wait_size(image_stream *s, const volatile int *cancel) {
+    pthread_mutex_lock(&s->lock);
+    while (s->state == STREAM_WAITING && !(cancel && *cancel)) wait_change(s);
+    long long size = (s->state == STREAM_RECEIVING || s->state == STREAM_COMPLETE) ? s->size : -1;
+    pthread_mutex_unlock(&s->lock);
+    return size;
+}
+
+const uint8_t *image_stream_wait(image_stream *s, long long offset, size_t len, const volatile int *cancel) {
+    const uint8_t *data = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        if (s->state == STREAM_FAILED || (cancel && *cancel)) break;
+        if (s->state != STREAM_WAITING) {
+            if (offset + (long long)len > s->size) break;
+            if (offset + (long long)len <= s->ready) {
+                data = s->data + offset;
+                break;
+            }
+        }
+        wait_change(s);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return data;
+}
+
+int image_stream_wait_complete(image_stream *s, char *sha256, const volatile int *cancel) {
+    pthread_mutex_lock(&s->lock);
+    while ((s->state == STREAM_WAITING || s->state == STREAM_RECEIVING) && !(cancel && *cancel)) wait_change(s);
+    int ok = s->state == STREAM_COMPLETE;
+    if (ok && sha256) snprintf(sha256, 65, "%s", s->sha256);
+    pthread_mutex_unlock(&s->lock);
+
+    return ok ? 0 : 1;
+}
+
+int image_stream_md5(image_stream *s, uint8_t md5[MD5_DIGEST_SIZE]) {
+    pthread_mutex_lock(&s->lock);
+    int ok = s->state == STREAM_COMPLETE && s->has_md5;
+    if (ok) memcpy(md5, s->md5, MD5_DIGEST_SIZE);
+    pthread_mutex_unlock(&s->lock);
+
+    return ok ? 0 : 1;
+}
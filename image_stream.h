@@ -0,0 +1,140 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "md5.h"
+
+#define IMAGE_STREAM_PAGE       4096
+
+typedef enum {
+    STREAM_WAITING = 0,     // todavía no se conoce el tamaño
+    STREAM_RECEIVING,       // tamaño conocido, llegan datos
+    STREAM_COMPLETE,        // todo recibido y con hash calculado
+    STREAM_FAILED
+} image_stream_state;
+
+/*
+ * Imagen de firmware compartida entre la descarga y el flasheo.
+ *
+ * La descarga escribe en su archivo parcial y publica qué tramos llegaron;
+ * la imagen se ve a través de un mapeo en memoria de ese archivo, así el
+ * flasheo puede enviar los bloques ya recibidos mientras el resto se sigue
+ * descargando, sin volver a leer el archivo del disco. En Windows, donde el
+ * mapeo bloquearía el renombrado del archivo, la imagen es una copia en
+ * memoria que se completa con image_stream_write().
+ *
+ * Como los tramos pueden llegar fuera de orden, se cuenta lo recibido por
+ * página y "ready" es el prefijo contiguo disponible desde el byte 0.
+ */
+typedef struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    image_stream_state  state;
+    const uint8_t      *data;
+    long long           size;
+    long long           ready;
+    uint16_t           *page_fill;      // bytes recibidos en cada página
+    char                sha256[65];     // hash de la imagen completa
+    uint8_t             md5[MD5_DIGEST_SIZE];
+    int                 has_md5;        // la descarga calculó también el MD5
+} image_stream;
+
+void image_stream_init(image_stream *s);
+void image_stream_destroy(image_stream *s);
+
+/**
+ * @brief Mapea el archivo de la descarga una vez conocido su tamaño.
+ *
+ * El archivo tiene que tener ya ese tamaño (se reserva con ftruncate) y,
+ * en Windows, estar abierto en modo binario.
+ *
+ * @return 0 si se pudo mapear.
+ */
+int image_stream_attach(image_stream *s, int fd, long long size);
+
+/**
+ * @brief Marca como recibidos los bytes [offset, offset + len).
+ */
+void image_stream_publish(image_stream *s, long long offset, size_t len);
+
+/**
+ * @brief Marca como recibidos los bytes [offset, offset + len) que se acaban
+ * de escribir en el archivo; data es el mismo contenido.
+ *
+ * En Windows los copia a la imagen en memoria; con el mapeo alcanza con
+ * publicarlos.
+ */
+void image_stream_write(image_stream *s, long long offset, const void *data, size_t len);
+
+/**
+ * @brief Termina la descarga; si ok, sha256 es el hash de la imagen completa.
+ *
+ * md5 es el MD5 de la imagen si se calculó durante la descarga (o NULL).
+ */
+void image_stream_finish(image_stream *s, int ok, const char *sha256, const uint8_t *md5);
+
+/**
+ * @brief Espera a que se conozca el tamaño de la imagen.
+ *
+ * @return Tamaño en bytes, o -1 si la descarga falló o se canceló.
+ */
+long long image_stream_wait_size(image_stream *s, const volatile int *cancel);
+
+/**
+ * @brief Espera a que los bytes [offset, offset + len) estén disponibles.
+ *
+ * @return Puntero a los datos, o NULL si la descarga falló o se canceló.
+ */
+const uint8_t *image_stream_wait(image_stream *s, long long offset, size_t len, const volatile int *cancel);
+
+/**
+ * @brief Espera al final de la descarga.
+ *
+ * Antes de confirmar el flasheo hay que verificar que la imagen completa
+ * llegó bien: esta llamada devuelve el hash de toda la imagen.
+ *
+ * @return 0 si la imagen está completa (sha256 recibe el hash), 1 si falló.
+ */
+int image_stream_wait_complete(image_stream *s, char *sha256, const volatile int *cancel);
+
+/**
+ * @brief MD5 de la imagen calculado durante la descarga.
+ *
+ * @return 0 si la imagen está completa y la descarga calculó el MD5, 1 si no.
+ */
+int image_stream_md5(image_stream *s, uint8_t md5[MD5_DIGEST_SIZE]);
+
+#endif // IMAGE_STREAM_H
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <stdarg.h>
+
+typedef enum {
+    LOG_SINK_INFO = 0,          // avance normal ("Downloading ...", "ESP32 found")
+    LOG_SINK_WARNING,           // se sigue, pero con algo fuera de lo esperado
+    LOG_SINK_ERROR              // el motivo de un fallo
+} log_level;
+
+typedef void (*log_fn)(void *ctx, log_level level, const char *text);
+
+// Destino de los mensajes de la biblioteca; la biblioteca nunca escribe en la consola
+typedef struct {
+    log_fn      fn;
+    void       *ctx;
+} log_sink;
+
+/**
+ * @brief Formatea un mensaje (una línea, sin '\n') y lo entrega a sink.
+ *
+ * Con sink o sink->fn en NULL el mensaje se descarta.
+ */
+void log_message(const log_sink *sink, log_level level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif // LOG_SINK_H
@@ -33,14 +33,26 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
 
 #ifndef _WIN32
 #include <sys/wait.h>
-#include <termios.h>
 #endif
 
 #include "download_file.h"
 #include "esp32_detect.h"
+#include "esp_loader.h"
+#include "especcyflash.h"
+#include "hotplug.h"
+#include "metrics.h"
+#include "monitor.h"
+#include "registry.h"
+#include "tasks.h"
+#include "transfer.h"
+#include "transport.h"
 
 #ifdef _WIN32
     #define ESPUTIL             "esputil.exe"
@@ -50,58 +62,7 @@
     #define ESPUTIL             "esputil_linux"
 #endif
 
-int get_baud_rate(int baud) {
-#ifdef _WIN32
-    // En Windows, solo devolvemos el valor porque se usa directamente
-    switch (baud) {
-        case 9600:
-        case 19200:
-        case 38400:
-        case 57600:
-        case 115200:
-        case 230400:
-        case 460800:
-        case 500000:
-        case 576000:
-        case 921600:
-        case 1000000:
-        case 1152000:
-        case 1500000:
-        case 2000000:
-        case 2500000:
-        case 3000000:
-        case 3500000:
-        case 4000000:
-            return baud;
-    }
-#else
-    // En Unix-like, retornamos las constantes definidas en termios.h
-    switch (baud) {
-        case 9600:    return B9600;
-        case 19200:   return B19200;
-        case 38400:   return B38400;
-        case 57600:   return B57600;
-        case 115200:  return B115200;
-        case 230400:  return B230400;
-#ifndef __APPLE__
-        case 460800:  return B460800;
-        case 500000:  return B500000;
-        case 576000:  return B576000;
-        case 921600:  return B921600;
-        case 1000000: return B1000000;
-        case 1152000: return B1152000;
-        case 1500000: return B1500000;
-        case 2000000: return B2000000;
-        case 2500000: return B2500000;
-        case 3000000: return B3000000;
-        case 3500000: return B3500000;
-        case 4000000: return B4000000;
-#endif
-    }
-#endif
-    fprintf(stderr, "Unsupported baud rate: %d\n", baud);
-    return -1;
-}
+#define ESPECCY_VERSION         "1.3.1"
 
 // Function to show the help message
 void show_help() {
@@ -109,7 +70,14 @@ void show_help() {
     printf("Options:\n");
     printf("  -h                This help\n");
     printf("  -nopsram          Use no PSRAM firmware\n");
+    printf("  -psram            Use the PSRAM firmware even on chips without PSRAM\n");
+    printf("                    (default: picked from the chip package)\n");
     printf("  -b|-baud [rate]   Specify baud rate (default: 115200)\n");
+    printf("                    'auto' picks the fastest rate the link handles\n");
+#if defined(__linux__)
+    printf("                    Any rate from %d to %d that the adapter can do\n", TRANSPORT_BAUD_MIN, TRANSPORT_BAUD_MAX);
+    printf("                    (with -esputil, only the standard rates up to 4000000)\n");
+#else
     printf("                    Supported rates:\n");
     printf("                      9600, 19200, 38400, 57600, 115200, 230400\n");
 #ifndef __APPLE__
@@ -117,6 +85,31 @@ void show_help() {
     printf("                      1152000, 1500000, 2000000, 2500000, 3000000\n");
     printf("                      3500000, 4000000\n");
 #endif
+#endif
+    printf("  -watch            Keep running and flash every ESP32 that gets connected\n");
+    printf("  -all              Flash every ESP32 found, each on its own thread\n");
+    printf("  -p|-port [port]   Serial port of the ESP32 (default: autodetect)\n");
+    printf("  -rescan           Forget the known boards and probe every port again\n");
+    printf("  -nocompress       Send the firmware uncompressed\n");
+    printf("  -diff             Only rewrite the flash regions that differ from the firmware\n");
+    printf("  -nosparse         Write the whole image, including the erased (0xFF) padding\n");
+    printf("  -only [parts]     Only write these parts, comma separated: bootloader,\n");
+    printf("                      partitions, app or a partition name\n");
+    printf("  -esputil          Flash with the external esputil tool instead of the built-in loader\n");
+    printf("  -offline          Flash from the local cache, without network access\n");
+    printf("  -ttl [seconds]    Reuse cached release data for this long (default: %d)\n", RELEASE_TTL_DEFAULT);
+    printf("  -connections [n]  Parallel connections per download (default: %d)\n", TRANSFER_CONNECTIONS_DEFAULT);
+    printf("  -api [url]        GitHub API base URL (default: " GITHUB_API_URL ")\n");
+    printf("  -insecure         Don't verify TLS certificates\n");
+    printf("  -report [format]  Print the time spent in each phase at exit ('text' or 'json')\n");
+    printf("  -monitor          After flashing, show the board's console with a timestamp on\n");
+    printf("                      each line (until Ctrl+C or the board is unplugged)\n");
+    printf("  -monitor-time [s] Stop the monitor after this many seconds\n");
+    printf("  -monitor-baud [n] Console baud rate (default: %d)\n", MONITOR_BAUD_DEFAULT);
+    printf("  -monitor-log [f]  Save the timestamped console to this file\n");
+    printf("                      (with several boards, one file per port: <f>.<port>)\n");
+    printf("  -ready [text]     Console text that marks the firmware as ready\n");
+    printf("                      (default: \"" MONITOR_READY_DEFAULT "\")\n");
     printf("\n");
     printf("GitHub: https://github.com/SplinterGU/ESPeccyFlashTool\n");
 }
@@ -142,12 +135,554 @@ int flash_firmware(const char *firmware_name, const char *port_name, int baud) {
 #endif
 }
 
-int main(int argc, char *argv[]) {
-    printf("ESPeccy Flash Tool - v1.3.1\n");
+// Mensajes de la biblioteca: el avance a stdout, advertencias y errores a stderr
+static void print_log(void *ctx, log_level level, const char *text) {
+    const char *prefix = ctx ? (const char *)ctx : "";
+    fprintf(level == LOG_SINK_INFO ? stdout : stderr, "%s%s\n", prefix, text);
+}
+
+static const log_sink console_log = { print_log, NULL };
+
+// Tarea de detección del puerto del ESP32
+typedef struct {
+    const char *port_name;
+} detect_job;
+
+static int detect_task(void *arg, const volatile int *cancel) {
+    detect_job *job = (detect_job *)arg;
+    char **ports;
+
+    if (job->port_name) return 0;       // puerto indicado con -port
+
+    if (find_esp32_ports(&ports, 0, ESP32_PROBE_TIMEOUT_MS, cancel, &console_log) <= 0) return 1;
+
+    job->port_name = ports[0];
+    free(ports);
+    return 0;
+}
+
+// Cada cuánto se consulta el estado de un flasheo en curso
+#define FLASH_POLL_MS           50
+
+static double now_seconds(void) {
+#ifdef _WIN32
+    return GetTickCount64() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// Presentación en consola de los eventos de un flasheo
+typedef struct {
+    char    prefix[40];     // "[puerto] " con varios equipos, vacío con uno solo
+    int     compress;
+    int     percent;        // último avance mostrado (-1 = ninguno)
+    int     connected;      // ya pasó la detección: los errores siguientes se muestran
+} flash_view;
+
+// Cierra la línea de avance que quedó a medias antes de mostrar otro mensaje
+static void end_progress_line(flash_view *view) {
+    if (!view->prefix[0] && view->percent >= 0 && view->percent < 100) printf("\n");
+    view->percent = -1;
+}
+
+static void show_progress(flash_view *view, uint32_t done, uint32_t total) {
+    int percent = (int)((unsigned long long)done * 100 / total);
+
+    // Con varios equipos a la vez, una línea cada 10 % para que no se pisen
+    if (view->prefix[0]) percent -= percent % 10;
+
+    if (percent == view->percent) return;
+    view->percent = percent;
+
+    if (view->prefix[0]) {
+        printf("%sWriting %u bytes... (%d %%)\n", view->prefix, total, percent);
+        return;
+    }
+    printf("\rWriting %u bytes at 0x00000000... (%d %%)", total, percent);
+    if (done == total) printf("\n");
+    fflush(stdout);
+}
+
+static void show_write_stats(const flash_view *view, const esp_write_stats *stats) {
+    double seconds = stats->seconds > 0.001 ? stats->seconds : 0.001;
+    double effective = stats->size * 8 / seconds / 1000;
+
+    if (stats->written == 0) {
+        printf("%sFlash already up to date (%u bytes compared in %.1f seconds)\n", view->prefix, stats->size, stats->seconds);
+        return;
+    }
+    if (stats->extents > 0 && stats->skipped > 0) {
+        printf("%sSkipped %u bytes of erased padding (%d extents to write)\n", view->prefix, stats->skipped, stats->extents);
+    }
+    if (stats->written < stats->size - stats->skipped) {
+        printf("%sSkipped %u of %u bytes already on flash\n", view->prefix,
+               stats->size - stats->skipped - stats->written, stats->size - stats->skipped);
+    }
+
+    if (view->compress) {
+        printf("%sWrote %u bytes (%u compressed, ratio %.2f:1) at 0x00000000 in %.1f seconds "
+               "(effective %.1f kbit/s, %.1f kbit/s on the wire)\n", view->prefix,
+               stats->written, stats->wire_size, (double)stats->written / (stats->wire_size ? stats->wire_size : 1),
+               stats->seconds, effective, stats->wire_size * 8 / seconds / 1000);
+    } else {
+        printf("%sWrote %u bytes at 0x00000000 in %.1f seconds (%.1f kbit/s)\n", view->prefix,
+               stats->written, stats->seconds, effective);
+    }
+}
+
+static void show_event(void *ctx, const especcy_event *event) {
+    flash_view *view = (flash_view *)ctx;
+
+    switch (event->type) {
+    case ESPECCY_EVENT_STATE:
+        if (event->state == ESPECCY_CONNECTING) {
+            view->connected = 1;
+            printf("%sConnecting to ESP32 on %s...\n", view->prefix, event->port);
+        } else if (event->state == ESPECCY_DONE) {
+            show_write_stats(view, event->stats);
+            printf("%sHash of data verified.\n", view->prefix);
+        } else if (event->state == ESPECCY_FAILED && view->connected) {
+            end_progress_line(view);
+            fprintf(stderr, "%sError! %s\n", view->prefix, event->message);
+        }
+        break;
+
+    case ESPECCY_EVENT_PROGRESS:
+        show_progress(view, event->done, event->total);
+        break;
+
+    case ESPECCY_EVENT_CHIP: {
+        char chip[128];
+        esp_chip_describe(event->chip, chip, sizeof(chip));
+        printf("%sChip is %s\n", view->prefix, chip);
+        if (event->message) printf("%sNo PSRAM on this chip, writing %s\n", view->prefix, event->message);
+        break;
+    }
+
+    case ESPECCY_EVENT_BAUD_TEST:
+        printf("%sTesting %d baud... %s (%d ms)\n", view->prefix, event->baud, event->ok ? "ok" : "errors", event->ms);
+        break;
+
+    case ESPECCY_EVENT_BAUD:
+        if (event->message) {
+            end_progress_line(view);
+            printf("%s%s, retrying at %d baud...\n", view->prefix, event->message, event->baud);
+        } else if (event->state == ESPECCY_NEGOTIATING) {
+            printf("%sUsing %d baud\n", view->prefix, event->baud);
+        }
+        break;
+
+    case ESPECCY_EVENT_LOG:
+        print_log(view->prefix, event->level, event->message);
+        break;
+    }
+}
+
+// Eventos de las descargas: solo traen mensajes
+static void show_firmware_event(void *ctx, const especcy_event *event) {
+    if (event->type == ESPECCY_EVENT_LOG) print_log(ctx, event->level, event->message);
+}
+
+// Espera el final de un flasheo; lo cancela si se interrumpe el programa o falla la descarga
+static especcy_state wait_flash(especcy_flash *flash, const volatile int *cancel) {
+    especcy_state state;
+
+    while (!ESPECCY_FINISHED(state = especcy_flash_poll(flash, NULL))) {
+        especcy_state download = especcy_firmware_poll(especcy_flash_firmware(flash), NULL, NULL);
+        if (*cancel || download == ESPECCY_FAILED || download == ESPECCY_CANCELLED) especcy_flash_cancel(flash);
+        usleep(FLASH_POLL_MS * 1000);
+    }
+    return state;
+}
+
+// Lanza un flasheo con los eventos dirigidos a view
+static especcy_flash *start_flash(especcy_firmware *firmware, const especcy_flash_config *base,
+                                  const char *port, flash_view *view) {
+    especcy_flash_config config = *base;
+    config.port = port;
+    config.on_event = show_event;
+    config.ctx = view;
+
+    especcy_flash *flash = especcy_flash_create(firmware, &config);
+    if (!flash) {
+        fprintf(stderr, "%sOut of memory\n", view->prefix);
+        return NULL;
+    }
+    especcy_flash_start(flash);
+    return flash;
+}
+
+static const char *port_basename(const char *path) {
+    const char *name = strrchr(path, '/');
+    return name ? name + 1 : path;
+}
+
+// Modo -monitor: tras grabar, la consola de cada placa con la hora de cada línea
+typedef struct {
+    int         enabled;
+    int         baud;
+    double      seconds;        // 0: hasta Ctrl+C (o hasta que se desconecte la placa)
+    const char *log;            // archivo de captura; con varias placas se le agrega ".<puerto>"
+    const char *ready;          // NULL: MONITOR_READY_DEFAULT
+} monitor_options;
+
+static monitor_options monitor_opts = { 0, MONITOR_BAUD_DEFAULT, 0, NULL, NULL };
+
+static int monitor_board(const char *port, const char *prefix, int many, const volatile int *cancel) {
+    monitor_config config = { port, monitor_opts.baud, NULL, stdout, prefix, monitor_opts.ready, monitor_opts.seconds, 1 };
+    char log[512];
+    if (monitor_opts.log) {
+        if (many) snprintf(log, sizeof(log), "%s.%s", monitor_opts.log, port_basename(port));
+        else snprintf(log, sizeof(log), "%s", monitor_opts.log);
+        config.output = log;
+    }
+
+    printf("%sMonitoring %s at %d baud%s\n", prefix, port, config.baud,
+           monitor_opts.seconds > 0 ? "" : " (Ctrl+C to stop)");
+
+    monitor_stats stats;
+    if (monitor_run(&config, cancel, &stats) != 0) {
+        fprintf(stderr, "%sMonitor error: %s\n", prefix, stats.error);
+        return 1;
+    }
+
+    char overruns[32] = "unknown";
+    if (stats.overruns >= 0) snprintf(overruns, sizeof(overruns), "%lld", stats.overruns);
+    printf("%sMonitor: %llu bytes, %llu lines in %.1f s, %llu bytes dropped, %s UART overruns\n", prefix,
+           stats.bytes, stats.lines, stats.seconds, stats.dropped, overruns);
+    if (stats.first_byte >= 0) printf("%sFirst byte %.3f s after reset", prefix, stats.first_byte);
+    else printf("%sNothing received after reset", prefix);
+    if (stats.ready >= 0) printf(", ready after %.3f s\n", stats.ready);
+    else printf(", \"%s\" not seen\n", monitor_opts.ready ? monitor_opts.ready : MONITOR_READY_DEFAULT);
+    if (stats.error[0]) printf("%sMonitor stopped: %s\n", prefix, stats.error);
+    if (config.output) printf("%sConsole saved to %s\n", prefix, config.output);
+    return 0;
+}
+
+typedef struct {
+    const char             *port;
+    const char             *prefix;
+    const volatile int     *cancel;
+} monitor_job;
+
+static void *monitor_thread(void *arg) {
+    monitor_job *job = (monitor_job *)arg;
+    monitor_board(job->port, job->prefix, 1, job->cancel);
+    return NULL;
+}
+
+static int flash_one(especcy_firmware *firmware, const especcy_flash_config *base, const volatile int *cancel) {
+    flash_view view = { "", base->compress, -1, 0 };
+
+    especcy_flash *flash = start_flash(firmware, base, base->port, &view);
+    if (!flash) return 1;
+
+    especcy_flash_status status;
+    wait_flash(flash, cancel);
+    especcy_flash_poll(flash, &status);
+    especcy_flash_destroy(flash);
+
+    if (status.state != ESPECCY_DONE) return 1;
+    if (monitor_opts.enabled && !*cancel) monitor_board(status.port, "", 0, cancel);
+    return 0;
+}
+
+// Modo -all: un flasheo por equipo detectado, todos leyendo la misma imagen
+static void show_gang_summary(especcy_flash **flashes, char **ports, int count) {
+    int passed = 0;
+
+    printf("\n%-24s %-6s %9s %10s %10s %8s\n", "Port", "Result", "Baud", "Written", "Wire", "Time");
+    for (int i = 0; i < count; i++) {
+        especcy_flash_status status;
+        memset(&status, 0, sizeof(status));
+        if (flashes[i]) {
+            especcy_flash_poll(flashes[i], &status);
+        } else {
+            status.state = ESPECCY_FAILED;
+            snprintf(status.error, sizeof(status.error), "Out of memory");
+        }
+
+        int ok = status.state == ESPECCY_DONE;
+        passed += ok;
+        printf("%-24s %-6s %9d %10u %10u %7.1fs%s%s\n", ports[i], ok ? "PASS" : "FAIL",
+               status.baud, status.stats.written, status.stats.wire_size, status.seconds,
+               ok ? "" : "  ", ok ? "" : status.error);
+    }
+    printf("%d of %d device%s flashed\n", passed, count, count == 1 ? "" : "s");
+}
+
+static int flash_all(especcy_firmware *firmware, const especcy_flash_config *base, const volatile int *cancel) {
+    char **ports;
+
+    int count = find_esp32_ports(&ports, 1, ESP32_PROBE_TIMEOUT_MS, cancel, &console_log);
+    if (count <= 0) return 1;
+
+    flash_view *views = calloc(count, sizeof(flash_view));
+    especcy_flash **flashes = calloc(count, sizeof(especcy_flash *));
+    if (!views || !flashes) {
+        fprintf(stderr, "Out of memory\n");
+        free(views);
+        free(flashes);
+        free_esp32_ports(ports, count);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        views[i] = (flash_view){ "", base->compress, -1, 0 };
+        snprintf(views[i].prefix, sizeof(views[i].prefix), "[%s] ", port_basename(ports[i]));
+        flashes[i] = start_flash(firmware, base, ports[i], &views[i]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        failed |= !flashes[i] || wait_flash(flashes[i], cancel) != ESPECCY_DONE;
+    }
+
+    show_gang_summary(flashes, ports, count);
+
+    // Las consolas de las placas grabadas se capturan a la vez, una por hilo
+    if (monitor_opts.enabled && !*cancel) {
+        monitor_job *jobs = calloc(count, sizeof(monitor_job));
+        pthread_t *threads = calloc(count, sizeof(pthread_t));
+        int *started = calloc(count, sizeof(int));
+        if (jobs && threads && started) {
+            printf("\n");
+            for (int i = 0; i < count; i++) {
+                especcy_flash_status status;
+                if (!flashes[i] || (especcy_flash_poll(flashes[i], &status), status.state != ESPECCY_DONE)) continue;
+                jobs[i] = (monitor_job){ ports[i], views[i].prefix, cancel };
+                started[i] = pthread_create(&threads[i], NULL, monitor_thread, &jobs[i]) == 0;
+            }
+            for (int i = 0; i < count; i++) {
+                if (started[i]) pthread_join(threads[i], NULL);
+            }
+        }
+        free(started);
+        free(threads);
+        free(jobs);
+    }
+
+    for (int i = 0; i < count; i++) especcy_flash_destroy(flashes[i]);
+    free(flashes);
+    free(views);
+    free_esp32_ports(ports, count);
+    return failed;
+}
+
+// Modo -watch: la imagen queda en memoria y cada placa que se conecta se flashea sola
+#define WATCH_MAX_PORTS         64
+#define WATCH_SETTLE_MS         500     // espera a que udev termine de preparar el nodo
+#define WATCH_REARM_SECONDS     5.0     // tras flashear se ignora el mismo nodo si reaparece enseguida
+
+typedef struct {
+    char        path[300];
+    int         busy;           // hay un hilo trabajando en este puerto
+    double      done_at;        // fin del último flasheo
+} watch_port;
+
+typedef struct {
+    especcy_firmware           *firmware;
+    const especcy_flash_config *base;
+    const volatile int         *cancel;
+    pthread_mutex_t     lock;
+    pthread_cond_t      idle;
+    int                 active;         // hilos en curso
+    int                 passed;
+    int                 failed;
+    watch_port          ports[WATCH_MAX_PORTS];
+    int                 count;
+} watch_state;
+
+typedef struct {
+    watch_state    *state;
+    watch_port     *port;
+} watch_worker;
+
+static void *watch_thread(void *arg) {
+    watch_worker *worker = (watch_worker *)arg;
+    watch_state *state = worker->state;
+    const char *path = worker->port->path;
+
+    usleep(WATCH_SETTLE_MS * 1000);
+
+    // Una placa del registro no hace falta sondearla
+    device_record record;
+    int result = -1;
+    if (!*state->cancel) {
+        if (registry_lookup(path, &record) != 0 && !is_esp32(path)) {
+            printf("[%s] No ESP32 found, ignoring\n", port_basename(path));
+        } else {
+            flash_view view = { "", state->base->compress, -1, 0 };
+            snprintf(view.prefix, sizeof(view.prefix), "[%s] ", port_basename(path));
+
+            especcy_flash *flash = start_flash(state->firmware, state->base, path, &view);
+            if (flash) {
+                especcy_flash_status status;
+                wait_flash(flash, state->cancel);
+                especcy_flash_poll(flash, &status);
+                especcy_flash_destroy(flash);
+
+                result = status.state == ESPECCY_DONE ? 0 : 1;
+                printf("%s%s in %.1f seconds\n", view.prefix, result == 0 ? "PASS" : "FAIL", status.seconds);
+
+                // Sin -monitor-time, hasta que se desconecta la placa
+                if (result == 0 && monitor_opts.enabled && !*state->cancel) {
+                    monitor_board(path, view.prefix, 1, state->cancel);
+                }
+            } else {
+                result = 1;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&state->lock);
+    if (result == 0) state->passed++;
+    else if (result > 0) state->failed++;
+    worker->port->busy = 0;
+    worker->port->done_at = now_seconds();
+    state->active--;
+    pthread_cond_broadcast(&state->idle);
+    pthread_mutex_unlock(&state->lock);
+
+    free(worker);
+    return NULL;
+}
+
+static void watch_event(void *ctx, const char *path, int added) {
+    watch_state *state = (watch_state *)ctx;
+
+    pthread_mutex_lock(&state->lock);
+
+    watch_port *port = NULL;
+    for (int i = 0; i < state->count; i++) {
+        if (strcmp(state->ports[i].path, path) == 0) port = &state->ports[i];
+    }
+
+    if (!added) {
+        if (port) printf("[%s] Disconnected\n", port_basename(path));
+        pthread_mutex_unlock(&state->lock);
+        return;
+    }
+
+    if (!port && state->count < WATCH_MAX_PORTS) {
+        port = &state->ports[state->count++];
+        snprintf(port->path, sizeof(port->path), "%s", path);
+        port->busy = 0;
+        port->done_at = 0;
+    }
+
+    // Las placas con USB-JTAG nativo vuelven a enumerarse al resetearse tras el flasheo
+    if (!port || port->busy || (port->done_at && now_seconds() - port->done_at < WATCH_REARM_SECONDS)) {
+        pthread_mutex_unlock(&state->lock);
+        return;
+    }
+
+    printf("[%s] Connected\n", port_basename(path));
+
+    watch_worker *worker = malloc(sizeof(watch_worker));
+    pthread_t thread;
+    if (worker) {
+        worker->state = state;
+        worker->port = port;
+        port->busy = 1;
+        state->active++;
+        if (pthread_create(&thread, NULL, watch_thread, worker) == 0) {
+            pthread_detach(thread);
+        } else {
+            port->busy = 0;
+            state->active--;
+            free(worker);
+            worker = NULL;
+        }
+    }
+    if (!worker) fprintf(stderr, "[%s] Can't start a worker thread\n", port_basename(path));
+
+    pthread_mutex_unlock(&state->lock);
+}
+
+static int watch_devices(especcy_firmware *firmware, const especcy_flash_config *base, const volatile int *cancel) {
+    watch_state state;
+    memset(&state, 0, sizeof(state));
+    state.firmware = firmware;
+    state.base = base;
+    state.cancel = cancel;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.idle, NULL);
+
+    printf("Waiting for new ESP32 boards (Ctrl+C to stop)...\n");
+    int ret = hotplug_watch(watch_event, &state, cancel);
+    if (ret != 0 && errno == ENOSYS) fprintf(stderr, "Watching for new devices is only supported on Linux\n");
+    else if (ret != 0) fprintf(stderr, "Can't watch %s: %s\n", HOTPLUG_DEV_DIR, strerror(errno));
+
+    // Esperar a los flasheos en curso (la cancelación ya les llegó)
+    pthread_mutex_lock(&state.lock);
+    while (state.active > 0) pthread_cond_wait(&state.idle, &state.lock);
+    pthread_mutex_unlock(&state.lock);
+
+    printf("\n%d board%s flashed, %d failed\n", state.passed, state.passed == 1 ? "" : "s", state.failed);
+
+    pthread_cond_destroy(&state.idle);
+    pthread_mutex_destroy(&state.lock);
+    return ret == 0 && state.failed == 0 ? 0 : 1;
+}
+
+static volatile int interrupted = 0;
+
+static void on_interrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+// Tarea de descarga de un asset (flasheo con esputil) de la última release
+typedef struct {
+    const char *repo;
+    const char *asset_name;
+    const char *error_message;
+    int         executable;
+} download_job;
+
+static int download_task(void *arg, const volatile int *cancel) {
+    download_job *job = (download_job *)arg;
+
+    if (download_file(job->repo, job->asset_name, cancel, &console_log) != 0) {
+        if (!*cancel) fprintf(stderr, "%s", job->error_message);
+        return 1;
+    }
+
+#ifndef _WIN32
+    if (job->executable &&
+        chmod(job->asset_name, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0) {
+        perror("Can't assign execution perms\n");
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+// Formato del informe de fases al salir (NULL = sin informe)
+static const char *report_format = NULL;
+
+static int run(int argc, char *argv[]) {
+    printf("ESPeccy Flash Tool - v" ESPECCY_VERSION "\n");
     printf("Copyright (c) 2024-2025 SplinterGU\n\n");
 
     const char *firmware_name = "complete_firmware.bin";
+    int pick_variant = 1;
+    const char *port_name = NULL;
     int baud_rate = 115200;
+    int use_esputil = 0;
+    int compress = 1;
+    int diff = 0;
+    int sparse = 1;
+    const char *only = NULL;
+    int all = 0;
+    int watch = 0;
+    int rescan = 0;
+    download_config download = { NULL, RELEASE_TTL_DEFAULT, 0, TRANSFER_CONNECTIONS_DEFAULT, 0 };
 
     // Parse command-line arguments
     for (int i = 1; i < argc; ++i) {
@@ -156,10 +691,18 @@ int main(int argc, char *argv[]) {
             return 0;
         } else if (strcmp(argv[i], "-nopsram") == 0) {
             firmware_name = "complete_firmware_nopsram.bin";
+            pick_variant = 0;
+        } else if (strcmp(argv[i], "-psram") == 0) {
+            firmware_name = "complete_firmware.bin";
+            pick_variant = 0;
         } else if (strcmp(argv[i], "-baud") == 0 || strcmp(argv[i], "-b") == 0) {
             if (i + 1 < argc) {
-                baud_rate = atoi(argv[++i]);
-                if (get_baud_rate(baud_rate) == -1) {
+                if (strcmp(argv[++i], "auto") == 0) {
+                    baud_rate = ESP_BAUD_AUTO;
+                    continue;
+                }
+                baud_rate = atoi(argv[i]);
+                if (!transport_baud_supported(baud_rate)) {
                     fprintf(stderr, "Invalid baud rate specified: %d\n", baud_rate);
                     return 1;
                 }
@@ -167,33 +710,205 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Missing value for -baud option\n");
                 return 1;
             }
+        } else if (strcmp(argv[i], "-port") == 0 || strcmp(argv[i], "-p") == 0) {
+            if (i + 1 < argc) {
+                port_name = argv[++i];
+            } else {
+                fprintf(stderr, "Missing value for -port option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-rescan") == 0 || strcmp(argv[i], "--rescan") == 0) {
+            rescan = 1;
+        } else if (strcmp(argv[i], "-nocompress") == 0) {
+            compress = 0;
+        } else if (strcmp(argv[i], "-watch") == 0 || strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        } else if (strcmp(argv[i], "-all") == 0 || strcmp(argv[i], "--all") == 0) {
+            all = 1;
+        } else if (strcmp(argv[i], "-diff") == 0) {
+            diff = 1;
+        } else if (strcmp(argv[i], "-nosparse") == 0) {
+            sparse = 0;
+        } else if (strcmp(argv[i], "-only") == 0 || strcmp(argv[i], "--only") == 0) {
+            if (i + 1 < argc) {
+                only = argv[++i];
+            } else {
+                fprintf(stderr, "Missing value for -only option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-esputil") == 0) {
+            use_esputil = 1;
+        } else if (strcmp(argv[i], "-offline") == 0 || strcmp(argv[i], "--offline") == 0) {
+            download.offline = 1;
+        } else if (strcmp(argv[i], "-insecure") == 0 || strcmp(argv[i], "--insecure") == 0) {
+            download.insecure = 1;
+        } else if (strcmp(argv[i], "-ttl") == 0) {
+            if (i + 1 < argc) {
+                download.release_ttl = atol(argv[++i]);
+            } else {
+                fprintf(stderr, "Missing value for -ttl option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-connections") == 0) {
+            if (i + 1 < argc) {
+                download.connections = atoi(argv[++i]);
+                if (download.connections < 1) {
+                    fprintf(stderr, "Invalid number of connections: %s\n", argv[i]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "Missing value for -connections option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-report") == 0 || strcmp(argv[i], "--report") == 0) {
+            if (i + 1 < argc && (strcmp(argv[i + 1], "json") == 0 || strcmp(argv[i + 1], "text") == 0)) {
+                report_format = argv[++i];
+            } else {
+                fprintf(stderr, "Missing or invalid value for -report option (text or json)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-monitor") == 0 || strcmp(argv[i], "--monitor") == 0) {
+            monitor_opts.enabled = 1;
+        } else if (strcmp(argv[i], "-monitor-time") == 0) {
+            if (i + 1 < argc && atof(argv[i + 1]) > 0) {
+                monitor_opts.enabled = 1;
+                monitor_opts.seconds = atof(argv[++i]);
+            } else {
+                fprintf(stderr, "Missing or invalid value for -monitor-time option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-monitor-baud") == 0) {
+            if (i + 1 < argc && transport_baud_supported(atoi(argv[i + 1]))) {
+                monitor_opts.enabled = 1;
+                monitor_opts.baud = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Missing or invalid value for -monitor-baud option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-monitor-log") == 0) {
+            if (i + 1 < argc) {
+                monitor_opts.enabled = 1;
+                monitor_opts.log = argv[++i];
+            } else {
+                fprintf(stderr, "Missing value for -monitor-log option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-ready") == 0) {
+            if (i + 1 < argc) {
+                monitor_opts.ready = argv[++i];
+            } else {
+                fprintf(stderr, "Missing value for -ready option\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-api") == 0) {
+            if (i + 1 < argc) {
+                download.api_url = argv[++i];
+            } else {
+                fprintf(stderr, "Missing value for -api option\n");
+                return 1;
+            }
         }
     }
 
-    const char *port_name = find_esp32_port();
-    if (!port_name) return -1;
-
-    if (download_file("SplinterGU/ESPeccy", firmware_name) != 0) {
-        fprintf(stderr, "Firmware download error... aborting...\n");
+    // esputil solo acepta las velocidades estándar, no las arbitrarias del transporte
+    if (use_esputil && baud_rate != ESP_BAUD_AUTO && get_baud_rate(baud_rate) == -1) {
+        fprintf(stderr, "Invalid baud rate specified for esputil: %d (use one of the standard rates)\n", baud_rate);
         return 1;
     }
 
-    if (download_file("SplinterGU/esputil", ESPUTIL) != 0) {
-        fprintf(stderr, "Flash tool download error... aborting...\n");
+    if (especcy_init(&download) != 0) {
+        fprintf(stderr, "Can't initialize network... aborting...\n");
         return 1;
     }
 
-#ifndef _WIN32
-    if (chmod(ESPUTIL, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0) {
-        perror("Can't assign execution perms\n");
+    if (rescan) registry_clear();
+
+    if (!use_esputil) {
+        // La detección, la sincronización y la identificación del chip corren
+        // mientras se descarga. Los bloques sólo siguen a la descarga con
+        // -nosparse -nocompress: el mapa de particiones necesita la imagen
+        // completa y la escritura comprimida el total de bloques comprimidos.
+        especcy_firmware *firmware = especcy_firmware_create("SplinterGU/ESPeccy", firmware_name, show_firmware_event, NULL);
+        if (!firmware || especcy_firmware_start(firmware) != 0) {
+            fprintf(stderr, "Firmware download error... aborting...\n");
+            especcy_firmware_destroy(firmware);
+            return 1;
+        }
+
+        // El firmware sin PSRAM se descarga solo si aparece un chip que lo necesita
+        especcy_firmware *nopsram = NULL;
+        if (pick_variant) nopsram = especcy_firmware_create("SplinterGU/ESPeccy", "complete_firmware_nopsram.bin", show_firmware_event, NULL);
+
+        especcy_flash_config flash = { port_name, baud_rate, compress, diff, sparse, only, NULL, NULL, nopsram };
+        int ret;
+
+        // Ctrl+C termina el monitor (o la vigilancia) de forma ordenada
+        if (watch || monitor_opts.enabled) {
+            signal(SIGINT, on_interrupt);
+            signal(SIGTERM, on_interrupt);
+        }
+
+        if (watch) {
+            // La release se resuelve y descarga una sola vez; la imagen queda mapeada para toda la sesión
+
+            ret = especcy_firmware_wait(firmware) != ESPECCY_DONE || watch_devices(firmware, &flash, &interrupted) != 0;
+        } else if (all && !port_name) {
+            // Con -all todos los equipos comparten la descarga: la imagen se baja una sola vez
+            ret = flash_all(firmware, &flash, &interrupted);
+        } else {
+            ret = flash_one(firmware, &flash, &interrupted);
+        }
+
+        especcy_state download = especcy_firmware_poll(firmware, NULL, NULL);
+        if (nopsram && especcy_firmware_poll(nopsram, NULL, NULL) == ESPECCY_FAILED) download = ESPECCY_FAILED;
+        especcy_firmware_destroy(firmware);
+        especcy_firmware_destroy(nopsram);
+
+        // Con la variante sin PSRAM, la descarga del otro firmware puede fallar sin afectar el flasheo
+        if (ret != 0 && download == ESPECCY_FAILED) {
+            fprintf(stderr, "Firmware download error... aborting...\n");
+            return 1;
+        }
+        if (ret != 0) {
+            if (!watch) fprintf(stderr, "Error! can't flash the firmware\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    // Detección del puerto y ambas descargas son independientes: correrlas a la vez
+    detect_job detect = { port_name };
+    download_job firmware = { "SplinterGU/ESPeccy", firmware_name, "Firmware download error... aborting...\n", 0 };
+    download_job flasher = { "SplinterGU/esputil", ESPUTIL, "Flash tool download error... aborting...\n", 1 };
+
+    task tasks[] = {
+        { .name = "detect",   .fn = detect_task,   .arg = &detect },
+        { .name = "firmware", .fn = download_task, .arg = &firmware },
+        { .name = "esputil",  .fn = download_task, .arg = &flasher },
+    };
+
+    if (run_tasks(tasks, sizeof(tasks) / sizeof(tasks[0])) != 0) {
+        if (detect.port_name != port_name) free((void *)detect.port_name);
         return 1;
     }
-#endif
 
-    if (flash_firmware(firmware_name, port_name, baud_rate) != 0) {
+    if (flash_firmware(firmware_name, detect.port_name, baud_rate == ESP_BAUD_AUTO ? ESP32_ROM_BAUD : baud_rate) != 0) {
         fprintf(stderr, "Error! can't flash the firmware\n");
+        if (detect.port_name != port_name) free((void *)detect.port_name);
         return 1;
     }
 
+    if (detect.port_name != port_name) free((void *)detect.port_name);
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    metrics_now();      // origen de las mediciones
+
+    int ret = run(argc, argv);
+
+    if (report_format && strcmp(report_format, "json") == 0) metrics_write_json(stdout, ESPECCY_VERSION, ret);
+    else if (report_format) metrics_write_text(stdout);
+
+    return ret;
+}
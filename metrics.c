@@ -0,0 +1,159 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "metrics.h"
+
+typedef struct {
+    char        phase[16];
+    char        subject[128];
+    double      start;          // segundos desde la primera medición
+    double      seconds;
+    long long   bytes;
+    int         ok;
+} metrics_entry;
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   origin_once = PTHREAD_ONCE_INIT;
+static double           origin;
+static metrics_entry   *entries;
+static int              count;
+static int              capacity;
+
+static double clock_seconds(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static void set_origin(void) {
+    origin = clock_seconds();
+}
+
+double metrics_now(void) {
+    pthread_once(&origin_once, set_origin);
+    return clock_seconds();
+}
+
+void metrics_phase(const char *phase, const char *subject, double start, long long bytes, int ok) {
+    metrics_span(phase, subject, start, metrics_now(), bytes, ok);
+}
+
+void metrics_span(const char *phase, const char *subject, double start, double end, long long bytes, int ok) {
+    double seconds = end - start;
+
+    pthread_mutex_lock(&lock);
+    if (count == capacity) {
+        int grow = capacity ? capacity * 2 : 64;
+        metrics_entry *list = realloc(entries, grow * sizeof(metrics_entry));
+        if (!list) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        entries = list;
+        capacity = grow;
+    }
+
+    metrics_entry *e = &entries[count++];
+    snprintf(e->phase, sizeof(e->phase), "%s", phase);
+    snprintf(e->subject, sizeof(e->subject), "%s", subject ? subject : "");
+    e->start = start - origin;
+    e->seconds = seconds;
+    e->bytes = bytes;
+    e->ok = ok;
+    pthread_mutex_unlock(&lock);
+}
+
+// Cadena JSON con los caracteres de control y las comillas escapadas
+static void write_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+        else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+        else fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+void metrics_write_json(FILE *fp, const char *version, int exit_code) {
+    double total = metrics_now() - origin;
+
+    pthread_mutex_lock(&lock);
+    fprintf(fp, "{\"version\":");
+    write_string(fp, version);
+    fprintf(fp, ",\"exit_code\":%d,\"seconds\":%.6f,\"phases\":[", exit_code, total);
+
+    for (int i = 0; i < count; i++) {
+        const metrics_entry *e = &entries[i];
+        fprintf(fp, "%s{\"phase\":", i ? "," : "");
+        write_string(fp, e->phase);
+        fprintf(fp, ",\"subject\":");
+        write_string(fp, e->subject);
+        fprintf(fp, ",\"start\":%.6f,\"seconds\":%.6f,\"bytes\":%lld", e->start, e->seconds, e->bytes);
+        if (e->bytes > 0 && e->seconds > 0) fprintf(fp, ",\"bytes_per_second\":%.0f", e->bytes / e->seconds);
+        fprintf(fp, ",\"ok\":%s}", e->ok ? "true" : "false");
+    }
+
+    fprintf(fp, "]}\n");
+    pthread_mutex_unlock(&lock);
+    fflush(fp);
+}
+
+void metrics_write_text(FILE *fp) {
+    pthread_mutex_lock(&lock);
+    fprintf(fp, "\n%-9s %-28s %9s %9s %12s %12s\n", "Phase", "Subject", "Start", "Seconds", "Bytes", "Bytes/s");
+    for (int i = 0; i < count; i++) {
+        const metrics_entry *e = &entries[i];
+        fprintf(fp, "%-9s %-28.28s %9.3f %9.3f", e->phase, e->subject, e->start, e->seconds);
+        if (e->bytes > 0) fprintf(fp, " %12lld", e->bytes);
+        else fprintf(fp, " %12s", "-");
+        if (e->bytes > 0 && e->seconds > 0) fprintf(fp, " %12.0f", e->bytes / e->seconds);
+        else fprintf(fp, " %12s", "-");
+        fprintf(fp, "%s\n", e->ok ? "" : "  FAILED");
+    }
+    pthread_mutex_unlock(&lock);
+}
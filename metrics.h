@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+// Nombres de las fases que se miden
+#define METRICS_SCAN        "scan"          // búsqueda del puerto (todas las sondas)
+#define METRICS_PROBE       "probe"         // is_esp32() sobre un puerto
+#define METRICS_METADATA    "metadata"      // consulta de la release a la API
+#define METRICS_DOWNLOAD    "download"      // descarga del asset
+#define METRICS_RESET       "reset"         // pulso de reset al modo descarga
+#define METRICS_SYNC        "sync"          // desde el reset hasta la respuesta al SYNC
+#define METRICS_IDENTIFY    "identify"      // lectura del chip, el encapsulado y la flash
+#define METRICS_COMPRESS    "compress"      // deflate de la imagen
+#define METRICS_DIFF        "diff"          // lectura de los MD5 de la flash (modo diferencial)
+#define METRICS_ERASE       "erase"         // FLASH_BEGIN / FLASH_DEFL_BEGIN
+#define METRICS_WRITE       "write"         // envío de los bloques de datos
+#define METRICS_VERIFY      "verify"        // MD5 final de la flash
+#define METRICS_MONITOR     "monitor"       // captura de la consola tras el flasheo
+#define METRICS_READY       "ready"         // desde el reset hasta la línea "listo" del firmware
+
+/**
+ * @brief Segundos de un reloj monótono, para medir fases.
+ */
+double metrics_now(void);
+
+/**
+ * @brief Registra una fase que empezó en start y termina ahora.
+ *
+ * Se puede llamar desde cualquier hilo.
+ *
+ * @param phase Nombre de la fase (METRICS_*).
+ * @param subject Puerto, repositorio o asset sobre el que se trabajó (o NULL).
+ * @param start Valor de metrics_now() al empezar.
+ * @param bytes Bytes procesados en la fase (0 si no aplica).
+ * @param ok 1 si la fase terminó bien.
+ */
+void metrics_phase(const char *phase, const char *subject, double start, long long bytes, int ok);
+
+/**
+ * @brief Como metrics_phase(), para una fase que terminó en end (un valor
+ * anterior de metrics_now()).
+ */
+void metrics_span(const char *phase, const char *subject, double start, double end, long long bytes, int ok);
+
+/**
+ * @brief Escribe todas las fases registradas como un objeto JSON de una línea.
+ *
+ * @param exit_code Código de salida del programa.
+ */
+void metrics_write_json(FILE *fp, const char *version, int exit_code);
+
+/**
+ * @brief Escribe las fases registradas como una tabla legible.
+ */
+void metrics_write_text(FILE *fp);
+
+#endif // METRICS_H
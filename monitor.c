@@ -0,0 +1,428 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <linux/serial.h>
+#endif
+#endif
+
+#include "esp32_detect.h"
+#include "metrics.h"
+#include "monitor.h"
+#include "transport.h"
+
+#define MONITOR_READ_SIZE       (64 * 1024)     // lectura máxima del puerto de una vez
+#define MONITOR_WAIT_MS         50              // el lector revisa si hay que parar cada tanto
+#define MONITOR_IDLE_MS         5               // pausa del escritor con el buffer vacío
+#define MONITOR_LINE_MAX        4096            // las líneas más largas se parten
+#define MONITOR_OUTPUT_BUFFER   (256 * 1024)    // buffer de stdio del archivo de captura
+
+// Cada lectura entra al buffer circular con esta cabecera delante
+typedef struct {
+    double      time;           // metrics_now() al leer
+    uint32_t    size;
+    uint32_t    dropped;        // bytes descartados justo antes de esta lectura
+} chunk_header;
+
+typedef struct {
+    transport               link;
+    const monitor_config   *config;
+    const char             *ready_text;
+    FILE                   *output;
+    double                  reset_at;
+
+    // Buffer circular de un productor (lector) y un consumidor (escritor)
+    uint8_t                *ring;
+    size_t                  head;           // solo lo avanza el lector
+    size_t                  tail;           // solo lo avanza el escritor
+
+    volatile int            stop;           // pedido de fin al lector
+    volatile int            reading;        // 0 cuando el lector ya no va a escribir más
+    volatile int            lost;           // el puerto desapareció
+
+    // Del lector
+    uint8_t                 in[MONITOR_READ_SIZE];
+    unsigned long long      bytes;
+    unsigned long long      dropped;
+    uint32_t                pending_drop;
+    double                  drop_time;      // hora del primer byte de pending_drop
+    double                  first_byte;
+    long long               overruns;       // Windows: errores de overrun vistos
+
+    // Del escritor
+    uint8_t                 out[MONITOR_READ_SIZE];
+    char                    line[MONITOR_LINE_MAX];
+    size_t                  line_len;
+    int                     line_open;
+    double                  line_time;
+    unsigned long long      lines;
+    double                  ready;
+} monitor;
+
+static void sleep_ms(int ms) {
+#if defined(_WIN32) || defined(_WIN64)
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+static void ring_copy_in(monitor *m, size_t pos, const void *data, size_t size) {
+    size_t at = pos & (MONITOR_RING_SIZE - 1);
+    size_t first = MONITOR_RING_SIZE - at < size ? MONITOR_RING_SIZE - at : size;
+    memcpy(m->ring + at, data, first);
+    memcpy(m->ring, (const uint8_t *)data + first, size - first);
+}
+
+static void ring_copy_out(monitor *m, size_t pos, void *data, size_t size) {
+    size_t at = pos & (MONITOR_RING_SIZE - 1);
+    size_t first = MONITOR_RING_SIZE - at < size ? MONITOR_RING_SIZE - at : size;
+    memcpy(data, m->ring + at, first);
+    memcpy((uint8_t *)data + first, m->ring, size - first);
+}
+
+// Lector: escribe una lectura con su cabecera, si entra
+static int ring_put(monitor *m, double time, const uint8_t *data, size_t size) {
+    size_t head = m->head;
+    size_t tail = __atomic_load_n(&m->tail, __ATOMIC_ACQUIRE);
+    if (MONITOR_RING_SIZE - (head - tail) < sizeof(chunk_header) + size) return -1;
+
+    chunk_header header = { time, (uint32_t)size, m->pending_drop };
+    ring_copy_in(m, head, &header, sizeof(header));
+    if (size) ring_copy_in(m, head + sizeof(header), data, size);
+    m->pending_drop = 0;
+    __atomic_store_n(&m->head, head + sizeof(header) + size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Lector: deja una lectura en el buffer, o la cuenta como descartada si no entra
+static void ring_push(monitor *m, double time, const uint8_t *data, size_t size) {
+    m->bytes += size;
+    if (m->first_byte < 0) m->first_byte = time;
+
+    if (ring_put(m, time, data, size) != 0) {
+        if (!m->pending_drop) m->drop_time = time;
+        m->dropped += size;
+        m->pending_drop += (uint32_t)size;
+    }
+}
+
+static long long port_overruns(monitor *m) {
+#if defined(__linux__)
+    struct serial_icounter_struct icount;
+    if (ioctl(m->link.fd, TIOCGICOUNT, &icount) == 0) return (long long)icount.overrun + icount.buf_overrun;
+#elif defined(_WIN32) || defined(_WIN64)
+    return m->overruns;
+#else
+    (void)m;
+#endif
+    return -1;
+}
+
+static void *reader_thread(void *arg) {
+    monitor *m = (monitor *)arg;
+
+#if defined(_WIN32) || defined(_WIN64)
+    while (!m->stop) {
+        DWORD errors = 0;
+        if (ClearCommError(m->link.fd, &errors, NULL) && (errors & (CE_OVERRUN | CE_RXOVER))) m->overruns++;
+
+        // Vuelve con lo que haya o a los TRANSPORT_READ_SLICE_MS
+        int n = transport_read(&m->link, m->in, sizeof(m->in), MONITOR_WAIT_MS);
+        if (n < 0) {
+            m->lost = 1;
+            break;
+        }
+        if (n > 0) ring_push(m, metrics_now(), m->in, (size_t)n);
+    }
+#else
+    int ep = -1;
+#if defined(__linux__)
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = m->link.fd;
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep != -1 && epoll_ctl(ep, EPOLL_CTL_ADD, m->link.fd, &event) != 0) {
+        close(ep);
+        ep = -1;
+    }
+#endif
+
+    while (!m->stop && !m->lost) {
+        int ready;
+#if defined(__linux__)
+        if (ep != -1) {
+            ready = epoll_wait(ep, &event, 1, MONITOR_WAIT_MS);
+        } else
+#endif
+        {
+            struct pollfd pfd = { m->link.fd, POLLIN, 0 };
+            ready = poll(&pfd, 1, MONITOR_WAIT_MS);
+        }
+        if (ready < 0 && errno != EINTR) m->lost = 1;
+        if (ready <= 0) continue;
+
+        // Vaciar lo que haya en el driver de una vez: el puerto es no bloqueante
+        for (;;) {
+            ssize_t n = read(m->link.fd, m->in, sizeof(m->in));
+            if (n > 0) {
+                ring_push(m, metrics_now(), m->in, (size_t)n);
+                if ((size_t)n < sizeof(m->in)) break;
+            } else {
+                // Listo para leer pero sin datos (0 o EIO): la placa se desconectó
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) m->lost = 1;
+                break;
+            }
+        }
+    }
+
+    if (ep != -1) close(ep);
+#endif
+
+    // Que la captura deje constancia también de lo último que se descartó
+    while (m->pending_drop && ring_put(m, m->drop_time, NULL, 0) != 0) sleep_ms(MONITOR_IDLE_MS);
+
+    __atomic_store_n(&m->reading, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void write_line(monitor *m, double time, const char *text, size_t size) {
+    double t = time - m->reset_at;
+
+    if (m->output) {
+        fprintf(m->output, "[%10.6f] ", t);
+        fwrite(text, 1, size, m->output);
+        fputc('\n', m->output);
+    }
+    if (m->config->echo) {
+        // Una sola llamada por línea: con varias placas, las líneas no se mezclan
+        fprintf(m->config->echo, "%s[%10.6f] %.*s\n", m->config->prefix ? m->config->prefix : "", t, (int)size, text);
+    }
+}
+
+static void end_line(monitor *m) {
+    m->line[m->line_len] = 0;
+    write_line(m, m->line_time, m->line, m->line_len);
+    if (m->ready < 0 && strstr(m->line, m->ready_text)) m->ready = m->line_time;
+
+    m->lines++;
+    m->line_len = 0;
+    m->line_open = 0;
+}
+
+// Escritor: arma las líneas, cada una con la hora de la lectura en la que empezó
+static void feed(monitor *m, double time, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        char c = (char)data[i];
+        if (c == '\r') continue;
+
+        if (!m->line_open) {
+            m->line_open = 1;
+            m->line_time = time;
+        }
+        if (c == '\n') {
+            end_line(m);
+            continue;
+        }
+
+        if (m->line_len == sizeof(m->line) - 1) {
+            end_line(m);
+            m->line_open = 1;
+            m->line_time = time;
+        }
+        m->line[m->line_len++] = c;
+    }
+}
+
+static void *writer_thread(void *arg) {
+    monitor *m = (monitor *)arg;
+
+    for (;;) {
+        size_t head = __atomic_load_n(&m->head, __ATOMIC_ACQUIRE);
+        if (head == m->tail) {
+            if (__atomic_load_n(&m->reading, __ATOMIC_ACQUIRE)) {
+                sleep_ms(MONITOR_IDLE_MS);
+                continue;
+            }
+            // El lector terminó: lo último que dejó ya es visible
+            if (__atomic_load_n(&m->head, __ATOMIC_ACQUIRE) == m->tail) break;
+            continue;
+        }
+
+        // Copiar y liberar el espacio antes de escribir, así el lector no espera al disco
+        chunk_header header;
+        ring_copy_out(m, m->tail, &header, sizeof(header));
+        ring_copy_out(m, m->tail + sizeof(header), m->out, header.size);
+        __atomic_store_n(&m->tail, m->tail + sizeof(header) + header.size, __ATOMIC_RELEASE);
+
+        if (header.dropped) {
+            char note[64];
+            int size = snprintf(note, sizeof(note), "<%u bytes lost, capture buffer full>", header.dropped);
+            if (m->line_open) end_line(m);
+            write_line(m, header.time, note, (size_t)size);
+        }
+        feed(m, header.time, m->out, header.size);
+    }
+
+    if (m->line_open) end_line(m);
+    if (m->output) fflush(m->output);
+    if (m->config->echo) fflush(m->config->echo);
+    return NULL;
+}
+
+static int open_port(monitor *m, const char *port, int baud) {
+    if (transport_open(&m->link, port) != 0) return -1;
+    if (baud != ESP32_ROM_BAUD && transport_set_baud(&m->link, baud) != 0) {
+        transport_close(&m->link);
+        return -1;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    // Buffer del driver grande, por si el lector se demora
+    SetupComm(m->link.fd, MONITOR_READ_SIZE * 4, 4096);
+#endif
+    transport_discard_input(&m->link);
+    return 0;
+}
+
+int monitor_run(const monitor_config *config, const volatile int *cancel, monitor_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->overruns = -1;
+    stats->first_byte = -1;
+    stats->ready = -1;
+
+    int baud = config->baud ? config->baud : MONITOR_BAUD_DEFAULT;
+    monitor *m = calloc(1, sizeof(monitor));
+    if (m) m->ring = malloc(MONITOR_RING_SIZE);
+    if (!m || !m->ring) {
+        snprintf(stats->error, sizeof(stats->error), "Out of memory");
+        free(m);
+        return -1;
+    }
+    m->config = config;
+    m->ready_text = config->ready ? config->ready : MONITOR_READY_DEFAULT;
+    m->first_byte = -1;
+    m->ready = -1;
+
+    if (open_port(m, config->port, baud) != 0) {
+        snprintf(stats->error, sizeof(stats->error), "Can't open %s at %d baud", config->port, baud);
+        free(m->ring);
+        free(m);
+        return -1;
+    }
+
+    if (config->output) {
+        m->output = fopen(config->output, "w");
+        if (!m->output) {
+            snprintf(stats->error, sizeof(stats->error), "Can't create %s: %s", config->output, strerror(errno));
+            transport_close(&m->link);
+            free(m->ring);
+            free(m);
+            return -1;
+        }
+        setvbuf(m->output, NULL, _IOFBF, MONITOR_OUTPUT_BUFFER);
+    }
+
+    long long overruns = port_overruns(m);
+    double start = metrics_now();
+    m->reset_at = start;
+    m->reading = 1;
+
+    // El lector arranca antes del reset para no perder los primeros bytes del arranque
+    pthread_t reader, writer;
+    int started = pthread_create(&reader, NULL, reader_thread, m) == 0;
+    if (started) {
+        if (config->reset) {
+            hard_reset_esp32(m->link.fd);
+            m->reset_at = metrics_now();    // el chip arranca al soltar EN
+        }
+        started = pthread_create(&writer, NULL, writer_thread, m) == 0;
+        if (!started) {
+            m->stop = 1;
+            pthread_join(reader, NULL);
+        }
+    }
+    if (!started) {
+        snprintf(stats->error, sizeof(stats->error), "Can't start the monitor threads");
+        if (m->output) fclose(m->output);
+        transport_close(&m->link);
+        free(m->ring);
+        free(m);
+        return -1;
+    }
+
+    while (!(cancel && *cancel) && !m->lost &&
+           (config->seconds <= 0 || metrics_now() - m->reset_at < config->seconds)) {
+        sleep_ms(MONITOR_WAIT_MS);
+    }
+
+    m->stop = 1;
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    long long overruns_end = port_overruns(m);
+    if (overruns >= 0 && overruns_end >= 0) stats->overruns = overruns_end - overruns;
+
+    stats->bytes = m->bytes;
+    stats->lines = m->lines;
+    stats->dropped = m->dropped;
+    stats->seconds = metrics_now() - m->reset_at;
+    if (m->first_byte >= 0) stats->first_byte = m->first_byte - m->reset_at;
+    if (m->ready >= 0) stats->ready = m->ready - m->reset_at;
+    if (m->lost) snprintf(stats->error, sizeof(stats->error), "%s disconnected", config->port);
+
+    metrics_phase(METRICS_MONITOR, config->port, start, (long long)m->bytes, !m->lost && m->dropped == 0);
+    if (m->ready >= 0) metrics_span(METRICS_READY, config->port, m->reset_at, m->ready, 0, 1);
+
+    int ret = 0;
+    if (m->output && fclose(m->output) != 0) {
+        snprintf(stats->error, sizeof(stats->error), "Can't write %s", config->output);
+        ret = -1;
+    }
+    transport_close(&m->link);
+    free(m->ring);
+    free(m);
+    return ret;
+}
@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdio.h>
+
+// Velocidad de la consola del firmware (la del ROM y del ESP-IDF por defecto)
+#define MONITOR_BAUD_DEFAULT    115200
+
+// Buffer entre la lectura del puerto y la escritura de la captura (potencia de 2)
+#define MONITOR_RING_SIZE       (4 * 1024 * 1024)
+
+// Línea que marca el firmware en marcha si no se indica otra
+#define MONITOR_READY_DEFAULT   "Calling app_main()"
+
+/*
+ * Monitor serie tras el flasheo.
+ *
+ * Un hilo lee el puerto (epoll en Linux, poll en el resto, ReadFile en
+ * Windows) y deja cada lectura con su hora en un buffer circular sin locks;
+ * otro hilo arma las líneas, les pone la hora (reloj monotónico, desde el
+ * reset) y las escribe en el archivo de captura. Así una escritura lenta a
+ * disco no frena la lectura: si el buffer se llena, los bytes que no entran
+ * se descartan y se cuentan en lugar de perderse en silencio en el driver.
+ */
+typedef struct {
+    const char         *port;
+    int                 baud;           // 0: MONITOR_BAUD_DEFAULT
+    const char         *output;         // archivo de captura (NULL: sin archivo)
+    FILE               *echo;           // copia de cada línea (ej. stdout), o NULL
+    const char         *prefix;         // antepuesto a cada línea del eco (o NULL)
+    const char         *ready;          // texto de la línea "listo" (NULL: MONITOR_READY_DEFAULT)
+    double              seconds;        // duración, 0 = hasta cancelar
+    int                 reset;          // resetear el chip al abrir para capturar el arranque
+} monitor_config;
+
+typedef struct {
+    unsigned long long  bytes;          // recibidos del puerto
+    unsigned long long  lines;
+    unsigned long long  dropped;        // descartados por buffer lleno
+    long long           overruns;       // overruns del UART/driver (TIOCGICOUNT), -1 si no se saben
+    double              first_byte;     // segundos desde el reset hasta el primer byte (-1: no llegó)
+    double              ready;          // segundos desde el reset hasta la línea "listo" (-1: no apareció)
+    double              seconds;        // duración de la captura
+    char                error[160];
+} monitor_stats;
+
+/**
+ * @brief Captura la consola del puerto hasta que pasen config->seconds, se
+ * active cancel o el puerto desaparezca.
+ *
+ * Registra las fases METRICS_MONITOR y, si apareció la línea "listo",
+ * METRICS_READY.
+ *
+ * @param cancel Bandera de cancelación (puede ser NULL).
+ * @return 0 si la captura terminó bien (aunque se hayan descartado bytes),
+ *         -1 si no se pudo abrir el puerto o el archivo (ver stats->error).
+ */
+int monitor_run(const monitor_config *config, const volatile int *cancel, monitor_stats *stats);
+
+#endif // MONITOR_H
@@ -0,0 +1,261 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <process.h>
+    #define getpid          _getpid
+#else
+    #include <unistd.h>
+#endif
+
+#include "cache.h"
+#include "registry.h"
+#include "serial_enum.h"
+
+#define REGISTRY_MAX_RECORDS    256
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int temp_counter = 0;
+
+typedef struct {
+    int             count;
+    device_record   records[REGISTRY_MAX_RECORDS];
+} registry;
+
+static const char *field_out(const char *value) {
+    return *value ? value : "-";
+}
+
+static void field_in(char *dest, size_t size, const char *value) {
+    snprintf(dest, size, "%s", strcmp(value, "-") ? value : "");
+}
+
+// Clave e identidad del adaptador conectado en path, según sysfs
+static void port_key(const char *path, char *key, size_t key_size, char *identity, size_t identity_size) {
+    identity[0] = '\0';
+    int has_serial = 0;
+
+    serial_port_info *ports;
+    int count = enumerate_serial_ports(NULL, &ports);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(ports[i].path, path) != 0) continue;
+        if (ports[i].serial[0]) {
+            snprintf(identity, identity_size, "usb:%04x:%04x:%s", ports[i].vid, ports[i].pid, ports[i].serial);
+            has_serial = 1;
+        } else {
+            snprintf(identity, identity_size, "usb:%04x:%04x", ports[i].vid, ports[i].pid);
+        }
+        break;
+    }
+    if (count >= 0) free(ports);
+
+    // Con número de serie la placa se reconoce aunque cambie de puerto
+    if (has_serial) {
+        snprintf(key, key_size, "%s", identity);
+    } else {
+        snprintf(key, key_size, "path:%s", path);
+    }
+}
+
+static void registry_path(char *path, size_t size) {
+    snprintf(path, size, "%s/devices", cache_dir());
+}
+
+// Formato: una placa por línea, "key identity path chip baud reset updated" separados por tabs
+static void load(registry *r) {
+    r->count = 0;
+
+    char path[1100];
+    registry_path(path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+
+    char line[1024];
+    while (r->count < REGISTRY_MAX_RECORDS && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char *f[7];
+        int n = 0;
+        for (char *p = line; n < 7 && p; n++) {
+            f[n] = p;
+            p = strchr(p, '\t');
+            if (p) *p++ = '\0';
+        }
+        if (n != 7) continue;
+
+        device_record *rec = &r->records[r->count++];
+        field_in(rec->key, sizeof(rec->key), f[0]);
+        field_in(rec->identity, sizeof(rec->identity), f[1]);
+        field_in(rec->path, sizeof(rec->path), f[2]);
+        field_in(rec->chip, sizeof(rec->chip), f[3]);
+        rec->baud = atoi(f[4]);
+        field_in(rec->reset, sizeof(rec->reset), f[5]);
+        rec->updated = atoll(f[6]);
+    }
+    fclose(fp);
+}
+
+static int save(const registry *r) {
+    char path[1100], temp[1200];
+    registry_path(path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.%d.%u.tmp", path, (int)getpid(), ++temp_counter);
+
+    FILE *fp = fopen(temp, "w");
+    if (!fp) return 1;
+
+    for (int i = 0; i < r->count; i++) {
+        const device_record *rec = &r->records[i];
+        fprintf(fp, "%s\t%s\t%s\t%s\t%d\t%s\t%lld\n", rec->key, field_out(rec->identity), field_out(rec->path),
+                field_out(rec->chip), rec->baud, field_out(rec->reset), rec->updated);
+    }
+
+    if (fclose(fp) != 0) {
+        remove(temp);
+        return 1;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    remove(path);
+#endif
+    if (rename(temp, path) != 0) {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+static int find(const registry *r, const char *key) {
+    for (int i = 0; i < r->count; i++) {
+        if (strcmp(r->records[i].key, key) == 0) return i;
+    }
+    return -1;
+}
+
+static void drop(registry *r, int index) {
+    memmove(&r->records[index], &r->records[index + 1], (size_t)(r->count - index - 1) * sizeof(device_record));
+    r->count--;
+}
+
+int registry_lookup(const char *path, device_record *record) {
+    if (!cache_dir()) return 1;
+
+    char key[sizeof(record->key)], identity[sizeof(record->identity)];
+    port_key(path, key, sizeof(key), identity, sizeof(identity));
+
+    registry *r = malloc(sizeof(registry));
+    if (!r) return 1;
+
+    pthread_mutex_lock(&registry_lock);
+    load(r);
+
+    int ret = 1;
+    int i = find(r, key);
+    if (i >= 0) {
+        const device_record *rec = &r->records[i];
+        long long age = (long long)time(NULL) - rec->updated;
+
+        // Otro adaptador en la misma ruta, o datos viejos: se vuelve a sondear
+        if (strcmp(rec->identity, identity) != 0 || age < 0 || age > REGISTRY_MAX_AGE) {
+            drop(r, i);
+            save(r);
+        } else {
+            *record = *rec;
+            snprintf(record->path, sizeof(record->path), "%s", path);
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    free(r);
+    return ret;
+}
+
+int registry_store(const char *path, const device_record *record) {
+    if (!cache_dir()) return 1;
+
+    registry *r = malloc(sizeof(registry));
+    if (!r) return 1;
+
+    device_record rec = *record;
+    port_key(path, rec.key, sizeof(rec.key), rec.identity, sizeof(rec.identity));
+    snprintf(rec.path, sizeof(rec.path), "%s", path);
+    rec.updated = (long long)time(NULL);
+
+    pthread_mutex_lock(&registry_lock);
+    load(r);
+
+    int i = find(r, rec.key);
+    if (i >= 0) drop(r, i);
+    if (r->count == REGISTRY_MAX_RECORDS) drop(r, 0);   // la más antigua
+    r->records[r->count++] = rec;
+
+    int ret = save(r);
+    pthread_mutex_unlock(&registry_lock);
+
+    free(r);
+    return ret;
+}
+
+void registry_forget(const char *path) {
+    if (!cache_dir()) return;
+
+    char key[sizeof(((device_record *)0)->key)], identity[sizeof(((device_record *)0)->identity)];
+    port_key(path, key, sizeof(key), identity, sizeof(identity));
+
+    registry *r = malloc(sizeof(registry));
+    if (!r) return;
+
+    pthread_mutex_lock(&registry_lock);
+    load(r);
+    int i = find(r, key);
+    if (i >= 0) {
+        drop(r, i);
+        save(r);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    free(r);
+}
+
+void registry_clear(void) {
+    if (!cache_dir()) return;
+
+    char path[1100];
+    registry_path(path, sizeof(path));
+
+    pthread_mutex_lock(&registry_lock);
+    remove(path);
+    pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,87 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+
+// Pasado este tiempo (segundos) una placa conocida se vuelve a sondear
+#define REGISTRY_MAX_AGE        (7 * 24 * 3600)
+
+/*
+ * Registro en disco de las placas ya identificadas (<cache>/devices).
+ *
+ * Cada placa se identifica por el número de serie USB del adaptador o, si no
+ * tiene, por la ruta del puerto junto con VID/PID. Se guarda el chip, la
+ * velocidad que funcionó y la estrategia de reset, así la próxima vez se va
+ * directo a conectar sin sondear todos los puertos ni negociar la velocidad.
+ *
+ * Una entrada deja de valer si en esa ruta aparece otro adaptador, si
+ * supera REGISTRY_MAX_AGE o si la conexión con sus datos falla.
+ */
+typedef struct {
+    char        key[192];       // "usb:<vid>:<pid>:<serie>" o "path:<ruta>"
+    char        identity[160];  // VID/PID y serie del adaptador ("" sin sysfs)
+    char        path[256];      // ruta del puerto la última vez
+    char        chip[32];       // ej. "ESP32"
+    int         baud;           // velocidad que funcionó (0 si no se negoció)
+    char        reset[16];      // estrategia de reset que funcionó (ver reset_format())
+    long long   updated;        // hora de la última conexión correcta
+} device_record;
+
+/**
+ * @brief Busca la placa conectada en path.
+ *
+ * @return 0 si está registrada y la entrada sigue valiendo (record recibe los
+ *         datos), 1 si no. Las entradas que ya no valen se borran.
+ */
+int registry_lookup(const char *path, device_record *record);
+
+/**
+ * @brief Guarda (o reemplaza) la entrada de la placa conectada en path.
+ *
+ * Completa key, identity, path y updated; el resto se toma de record.
+ *
+ * @return 0 si se guardó.
+ */
+int registry_store(const char *path, const device_record *record);
+
+/**
+ * @brief Olvida la placa conectada en path (p. ej. tras fallar la conexión).
+ */
+void registry_forget(const char *path);
+
+/**
+ * @brief Olvida todas las placas; la próxima búsqueda sondea todos los puertos.
+ */
+void registry_clear(void);
+
+#endif // REGISTRY_H
@@ -0,0 +1,221 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <string.h>
+
+#include "release_json.h"
+
+void release_parser_init(release_parser *p, release_info *info) {
+    memset(p, 0, sizeof(*p));
+    p->info = info;
+    info->tag[0] = '\0';
+    info->asset_count = 0;
+}
+
+// Agrega un byte al string que se está capturando (se trunca si no entra)
+static void capture_byte(release_parser *p, char c) {
+    if (p->string_is_key) {
+        if (p->key_len + 1 < sizeof(p->key)) p->key[p->key_len++] = c;
+    } else if (p->capture && p->capture_len + 1 < p->capture_size) {
+        p->capture[p->capture_len++] = c;
+    }
+}
+
+// Agrega un code point como UTF-8
+static void capture_codepoint(release_parser *p, unsigned int cp) {
+    if (cp < 0x80) {
+        capture_byte(p, (char)cp);
+    } else if (cp < 0x800) {
+        capture_byte(p, (char)(0xc0 | (cp >> 6)));
+        capture_byte(p, (char)(0x80 | (cp & 0x3f)));
+    } else {
+        capture_byte(p, (char)(0xe0 | (cp >> 12)));
+        capture_byte(p, (char)(0x80 | ((cp >> 6) & 0x3f)));
+        capture_byte(p, (char)(0x80 | (cp & 0x3f)));
+    }
+}
+
+static int key_is(const release_parser *p, const char *name) {
+    return strlen(name) == p->key_len && memcmp(p->key, name, p->key_len) == 0;
+}
+
+// Decide dónde guardar un string que empieza como valor
+static void begin_value_string(release_parser *p) {
+    p->capture = NULL;
+    if (p->depth == 0 || p->stack[p->depth - 1] != '{') return;
+
+    if (p->depth == 1 && key_is(p, "tag_name")) {
+        p->capture = p->info->tag;
+        p->capture_size = sizeof(p->info->tag);
+    } else if (p->in_assets && p->depth == 3 && key_is(p, "name")) {
+        p->capture = p->asset.name;
+        p->capture_size = sizeof(p->asset.name);
+    } else if (p->in_assets && p->depth == 3 && key_is(p, "browser_download_url")) {
+        p->capture = p->asset.url;
+        p->capture_size = sizeof(p->asset.url);
+    } else if (p->in_assets && p->depth == 3 && key_is(p, "digest")) {
+        p->capture = p->asset.digest;
+        p->capture_size = sizeof(p->asset.digest);
+    }
+    p->capture_len = 0;
+}
+
+static void end_string(release_parser *p) {
+    p->in_string = 0;
+    if (p->string_is_key) {
+        p->key[p->key_len] = '\0';
+        p->expect_key = 0;
+    } else if (p->capture) {
+        p->capture[p->capture_len] = '\0';
+        p->capture = NULL;
+    }
+}
+
+// Procesa un byte dentro de un string
+static int string_byte(release_parser *p, char c) {
+    if (p->unicode_left) {
+        int v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else return -1;
+
+        p->unicode = (p->unicode << 4) | (unsigned int)v;
+        if (--p->unicode_left == 0) capture_codepoint(p, p->unicode);
+        return 0;
+    }
+
+    if (p->escape) {
+        p->escape = 0;
+        switch (c) {
+            case '"':  capture_byte(p, '"');  break;
+            case '\\': capture_byte(p, '\\'); break;
+            case '/':  capture_byte(p, '/');  break;
+            case 'b':  capture_byte(p, '\b'); break;
+            case 'f':  capture_byte(p, '\f'); break;
+            case 'n':  capture_byte(p, '\n'); break;
+            case 'r':  capture_byte(p, '\r'); break;
+            case 't':  capture_byte(p, '\t'); break;
+            case 'u':
+                p->unicode = 0;
+                p->unicode_left = 4;
+                break;
+            default:
+                return -1;
+        }
+        return 0;
+    }
+
+    if (c == '\\') {
+        p->escape = 1;
+    } else if (c == '"') {
+        end_string(p);
+    } else {
+        capture_byte(p, c);
+    }
+    return 0;
+}
+
+// Procesa un byte fuera de los strings
+static int structure_byte(release_parser *p, char c) {
+    switch (c) {
+        case '{':
+        case '[':
+            if (p->depth == RELEASE_PARSER_MAX_DEPTH) return -1;
+
+            if (c == '[' && p->depth == 1 && p->stack[0] == '{' && key_is(p, "assets")) {
+                p->in_assets = 1;
+            } else if (c == '{' && p->in_assets && p->depth == 2) {
+                memset(&p->asset, 0, sizeof(p->asset));
+            }
+
+            p->stack[p->depth++] = c;
+            p->expect_key = (c == '{');
+            p->key_len = 0;
+            break;
+
+        case '}':
+        case ']':
+            if (p->depth == 0 || p->stack[p->depth - 1] != (c == '}' ? '{' : '[')) return -1;
+
+            if (c == '}' && p->in_assets && p->depth == 3) {
+                // Solo se guardan los assets que tienen nombre y URL
+                if (p->asset.name[0] && p->asset.url[0] && p->info->asset_count < RELEASE_MAX_ASSETS) {
+                    p->info->assets[p->info->asset_count++] = p->asset;
+                }
+            } else if (c == ']' && p->in_assets && p->depth == 2) {
+                p->in_assets = 0;
+            }
+
+            p->depth--;
+            p->expect_key = 0;
+            break;
+
+        case ',':
+            if (p->depth > 0 && p->stack[p->depth - 1] == '{') {
+                p->expect_key = 1;
+                p->key_len = 0;
+            }
+            break;
+
+        case '"':
+            p->in_string = 1;
+            p->string_is_key = (p->depth > 0 && p->stack[p->depth - 1] == '{' && p->expect_key);
+            if (p->string_is_key) {
+                p->key_len = 0;
+            } else {
+                begin_value_string(p);
+            }
+            break;
+
+        default:
+            // ':' , espacios, números y literales no cambian el estado que interesa
+            break;
+    }
+    return 0;
+}
+
+int release_parser_feed(release_parser *p, const char *data, size_t len) {
+    if (p->error) return -1;
+
+    for (size_t i = 0; i < len; i++) {
+        int ret = p->in_string ? string_byte(p, data[i]) : structure_byte(p, data[i]);
+        if (ret != 0) {
+            p->error = 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int release_parser_finish(release_parser *p) {
+    if (p->error || p->in_string || p->depth != 0 || !p->info->tag[0]) return -1;
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef RELEASE_JSON_H
+#define RELEASE_JSON_H
+
+#include <stddef.h>
+
+// Metadatos de la última release de un repositorio
+#define RELEASE_MAX_ASSETS      64
+
+typedef struct {
+    char    name[128];
+    char    url[512];
+    char    digest[80];     // "sha256:<hex>" si la API lo publica (o vacío)
+} release_asset;
+
+typedef struct {
+    char            tag[128];
+    int             asset_count;
+    release_asset   assets[RELEASE_MAX_ASSETS];
+} release_info;
+
+#define RELEASE_PARSER_MAX_DEPTH    32
+
+/*
+ * Parser incremental de la respuesta de /releases/latest.
+ *
+ * Recorre el JSON byte a byte, sin construir el árbol, y extrae solo
+ * "tag_name" y el "name" / "browser_download_url" / "digest" de cada
+ * elemento de "assets". Se le puede entregar la respuesta en bloques de cualquier tamaño.
+ */
+typedef struct {
+    release_info   *info;
+    char            stack[RELEASE_PARSER_MAX_DEPTH];    // '{' o '[' por nivel
+    int             depth;
+    int             expect_key;     // dentro de un objeto, el próximo string es una clave
+    int             in_string;
+    int             string_is_key;
+    int             escape;         // se leyó '\'
+    int             unicode_left;   // dígitos hex pendientes de un \uXXXX
+    unsigned int    unicode;
+    char            key[32];        // última clave leída (truncada)
+    size_t          key_len;
+    char           *capture;        // destino del string actual (NULL si no interesa)
+    size_t          capture_size;
+    size_t          capture_len;
+    int             in_assets;      // dentro del array "assets"
+    release_asset   asset;          // asset en construcción
+    int             error;
+} release_parser;
+
+void release_parser_init(release_parser *p, release_info *info);
+
+/**
+ * @brief Consume un bloque de la respuesta.
+ *
+ * @return 0 si todo va bien, -1 si el JSON es inválido.
+ */
+int release_parser_feed(release_parser *p, const char *data, size_t len);
+
+/**
+ * @brief Cierra el parseo.
+ *
+ * @return 0 si el JSON estaba completo y tenía tag_name, -1 en caso contrario.
+ */
+int release_parser_finish(release_parser *p);
+
+#endif // RELEASE_JSON_H
@@ -0,0 +1,249 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+#endif
+
+#include "reset.h"
+
+static const char *kind_names[] = { "classic", "tight", "usb-jtag" };
+
+#define RESET_KINDS     (int)(sizeof(kind_names) / sizeof(kind_names[0]))
+
+// Esperas de cada nivel, de la más corta a la segura (la de esptool)
+static const struct {
+    int hold_ms;
+    int boot_ms;
+} levels[] = {
+    { 10, 5 },
+    { 50, 20 },
+    { 100, 50 },
+};
+
+#define RESET_LEVELS    (int)(sizeof(levels) / sizeof(levels[0]))
+
+// Perfil de cada tipo de adaptador: secuencias a probar, la más probable primero
+static const struct {
+    adapter_type    adapter;
+    int             count;
+    reset_kind      kinds[2];
+} profiles[] = {
+    { ADAPTER_USB_JTAG, 2, { RESET_USB_JTAG, RESET_CLASSIC } },
+    { ADAPTER_CP210X,   2, { RESET_CLASSIC, RESET_TIGHT } },
+    { ADAPTER_CH34X,    2, { RESET_TIGHT, RESET_CLASSIC } },    // con ioctl separados el CH340 deja glitches en EN
+    { ADAPTER_FTDI,     2, { RESET_CLASSIC, RESET_TIGHT } },
+    { ADAPTER_UNKNOWN,  2, { RESET_CLASSIC, RESET_TIGHT } },
+};
+
+#define RESET_PROFILES  (int)(sizeof(profiles) / sizeof(profiles[0]))
+
+// Lo aprendido en este proceso, por tipo de adaptador
+static pthread_mutex_t learned_lock = PTHREAD_MUTEX_INITIALIZER;
+static reset_strategy learned[ADAPTER_FOREIGN + 1];
+static int learned_valid[ADAPTER_FOREIGN + 1];
+
+static void sleep_ms(int ms) {
+    if (ms <= 0) return;
+#if defined(_WIN32) || defined(_WIN64)
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+static void set_dtr(FD fd, int on) {
+#if defined(_WIN32) || defined(_WIN64)
+    EscapeCommFunction(fd, on ? SETDTR : CLRDTR);
+#else
+    int flag = TIOCM_DTR;
+    ioctl(fd, on ? TIOCMBIS : TIOCMBIC, &flag);
+#endif
+}
+
+static void set_rts(FD fd, int on) {
+#if defined(_WIN32) || defined(_WIN64)
+    EscapeCommFunction(fd, on ? SETRTS : CLRRTS);
+#else
+    int flag = TIOCM_RTS;
+    ioctl(fd, on ? TIOCMBIS : TIOCMBIC, &flag);
+#endif
+}
+
+// Cambia las dos líneas en una sola operación (en Windows no se puede: DTR y después RTS)
+static void set_lines(FD fd, int dtr, int rts) {
+#if defined(_WIN32) || defined(_WIN64)
+    set_dtr(fd, dtr);
+    set_rts(fd, rts);
+#else
+    int status = 0;
+    ioctl(fd, TIOCMGET, &status);
+    status = dtr ? status | TIOCM_DTR : status & ~TIOCM_DTR;
+    status = rts ? status | TIOCM_RTS : status & ~TIOCM_RTS;
+    ioctl(fd, TIOCMSET, &status);
+#endif
+}
+
+// Con el circuito habitual, RTS activo baja EN y DTR activo baja IO0
+void reset_apply(FD fd, const reset_strategy *s) {
+    switch (s->kind) {
+    case RESET_TIGHT:
+        set_lines(fd, 0, 0);
+        set_lines(fd, 1, 1);
+        set_lines(fd, 0, 1);            // IO0 alto, EN bajo: chip en reset
+        sleep_ms(s->hold_ms);
+        set_lines(fd, 1, 0);            // IO0 bajo, EN alto: arranca en modo descarga
+        sleep_ms(s->boot_ms);
+        set_lines(fd, 0, 0);
+        set_dtr(fd, 0);                 // algunos drivers no propagan DTR en el TIOCMSET anterior
+        break;
+
+    case RESET_USB_JTAG:
+        set_rts(fd, 0);
+        set_dtr(fd, 0);
+        sleep_ms(s->boot_ms);
+        set_dtr(fd, 1);                 // IO0 bajo
+        set_rts(fd, 0);
+        sleep_ms(s->boot_ms);
+        set_rts(fd, 1);                 // reset, pasando por (1,1) en lugar de (0,0)
+        set_dtr(fd, 0);
+        set_rts(fd, 1);                 // Windows solo propaga DTR al escribir RTS
+        sleep_ms(s->hold_ms);
+        set_dtr(fd, 0);
+        set_rts(fd, 0);                 // fuera de reset
+        break;
+
+    default:
+        set_dtr(fd, 0);                 // IO0 alto
+        set_rts(fd, 1);                 // EN bajo: chip en reset
+        sleep_ms(s->hold_ms);
+        set_dtr(fd, 1);                 // IO0 bajo
+        set_rts(fd, 0);                 // EN alto: arranca en modo descarga
+        sleep_ms(s->boot_ms);
+        set_dtr(fd, 0);                 // IO0 alto
+        break;
+    }
+}
+
+adapter_type reset_adapter_type(const char *path) {
+    serial_port_info info;
+    if (find_serial_port(path, &info) == 0) return info.type;
+
+    // Sin sysfs: los ttyACM suelen ser el USB-JTAG-serial nativo
+    const char *name = strrchr(path, '/');
+    return strncmp(name ? name + 1 : path, "ttyACM", 6) == 0 ? ADAPTER_USB_JTAG : ADAPTER_UNKNOWN;
+}
+
+static int same_strategy(const reset_strategy *a, const reset_strategy *b) {
+    return a->kind == b->kind && a->hold_ms == b->hold_ms && a->boot_ms == b->boot_ms;
+}
+
+static void plan_add(reset_plan *plan, reset_kind kind, int hold_ms, int boot_ms) {
+    reset_strategy s = { kind, hold_ms, boot_ms };
+    for (int i = 0; i < plan->count; i++) {
+        if (same_strategy(&plan->steps[i], &s)) return;
+    }
+    if (plan->count < RESET_PLAN_MAX) plan->steps[plan->count++] = s;
+}
+
+void reset_plan_init(reset_plan *plan, adapter_type adapter, int probe) {
+    memset(plan, 0, sizeof(*plan));
+    plan->adapter = adapter;
+
+    int p = 0;
+    while (p < RESET_PROFILES - 1 && profiles[p].adapter != adapter) p++;   // el último es el genérico
+
+    pthread_mutex_lock(&learned_lock);
+    if (adapter >= 0 && adapter <= ADAPTER_FOREIGN && learned_valid[adapter]) {
+        plan_add(plan, learned[adapter].kind, learned[adapter].hold_ms, learned[adapter].boot_ms);
+    }
+    pthread_mutex_unlock(&learned_lock);
+
+    if (probe) {
+        plan_add(plan, profiles[p].kinds[0], levels[RESET_LEVELS - 1].hold_ms, levels[RESET_LEVELS - 1].boot_ms);
+        return;
+    }
+
+    for (int level = 0; level < RESET_LEVELS; level++) {
+        for (int k = 0; k < profiles[p].count; k++) {
+            plan_add(plan, profiles[p].kinds[k], levels[level].hold_ms, levels[level].boot_ms);
+        }
+    }
+}
+
+void reset_plan_prefer(reset_plan *plan, const reset_strategy *s) {
+    int i = 0;
+    while (i < plan->count && !same_strategy(&plan->steps[i], s)) i++;
+    if (i == plan->count && plan->count == RESET_PLAN_MAX) i--;         // se descarta el último
+    if (i == plan->count) plan->count++;
+
+    memmove(&plan->steps[1], &plan->steps[0], (size_t)i * sizeof(reset_strategy));
+    plan->steps[0] = *s;
+}
+
+void reset_learn(adapter_type adapter, const reset_strategy *s) {
+    if (adapter < 0 || adapter > ADAPTER_FOREIGN) return;
+
+    pthread_mutex_lock(&learned_lock);
+    if (!learned_valid[adapter] || s->hold_ms + s->boot_ms < learned[adapter].hold_ms + learned[adapter].boot_ms) {
+        learned[adapter] = *s;
+        learned_valid[adapter] = 1;
+    }
+    pthread_mutex_unlock(&learned_lock);
+}
+
+void reset_format(const reset_strategy *s, char *buf, size_t size) {
+    snprintf(buf, size, "%s:%d:%d", kind_names[s->kind], s->hold_ms, s->boot_ms);
+}
+
+int reset_parse(const char *text, reset_strategy *s) {
+    char name[16];
+    int hold_ms, boot_ms;
+    if (sscanf(text, "%15[^:]:%d:%d", name, &hold_ms, &boot_ms) != 3) return 1;
+    if (hold_ms < 0 || hold_ms > 1000 || boot_ms < 0 || boot_ms > 1000) return 1;
+
+    for (int i = 0; i < RESET_KINDS; i++) {
+        if (strcmp(name, kind_names[i]) == 0) {
+            s->kind = (reset_kind)i;
+            s->hold_ms = hold_ms;
+            s->boot_ms = boot_ms;
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef RESET_H
+#define RESET_H
+
+#include <stddef.h>
+
+#include "esp32_detect.h"
+#include "serial_enum.h"
+
+// Secuencias de DTR/RTS para entrar al modo descarga
+typedef enum {
+    RESET_CLASSIC = 0,          // DTR y RTS por separado (circuito de auto-reset de dos transistores)
+    RESET_TIGHT,                // DTR y RTS a la vez con TIOCMSET, sin estados intermedios (CH340)
+    RESET_USB_JTAG,             // USB-JTAG-serial nativo: pasa por (1,1) en lugar de (0,0)
+} reset_kind;
+
+typedef struct {
+    reset_kind  kind;
+    int         hold_ms;        // EN en bajo (chip en reset)
+    int         boot_ms;        // IO0 en bajo tras soltar EN, hasta que el ROM lo lee
+} reset_strategy;
+
+// Intentos de un plan: niveles de espera por estrategia del perfil
+#define RESET_PLAN_MAX          8
+
+/*
+ * Orden en que se prueban las estrategias de reset en un puerto.
+ *
+ * Cada tipo de adaptador tiene un perfil con sus secuencias, de la más
+ * probable a la menos. El plan recorre primero las esperas más cortas de
+ * todas ellas y después las más largas. Lo que ya funcionó (en este proceso
+ * con el mismo tipo de adaptador, o lo registrado para la placa) va primero.
+ */
+typedef struct {
+    adapter_type    adapter;
+    int             count;
+    reset_strategy  steps[RESET_PLAN_MAX];
+} reset_plan;
+
+/**
+ * @brief Tipo del adaptador conectado en path, según sysfs.
+ *
+ * Sin sysfs, un ttyACM se toma como USB-JTAG-serial y el resto como desconocido.
+ */
+adapter_type reset_adapter_type(const char *path);
+
+/**
+ * @brief Arma el plan para un tipo de adaptador.
+ *
+ * @param probe 1 para un sondeo: solo lo aprendido (si hay) y la estrategia
+ *              principal con las esperas seguras, para no demorar los puertos
+ *              que no son un ESP32.
+ */
+void reset_plan_init(reset_plan *plan, adapter_type adapter, int probe);
+
+/**
+ * @brief Pone s al principio del plan (sin repetirla).
+ */
+void reset_plan_prefer(reset_plan *plan, const reset_strategy *s);
+
+/**
+ * @brief Recuerda que s funcionó con este tipo de adaptador, para los planes
+ * siguientes del proceso. Se queda con las esperas más cortas.
+ */
+void reset_learn(adapter_type adapter, const reset_strategy *s);
+
+/**
+ * @brief Aplica la secuencia al puerto (bloquea hold_ms + boot_ms).
+ */
+void reset_apply(FD fd, const reset_strategy *s);
+
+/**
+ * @brief Texto para el registro, ej. "tight:10:5".
+ */
+void reset_format(const reset_strategy *s, char *buf, size_t size);
+
+/**
+ * @return 0 si text es una estrategia válida (ver reset_format()).
+ */
+int reset_parse(const char *text, reset_strategy *s);
+
+#endif // RESET_H
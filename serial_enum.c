@@ -0,0 +1,273 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "serial_enum.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+
+// Tabla de VID/PID conocidos; pid 0 coincide con cualquier producto del fabricante
+static const struct {
+    unsigned int    vid;
+    unsigned int    pid;
+    adapter_type    type;
+} known_ids[] = {
+    { 0x303a, 0x1001, ADAPTER_USB_JTAG },   // Espressif USB-JTAG-serial
+    { 0x303a, 0x0000, ADAPTER_USB_JTAG },   // Espressif (TinyUSB CDC)
+    { 0x10c4, 0xea60, ADAPTER_CP210X },     // CP2102/CP2104
+    { 0x10c4, 0xea70, ADAPTER_CP210X },     // CP2105
+    { 0x10c4, 0xea71, ADAPTER_CP210X },     // CP2108
+    { 0x1a86, 0x7523, ADAPTER_CH34X },      // CH340
+    { 0x1a86, 0x5523, ADAPTER_CH34X },      // CH341
+    { 0x1a86, 0x7522, ADAPTER_CH34X },      // CH340K
+    { 0x1a86, 0x55d4, ADAPTER_CH34X },      // CH9102
+    { 0x1a86, 0x55d3, ADAPTER_CH34X },      // CH343
+    { 0x0403, 0x6001, ADAPTER_FTDI },       // FT232R
+    { 0x0403, 0x6010, ADAPTER_FTDI },       // FT2232
+    { 0x0403, 0x6011, ADAPTER_FTDI },       // FT4232
+    { 0x0403, 0x6014, ADAPTER_FTDI },       // FT232H
+    { 0x0403, 0x6015, ADAPTER_FTDI },       // FT231X
+    { 0x1546, 0x0000, ADAPTER_FOREIGN },    // u-blox (GPS)
+    { 0x2341, 0x0000, ADAPTER_FOREIGN },    // Arduino
+    { 0x2e8a, 0x0000, ADAPTER_FOREIGN },    // Raspberry Pi (RP2040)
+    { 0x0483, 0x0000, ADAPTER_FOREIGN },    // STMicroelectronics
+    { 0x1199, 0x0000, ADAPTER_FOREIGN },    // Sierra Wireless
+    { 0x2c7c, 0x0000, ADAPTER_FOREIGN },    // Quectel
+    { 0x12d1, 0x0000, ADAPTER_FOREIGN },    // Huawei
+};
+
+// Drivers que identifican al adaptador cuando el VID/PID no está en la tabla
+static const struct {
+    const char     *prefix;
+    adapter_type    type;
+} known_drivers[] = {
+    { "cp210x",     ADAPTER_CP210X },
+    { "ch341",      ADAPTER_CH34X },
+    { "ch343",      ADAPTER_CH34X },
+    { "ftdi_sio",   ADAPTER_FTDI },
+    { "option",     ADAPTER_FOREIGN },      // módems 3G/4G
+    { "qcserial",   ADAPTER_FOREIGN },
+    { "qcaux",      ADAPTER_FOREIGN },
+    { "sierra",     ADAPTER_FOREIGN },
+};
+
+// Prioridad de sondeo por tipo de adaptador
+static int adapter_rank(adapter_type type) {
+    switch (type) {
+        case ADAPTER_USB_JTAG:  return 0;
+        case ADAPTER_CP210X:
+        case ADAPTER_CH34X:     return 1;
+        case ADAPTER_FTDI:      return 2;
+        case ADAPTER_UNKNOWN:   return 3;
+        default:                return -1;
+    }
+}
+
+// Lee la primera línea de un archivo de sysfs
+static int read_attr(const char *dir, const char *attr, char *value, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    if (!fgets(value, (int)size, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    value[strcspn(value, "\r\n")] = '\0';
+    return 0;
+}
+
+// Obtiene el nombre del driver enlazado a un dispositivo de sysfs
+static int read_driver(const char *dir, char *driver, size_t size) {
+    char path[PATH_MAX], target[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/driver", dir);
+
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) return -1;
+    target[len] = '\0';
+
+    const char *base = strrchr(target, '/');
+    snprintf(driver, size, "%s", base ? base + 1 : target);
+    return 0;
+}
+
+static void classify(serial_port_info *info) {
+    info->type = ADAPTER_UNKNOWN;
+
+    for (size_t i = 0; i < sizeof(known_ids) / sizeof(known_ids[0]); i++) {
+        if (known_ids[i].vid == info->vid && (known_ids[i].pid == 0 || known_ids[i].pid == info->pid)) {
+            info->type = known_ids[i].type;
+            break;
+        }
+    }
+
+    if (info->type == ADAPTER_UNKNOWN && info->driver[0]) {
+        for (size_t i = 0; i < sizeof(known_drivers) / sizeof(known_drivers[0]); i++) {
+            if (strncmp(info->driver, known_drivers[i].prefix, strlen(known_drivers[i].prefix)) == 0) {
+                info->type = known_drivers[i].type;
+                break;
+            }
+        }
+    }
+
+    info->rank = adapter_rank(info->type);
+}
+
+// Completa la información USB de un tty a partir de su nodo en sysfs
+static void describe_port(const char *root, serial_port_info *info) {
+    char dir[PATH_MAX], link[PATH_MAX];
+
+    snprintf(link, sizeof(link), "%s/class/tty/%s/device", root, info->name);
+    if (!realpath(link, dir)) {
+        classify(info);
+        return;
+    }
+
+    read_driver(dir, info->driver, sizeof(info->driver));
+
+    // Subir por la jerarquía hasta el dispositivo USB (el que tiene idVendor).
+    // ttyUSB: <usb>/<interfaz>/ttyUSBn, ttyACM: <usb>/<interfaz>
+    for (int level = 0; level < 4; level++) {
+        char value[32];
+        if (read_attr(dir, "idVendor", value, sizeof(value)) == 0) {
+            info->vid = (unsigned int)strtoul(value, NULL, 16);
+            if (read_attr(dir, "idProduct", value, sizeof(value)) == 0) {
+                info->pid = (unsigned int)strtoul(value, NULL, 16);
+            }
+            read_attr(dir, "serial", info->serial, sizeof(info->serial));
+            break;
+        }
+
+        if (!info->driver[0]) read_driver(dir, info->driver, sizeof(info->driver));
+
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) break;
+        *slash = '\0';
+    }
+
+    classify(info);
+}
+
+static int compare_ports(const void *a, const void *b) {
+    const serial_port_info *pa = (const serial_port_info *)a;
+    const serial_port_info *pb = (const serial_port_info *)b;
+
+    // Descartados al final
+    int ra = pa->rank < 0 ? 1000 : pa->rank;
+    int rb = pb->rank < 0 ? 1000 : pb->rank;
+    if (ra != rb) return ra - rb;
+    return strcmp(pa->name, pb->name);
+}
+
+// Enumera los ttyUSB*/ttyACM* de sysfs y los clasifica
+int enumerate_serial_ports(const char *sysfs_root, serial_port_info **ports) {
+    *ports = NULL;
+
+    if (!sysfs_root) sysfs_root = getenv("ESPECCY_SYSFS_ROOT");
+    if (!sysfs_root || !*sysfs_root) sysfs_root = SYSFS_ROOT_DEFAULT;
+
+    char class_dir[PATH_MAX];
+    snprintf(class_dir, sizeof(class_dir), "%s/class/tty", sysfs_root);
+
+    DIR *dir = opendir(class_dir);
+    if (!dir) return -1;
+
+    serial_port_info *list = NULL;
+    int count = 0, capacity = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "ttyUSB", 6) != 0 && strncmp(entry->d_name, "ttyACM", 6) != 0) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            serial_port_info *grown = realloc(list, capacity * sizeof(serial_port_info));
+            if (!grown) break;
+            list = grown;
+        }
+
+        serial_port_info *info = &list[count++];
+        memset(info, 0, sizeof(*info));
+        snprintf(info->name, sizeof(info->name), "%.63s", entry->d_name);
+        snprintf(info->path, sizeof(info->path), "/dev/%s", info->name);
+
+        describe_port(sysfs_root, info);
+    }
+    closedir(dir);
+
+    if (count > 1) qsort(list, count, sizeof(serial_port_info), compare_ports);
+
+    *ports = list;
+    return count;
+}
+#else
+int enumerate_serial_ports(const char *sysfs_root, serial_port_info **ports) {
+    (void)sysfs_root;
+    *ports = NULL;
+    return -1;
+}
+#endif
+
+int find_serial_port(const char *path, serial_port_info *info) {
+    serial_port_info *ports;
+    int count = enumerate_serial_ports(NULL, &ports);
+    int ret = -1;
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(ports[i].path, path) == 0) {
+            *info = ports[i];
+            ret = 0;
+            break;
+        }
+    }
+    if (count >= 0) free(ports);
+    return ret;
+}
+
+const char *adapter_type_name(adapter_type type) {
+    switch (type) {
+        case ADAPTER_USB_JTAG:  return "USB-JTAG-serial";
+        case ADAPTER_CP210X:    return "CP210x";
+        case ADAPTER_CH34X:     return "CH34x";
+        case ADAPTER_FTDI:      return "FTDI";
+        case ADAPTER_FOREIGN:   return "foreign";
+        default:                return "unknown";
+    }
+}
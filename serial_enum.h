@@ -0,0 +1,83 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef SERIAL_ENUM_H
+#define SERIAL_ENUM_H
+
+// Raíz de sysfs por defecto; se puede cambiar con la variable ESPECCY_SYSFS_ROOT
+#define SYSFS_ROOT_DEFAULT      "/sys"
+
+// Tipos de adaptador USB-serie conocidos
+typedef enum {
+    ADAPTER_UNKNOWN = 0,
+    ADAPTER_USB_JTAG,           // USB-JTAG-serial nativo de Espressif (ESP32-S3/C3/C6...)
+    ADAPTER_CP210X,             // Silicon Labs CP210x
+    ADAPTER_CH34X,              // WCH CH340/CH341/CH9102
+    ADAPTER_FTDI,               // FTDI FT232/FT2232/FT231X
+    ADAPTER_FOREIGN             // Módems, GPS y otros MCUs que no se deben resetear
+} adapter_type;
+
+// Información de un puerto serie obtenida de sysfs
+typedef struct {
+    char            name[64];       // ej. "ttyUSB0"
+    char            path[256];      // ej. "/dev/ttyUSB0"
+    unsigned int    vid;
+    unsigned int    pid;
+    char            serial[128];    // número de serie USB (vacío si no hay)
+    char            driver[64];     // ej. "cp210x", "ch341-uart", "ftdi_sio", "cdc_acm"
+    adapter_type    type;
+    int             rank;           // 0 es el candidato más probable; -1 descartado
+} serial_port_info;
+
+/**
+ * @brief Enumera los ttyUSB* y ttyACM* a través de sysfs y los clasifica.
+ *
+ * Lee VID/PID, número de serie y driver de /sys/class/tty/<tty>/device sin
+ * abrir el puerto. La lista se devuelve ordenada por rank y luego por nombre.
+ *
+ * @param sysfs_root Raíz de sysfs, o NULL para usar ESPECCY_SYSFS_ROOT o "/sys".
+ * @param ports Recibe la lista de puertos (liberar con free()).
+ * @return Cantidad de puertos encontrados, o -1 si sysfs no está disponible.
+ */
+int enumerate_serial_ports(const char *sysfs_root, serial_port_info **ports);
+
+/**
+ * @brief Busca en sysfs el puerto con esa ruta de /dev.
+ *
+ * @return 0 si se encontró (info recibe sus datos), -1 si no.
+ */
+int find_serial_port(const char *path, serial_port_info *info);
+
+/**
+ * @brief Devuelve un nombre legible para el tipo de adaptador.
+ */
+const char *adapter_type_name(adapter_type type);
+
+#endif // SERIAL_ENUM_H
@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "tasks.h"
+
+typedef struct {
+    task            *t;
+    volatile int    *cancel;
+} task_runner;
+
+static void *task_thread(void *arg) {
+    task_runner *runner = (task_runner *)arg;
+
+    runner->t->result = runner->t->fn(runner->t->arg, runner->cancel);
+
+    // La primera tarea que falla cancela a las demás
+    if (runner->t->result != 0 && !*runner->cancel) {
+        *runner->cancel = 1;
+        __sync_synchronize();
+    }
+    return NULL;
+}
+
+// Ejecuta las tareas en paralelo y espera a todas
+int run_tasks(task *tasks, int count) {
+    volatile int cancel = 0;
+    pthread_t *threads = calloc(count, sizeof(pthread_t));
+    task_runner *runners = calloc(count, sizeof(task_runner));
+    int *started = calloc(count, sizeof(int));
+
+    if (!threads || !runners || !started) {
+        free(threads);
+        free(runners);
+        free(started);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        runners[i].t = &tasks[i];
+        runners[i].cancel = &cancel;
+        if (pthread_create(&threads[i], NULL, task_thread, &runners[i]) == 0) {
+            started[i] = 1;
+        } else {
+            // Sin hilo disponible se ejecuta en el hilo actual
+            task_thread(&runners[i]);
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        if (tasks[i].result != 0) failed = 1;
+    }
+
+    free(threads);
+    free(runners);
+    free(started);
+
+    return failed;
+}
@@ -0,0 +1,60 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef TASKS_H
+#define TASKS_H
+
+/**
+ * @brief Función de una tarea del pipeline.
+ *
+ * @param arg Argumento propio de la tarea.
+ * @param cancel Bandera compartida; la tarea debe abandonar cuanto antes si pasa a 1.
+ * @return 0 si la tarea terminó bien, distinto de 0 si falló.
+ */
+typedef int (*task_fn)(void *arg, const volatile int *cancel);
+
+typedef struct {
+    const char *name;
+    task_fn     fn;
+    void       *arg;
+    int         result;     // resultado de fn (se completa al terminar)
+} task;
+
+/**
+ * @brief Ejecuta todas las tareas a la vez y espera a que terminen.
+ *
+ * Si alguna tarea falla se activa la bandera de cancelación para que las
+ * demás abandonen su trabajo.
+ *
+ * @return 0 si todas las tareas terminaron bien, 1 en caso contrario.
+ */
+int run_tasks(task *tasks, int count);
+
+#endif // TASKS_H
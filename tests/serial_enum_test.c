@@ -0,0 +1,219 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+/*
+ * Comprobación de la clasificación de adaptadores de serial_enum.c.
+ *
+ * Arma en un directorio temporal un árbol con la forma de /sys (class/tty,
+ * dispositivos USB con idVendor/idProduct/serial e interfaces con el enlace
+ * al driver) y lo enumera con enumerate_serial_ports(). Verifica el tipo, el
+ * rank y el orden de sondeo de un USB-JTAG-serial, un CP210x, dos CH34x (uno
+ * reconocido sólo por el driver), un FTDI, un adaptador desconocido y un GPS
+ * que se debe descartar. Los nombres no siguen el orden esperado a propósito,
+ * para que el resultado dependa del rank y no de readdir().
+ *
+ * Uso: serial_enum_test [-keep]
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../serial_enum.h"
+
+// Un puerto del árbol falso y lo que se espera de él
+typedef struct {
+    const char     *name;
+    unsigned int    vid;
+    unsigned int    pid;
+    const char     *serial;
+    const char     *driver;
+    adapter_type    type;
+    int             rank;
+} fake_port;
+
+// En el orden en que se deben sondear
+static const fake_port expected[] = {
+    { "ttyACM0", 0x303a, 0x1001, "F4:12:FA:00:11:22", "cdc_acm",    ADAPTER_USB_JTAG, 0 },
+    { "ttyUSB1", 0x1a86, 0x7523, "",                  "ch341-uart", ADAPTER_CH34X,    1 },
+    { "ttyUSB3", 0x10c4, 0xea60, "0001",              "cp210x",     ADAPTER_CP210X,   1 },
+    { "ttyUSB4", 0x1a86, 0x55aa, "",                  "ch341-uart", ADAPTER_CH34X,    1 },
+    { "ttyUSB0", 0x0403, 0x6001, "A50285BI",          "ftdi_sio",   ADAPTER_FTDI,     2 },
+    { "ttyUSB2", 0x067b, 0x2303, "",                  "pl2303",     ADAPTER_UNKNOWN,  3 },
+    { "ttyACM1", 0x1546, 0x01a8, "",                  "cdc_acm",    ADAPTER_FOREIGN, -1 },
+};
+
+#define PORT_COUNT  (int)(sizeof(expected) / sizeof(expected[0]))
+
+static int write_attr(const char *dir, const char *attr, const char *value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    fprintf(fp, "%s\n", value);
+    return fclose(fp);
+}
+
+static int make_dirs(const char *path) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(tmp, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+// Crea el dispositivo USB, su interfaz y la entrada de class/tty como en Linux:
+//   ttyUSB: class/tty/ttyUSBn/device -> <usb>/<usb>:1.0/ttyUSBn (driver de usb-serial)
+//   ttyACM: class/tty/ttyACMn/device -> <usb>/<usb>:1.0 (driver cdc_acm)
+static int add_port(const char *root, int index, const fake_port *port) {
+    char usb[512], iface[768], node[1024], path[PATH_MAX], target[PATH_MAX], value[16];
+    int acm = strncmp(port->name, "ttyACM", 6) == 0;
+
+    snprintf(usb, sizeof(usb), "%.256s/devices/pci0000:00/usb1/1-%d", root, index + 1);
+    snprintf(iface, sizeof(iface), "%s/1-%d:1.0", usb, index + 1);
+    if (acm) {
+        snprintf(node, sizeof(node), "%s", iface);
+    } else {
+        snprintf(node, sizeof(node), "%s/%s", iface, port->name);
+    }
+    if (make_dirs(node) != 0) return -1;
+
+    snprintf(value, sizeof(value), "%04x", port->vid);
+    if (write_attr(usb, "idVendor", value) != 0) return -1;
+    snprintf(value, sizeof(value), "%04x", port->pid);
+    if (write_attr(usb, "idProduct", value) != 0) return -1;
+    if (port->serial[0] && write_attr(usb, "serial", port->serial) != 0) return -1;
+
+    snprintf(path, sizeof(path), "%s/driver", node);
+    snprintf(target, sizeof(target), "%s/bus/%s/drivers/%s", root, acm ? "usb" : "usb-serial", port->driver);
+    if (symlink(target, path) != 0) return -1;
+
+    snprintf(path, sizeof(path), "%s/class/tty/%s", root, port->name);
+    if (make_dirs(path) != 0) return -1;
+    snprintf(path, sizeof(path), "%s/class/tty/%s/device", root, port->name);
+    return symlink(node, path);
+}
+
+// Arma el árbol completo; los puertos se crean en orden de nombre, no de rank
+static int build_tree(const char *root) {
+    static const char *by_name[] = { "ttyACM1", "ttyUSB0", "ttyUSB2", "ttyUSB4", "ttyACM0", "ttyUSB3", "ttyUSB1" };
+    char path[PATH_MAX];
+
+    for (int i = 0; i < (int)(sizeof(by_name) / sizeof(by_name[0])); i++) {
+        for (int j = 0; j < PORT_COUNT; j++) {
+            if (strcmp(expected[j].name, by_name[i]) == 0 && add_port(root, i, &expected[j]) != 0) return -1;
+        }
+    }
+
+    // Una consola que no es USB: no debe aparecer en la lista
+    snprintf(path, sizeof(path), "%s/class/tty/ttyS0", root);
+    return make_dirs(path);
+}
+
+static int check_port(int index, const serial_port_info *got, const fake_port *want) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/dev/%s", want->name);
+
+    const char *error = NULL;
+    if (strcmp(got->name, want->name) != 0)             error = "wrong order";
+    else if (strcmp(got->path, path) != 0)              error = "wrong path";
+    else if (got->vid != want->vid || got->pid != want->pid) error = "wrong VID/PID";
+    else if (strcmp(got->serial, want->serial) != 0)    error = "wrong serial number";
+    else if (strcmp(got->driver, want->driver) != 0)    error = "wrong driver";
+    else if (got->type != want->type)                   error = "wrong adapter type";
+    else if (got->rank != want->rank)                   error = "wrong rank";
+
+    printf("  %d. %-8s %04x:%04x %-10s %-16s rank %2d  %s\n", index + 1, got->name, got->vid, got->pid,
+           got->driver, adapter_type_name(got->type), got->rank, error ? error : "ok");
+    if (error) {
+        printf("     expected %s %04x:%04x %s %s rank %d\n", want->name, want->vid, want->pid, want->driver,
+               adapter_type_name(want->type), want->rank);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int keep = argc > 1 && strcmp(argv[1], "-keep") == 0;
+
+    char root[] = "/tmp/especcy-sysfs-XXXXXX";
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    if (build_tree(root) != 0) {
+        perror("build fake sysfs");
+        return 1;
+    }
+
+    serial_port_info *ports;
+    int count = enumerate_serial_ports(root, &ports);
+    int failed = 0;
+
+    printf("Fake sysfs in %s\n", root);
+    if (count != PORT_COUNT) {
+        printf("  found %d ports, expected %d\n", count, PORT_COUNT);
+        failed = 1;
+    }
+    for (int i = 0; i < count && i < PORT_COUNT; i++) {
+        if (check_port(i, &ports[i], &expected[i]) != 0) failed = 1;
+    }
+    if (count >= 0) free(ports);
+
+    // Sin class/tty la enumeración debe fallar para que se use ESPECCY_DEV_DIR
+    char missing[PATH_MAX];
+    snprintf(missing, sizeof(missing), "%s/no-sysfs", root);
+    if (enumerate_serial_ports(missing, &ports) != -1) {
+        printf("  a missing sysfs root was not reported\n");
+        failed = 1;
+    }
+
+    if (!keep) {
+        char cmd[PATH_MAX + 16];
+        snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+        if (system(cmd) != 0) fprintf(stderr, "Could not remove %s\n", root);
+    }
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed;
+}
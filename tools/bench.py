@@ -0,0 +1,421 @@
+#!/usr/bin/env python3
+#
+# MIT License
+#
+# Copyright (c) 2024 SplinterGU
+#
+# Hermetic benchmark of especcy_flash_tool.
+#
+# Every scenario starts tools/release_server.py and one or more
+# tools/esp32_sim.py devices in a scratch directory, runs the tool several
+# times with "-report json" and aggregates the time of each phase. Nothing
+# touches real hardware or github.com: the tool is pointed at the local
+# server with ESPECCY_API_URL and at the simulated ports with
+# ESPECCY_DEV_DIR (sysfs is disabled through ESPECCY_SYSFS_ROOT).
+#
+# Usage:
+#   tools/bench.py --tool build/especcy_flash_tool [--runs 5] [--scenario NAME ...]
+#                  [--json results.json] [--keep]
+#   tools/bench.py --list
+#
+
+import argparse
+import hashlib
+import json
+import os
+import random
+import shutil
+import socket
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+
+REPO = ("SplinterGU", "ESPeccy")
+ASSET = "complete_firmware.bin"
+FIRMWARE_SIZE = 3000000
+FLASH_SIZE = 4 * 1024 * 1024
+
+# Fases que corren a la vez (una sonda por puerto): se toma la más larga, no la suma
+PARALLEL_PHASES = {"probe"}
+
+# Cada escenario describe el servidor, los dispositivos y los argumentos del tool.
+#   warm:   una corrida previa sin medir llena la caché y la flash simulada
+#   port:   usar -p con el primer dispositivo en lugar de buscarlo
+SCENARIOS = [
+    {
+        "name": "detect",
+        "help": "scan 5 ports: one ESP32, three silent devices and a GPS",
+        "devices": [{"banner": "download"}, {"banner": "silent"}, {"banner": "silent"},
+                    {"banner": "silent"}, {"banner": "noise"}],
+        "args": ["-diff", "-rescan"],
+        "warm": True,
+    },
+    {
+        "name": "detect-known",
+        "help": "same 5 ports, the ESP32 already in the device registry",
+        "devices": [{"banner": "download"}, {"banner": "silent"}, {"banner": "silent"},
+                    {"banner": "silent"}, {"banner": "noise"}],
+        "args": ["-diff"],
+        "warm": True,
+    },
+    {
+        "name": "metadata",
+        "help": "cold cache, 50 ms server latency, unlimited bandwidth",
+        "server": ["--latency-ms", "50"],
+        "devices": [{}],
+        "args": ["-diff"],
+        "port": True,
+    },
+    {
+        "name": "download-1conn",
+        "help": "cold cache, 4 MB/s per connection, a single connection",
+        "server": ["--latency-ms", "50", "--bandwidth", str(4 * 1024 * 1024)],
+        "devices": [{}],
+        "args": ["-diff", "-connections", "1"],
+        "port": True,
+    },
+    {
+        "name": "download-4conn",
+        "help": "cold cache, 4 MB/s per connection, four connections",
+        "server": ["--latency-ms", "50", "--bandwidth", str(4 * 1024 * 1024)],
+        "devices": [{}],
+        "args": ["-diff", "-connections", "4"],
+        "port": True,
+    },
+    {
+        "name": "revalidate",
+        "help": "warm cache, the server answers 304 Not Modified",
+        "server": ["--latency-ms", "50"],
+        "devices": [{}],
+        "args": ["-diff", "-ttl", "0"],
+        "port": True,
+        "warm": True,
+    },
+    {
+        "name": "flash-compressed",
+        "help": "full compressed write, 1 ms response latency, auto baud",
+        "devices": [{"latency": 1}],
+        "args": ["-b", "auto"],
+        "port": True,
+        "warm": True,
+    },
+    {
+        "name": "flash-full",
+        "help": "full compressed write including the 0xFF padding (-nosparse)",
+        "devices": [{"latency": 1}],
+        "args": ["-b", "auto", "-nosparse"],
+        "port": True,
+        "warm": True,
+    },
+    {
+        "name": "flash-plain",
+        "help": "full uncompressed write, 1 ms response latency, auto baud",
+        "devices": [{"latency": 1}],
+        "args": ["-b", "auto", "-nocompress"],
+        "port": True,
+        "warm": True,
+    },
+    {
+        "name": "flash-diff",
+        "help": "differential write over an up-to-date flash",
+        "devices": [{"latency": 1}],
+        "args": ["-b", "auto", "-diff"],
+        "port": True,
+        "warm": True,
+    },
+    {
+        "name": "monitor",
+        "help": "flash, then capture 1 MB of boot log with -monitor until app_main",
+        "devices": [{"app_log": 1024 * 1024}],
+        "args": ["-monitor-time", "1"],
+        "port": True,
+        "warm": True,
+    },
+]
+
+
+# Particiones de la imagen combinada: (nombre, tipo, subtipo, offset, tamaño)
+PARTITIONS = [
+    ("nvs", 1, 0x02, 0x9000, 0x4000),
+    ("otadata", 1, 0x00, 0xD000, 0x2000),
+    ("phy_init", 1, 0x01, 0xF000, 0x1000),
+    ("ota_0", 0, 0x10, 0x10000, 0x170000),
+    ("ota_1", 0, 0x11, 0x180000, 0x170000),
+]
+
+
+def filler(rng, size):
+    """Contenido con una mezcla parecida a un firmware real: código poco
+    comprimible, tablas y texto repetitivos y algo de relleno 0xFF."""
+    words = [b"ESPeccy", b"ZX Spectrum", b"esp_err_t", b"heap_caps_malloc", b"vTaskDelay",
+             b"I (%d) %s: ", b"0123456789ABCDEF", b"\x00\x00\x00\x00"]
+    out = bytearray()
+    while len(out) < size:
+        kind = rng.random()
+        if kind < 0.2:
+            out += rng.randbytes(4096)
+        elif kind < 0.9:
+            block = bytearray()
+            while len(block) < 4096:
+                block += rng.choice(words)
+            out += block[:4096]
+        else:
+            out += b"\xff" * 4096
+    return bytes(out[:size])
+
+
+def app_image(rng, size, segments=4):
+    """Imagen de aplicación del ESP32 (cabecera 0xE9, segmentos, checksum y
+    SHA-256 al final) de unos size bytes."""
+    header = bytes([0xE9, segments, 0x02, 0x20]) + struct.pack("<I", 0x400D0000)
+    header += bytes(15) + b"\x01"     # cabecera extendida con hash_appended = 1
+    payload = (size - len(header) - 8 * segments - 48) // segments & ~3
+    out = bytearray(header)
+    for i in range(segments):
+        out += struct.pack("<II", 0x3F400000 + i * 0x100000, payload) + filler(rng, payload)
+    out += bytes(15 - len(out) % 16) + b"\xef"
+    out += hashlib.sha256(out).digest()
+    return bytes(out)
+
+
+def make_firmware(path, size, seed=1):
+    """Imagen combinada como complete_firmware.bin: bootloader en 0x1000,
+    tabla de particiones en 0x8000 y la aplicación en ota_0; el resto es
+    relleno 0xFF (otadata, nvs y ota_1 vacías)."""
+    rng = random.Random(seed)
+    out = bytearray(b"\xff" * size)
+
+    def put(offset, data):
+        out[offset:offset + len(data)] = data[:max(0, size - offset)]
+
+    put(0x1000, app_image(rng, 0x6000))
+
+    table = b"".join(struct.pack("<HBBII16sI", 0x50AA, kind, subtype, offset, length, name.encode(), 0)
+                     for name, kind, subtype, offset, length in PARTITIONS)
+    table += struct.pack("<H", 0xEBEB) + b"\xff" * 14 + hashlib.md5(table).digest()
+    put(0x8000, table)
+
+    put(0xF000, filler(rng, 0x100))
+    put(0x10000, app_image(rng, 1300000))
+
+    with open(path, "wb") as f:
+        f.write(out)
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_for(predicate, timeout=10.0):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.02)
+    return False
+
+
+class Bench:
+    def __init__(self, args):
+        self.args = args
+        self.root = tempfile.mkdtemp(prefix="especcy-bench-")
+        self.processes = []
+
+        self.srv_dir = os.path.join(self.root, "srv")
+        release = os.path.join(self.srv_dir, REPO[0], REPO[1], "v1.0")
+        os.makedirs(release)
+        make_firmware(os.path.join(release, ASSET), FIRMWARE_SIZE)
+
+    def start_server(self, extra):
+        port = free_port()
+        proc = subprocess.Popen([sys.executable, os.path.join(TOOLS_DIR, "release_server.py"),
+                                 "--root", self.srv_dir, "--port", str(port), "--quiet"] + extra,
+                                stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+        self.processes.append(proc)
+        proc.stdout.readline()      # "Serving ..." cuando ya escucha
+        return "http://127.0.0.1:%d" % port
+
+    def start_device(self, dev_dir, index, device):
+        link = os.path.join(dev_dir, "ttyUSB%d" % index)
+        cmd = [sys.executable, os.path.join(TOOLS_DIR, "esp32_sim.py"), "--link", link, "--quiet",
+               "--flash-size", str(FLASH_SIZE), "--banner", device.get("banner", "download"),
+               "--latency-ms", str(device.get("latency", 0))]
+        if "app_log" in device:
+            cmd += ["--app-log", str(device["app_log"])]
+        proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        self.processes.append(proc)
+        if not wait_for(lambda: os.path.islink(link)):
+            raise RuntimeError("simulator %s did not start" % link)
+        return link
+
+    def stop_all(self):
+        for proc in self.processes:
+            proc.terminate()
+        for proc in self.processes:
+            try:
+                proc.wait(timeout=5)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+        self.processes = []
+
+    def run_tool(self, work, env, args):
+        proc = subprocess.run([self.args.tool] + args + ["-report", "json"], cwd=work, env=env,
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                              timeout=self.args.timeout)
+        lines = proc.stdout.strip().splitlines()
+        try:
+            report = json.loads(lines[-1])
+        except (IndexError, ValueError):
+            report = None
+        if proc.returncode != 0 or report is None:
+            sys.stderr.write("  run failed (exit %d):\n    %s\n" %
+                             (proc.returncode, "\n    ".join(lines[-5:])))
+            return None
+        return report
+
+    def scenario(self, sc):
+        work = os.path.join(self.root, sc["name"])
+        dev_dir = os.path.join(work, "dev")
+        run_dir = os.path.join(work, "run")
+        cache_dir = os.path.join(work, "cache")
+        os.makedirs(dev_dir)
+        os.makedirs(run_dir)
+
+        try:
+            env = dict(os.environ)
+            env["ESPECCY_API_URL"] = self.start_server(sc.get("server", []))
+            env["ESPECCY_DEV_DIR"] = dev_dir
+            env["ESPECCY_SYSFS_ROOT"] = os.path.join(work, "no-sysfs")
+            env["ESPECCY_CACHE_DIR"] = cache_dir
+
+            links = [self.start_device(dev_dir, i, d) for i, d in enumerate(sc.get("devices", [{}]))]
+            args = list(sc.get("args", []))
+            if sc.get("port"):
+                args += ["-p", links[0]]
+
+            if sc.get("warm") and not self.run_tool(run_dir, env, args):
+                return [], self.args.runs
+
+            reports, failures = [], 0
+            for _ in range(self.args.runs):
+                if not sc.get("warm"):
+                    shutil.rmtree(cache_dir, ignore_errors=True)
+                report = self.run_tool(run_dir, env, args)
+                if report:
+                    reports.append(report)
+                else:
+                    failures += 1
+            return reports, failures
+        finally:
+            self.stop_all()
+
+    def cleanup(self):
+        if self.args.keep:
+            print("Scratch files kept in %s" % self.root)
+        else:
+            shutil.rmtree(self.root, ignore_errors=True)
+
+
+def summarize(reports):
+    """Por fase: segundos de cada corrida (suma, o máximo si es paralela) y bytes."""
+    per_phase = {}
+    for report in reports:
+        run = {"total": [report["seconds"], 0]}
+        for p in report["phases"]:
+            seconds, size = run.get(p["phase"], [0.0, 0])
+            if p["phase"] in PARALLEL_PHASES:
+                seconds = max(seconds, p["seconds"])
+            else:
+                seconds += p["seconds"]
+            run[p["phase"]] = [seconds, size + p["bytes"]]
+        for phase, (seconds, size) in run.items():
+            entry = per_phase.setdefault(phase, {"seconds": [], "bytes": []})
+            entry["seconds"].append(seconds)
+            entry["bytes"].append(size)
+
+    summary = {}
+    for phase, entry in per_phase.items():
+        median = statistics.median(entry["seconds"])
+        size = statistics.median(entry["bytes"])
+        summary[phase] = {
+            "runs": len(entry["seconds"]),
+            "median": median,
+            "min": min(entry["seconds"]),
+            "max": max(entry["seconds"]),
+            "bytes": size,
+            "bytes_per_second": size / median if size and median > 0 else None,
+        }
+    return summary
+
+
+PHASE_ORDER = ["scan", "probe", "metadata", "download", "reset", "sync", "identify", "diff", "compress",
+               "erase", "write", "verify", "monitor", "ready", "total"]
+
+
+def print_summary(name, summary, failures):
+    print("\n%s%s" % (name, "  (%d failed runs)" % failures if failures else ""))
+    print("  %-10s %5s %10s %10s %10s %10s" % ("phase", "runs", "median s", "min s", "max s", "MB/s"))
+    phases = sorted(summary, key=lambda p: PHASE_ORDER.index(p) if p in PHASE_ORDER else len(PHASE_ORDER))
+    for phase in phases:
+        s = summary[phase]
+        rate = "%.2f" % (s["bytes_per_second"] / 1e6) if s["bytes_per_second"] else "-"
+        print("  %-10s %5d %10.3f %10.3f %10.3f %10s" % (phase, s["runs"], s["median"], s["min"], s["max"], rate))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Hermetic benchmark of especcy_flash_tool")
+    parser.add_argument("--tool", help="path to the especcy_flash_tool binary")
+    parser.add_argument("--runs", type=int, default=5, help="measured runs per scenario")
+    parser.add_argument("--scenario", action="append", metavar="NAME", help="run only these scenarios")
+    parser.add_argument("--timeout", type=int, default=120, metavar="SECONDS", help="limit per run")
+    parser.add_argument("--json", metavar="FILE", help="also write the results as JSON")
+    parser.add_argument("--keep", action="store_true", help="keep the scratch directory")
+    parser.add_argument("--list", action="store_true", help="list the scenarios and exit")
+    args = parser.parse_args()
+
+    if args.list:
+        for sc in SCENARIOS:
+            print("%-18s %s" % (sc["name"], sc["help"]))
+        return 0
+
+    if not args.tool:
+        parser.error("--tool is required")
+    args.tool = os.path.abspath(args.tool)
+
+    selected = [sc for sc in SCENARIOS if not args.scenario or sc["name"] in args.scenario]
+    unknown = set(args.scenario or []) - {sc["name"] for sc in SCENARIOS}
+    if unknown:
+        parser.error("unknown scenario: %s" % ", ".join(sorted(unknown)))
+
+    bench = Bench(args)
+    results = {}
+    failed = 0
+    try:
+        for sc in selected:
+            print("Running %s: %s" % (sc["name"], sc["help"]), flush=True)
+            reports, failures = bench.scenario(sc)
+            failed += failures
+            summary = summarize(reports)
+            results[sc["name"]] = {"failures": failures, "phases": summary}
+            print_summary(sc["name"], summary, failures)
+    finally:
+        bench.stop_all()
+        bench.cleanup()
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"runs": args.runs, "scenarios": results}, f, indent=2)
+            f.write("\n")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
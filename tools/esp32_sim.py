@@ -0,0 +1,480 @@
+#!/usr/bin/env python3
+#
+# MIT License
+#
+# Copyright (c) 2024 SplinterGU
+#
+# Simulated ESP32 ROM loader on a pseudo terminal.
+#
+# The simulator creates a pty pair and answers the serial bootloader
+# protocol (SLIP framed commands) on it, keeping the flash contents in
+# memory. A pty has no DTR/RTS lines, so every time a client opens the
+# port the simulator behaves as if the chip had just been reset into
+# download mode: it prints the ROM boot banner and waits for SYNC.
+#
+# Link limits can be simulated per baud rate: above --max-baud every
+# response is garbled, above --flaky-baud one data block out of
+# --flaky-every fails its checksum.
+#
+# --banner picks what the device prints when the port is opened:
+#   download  ROM banner, then the loader answers (default)
+#   app       ROM banner of a normal boot plus ESP-IDF log lines
+#   noise     a non-ESP32 device that streams NMEA sentences
+#   silent    a non-ESP32 device that never sends anything
+# Only "download" answers loader commands.
+#
+# --chip and --package set what the identification registers report: the
+# chip family (magic register) and the ESP32 package in eFuse, which tells
+# whether the chip has PSRAM. RDID through the SPI1 registers returns a
+# JEDEC ID that matches --flash-size.
+#
+# With --app-log the chip runs the firmware after being flashed: the first
+# time the port is opened after a FLASH_END it prints the boot log of the
+# application (about --app-log bytes of ESP-IDF log lines, then the
+# "Calling app_main()" line) instead of entering download mode. This is what
+# the post-flash monitor (-monitor) sees.
+#
+# Usage:
+#   tools/esp32_sim.py [--link /tmp/ttyESP32] [--flash-file flash.bin]
+#   especcy_flash_tool -port /tmp/ttyESP32
+#
+
+import argparse
+import hashlib
+import os
+import random
+import select
+import signal
+import struct
+import sys
+import time
+import tty
+import zlib
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+
+FLASH_BEGIN = 0x02
+FLASH_DATA = 0x03
+FLASH_END = 0x04
+SYNC = 0x08
+WRITE_REG = 0x09
+READ_REG = 0x0A
+SPI_SET_PARAMS = 0x0B
+SPI_ATTACH = 0x0D
+CHANGE_BAUDRATE = 0x0F
+FLASH_DEFL_BEGIN = 0x10
+FLASH_DEFL_DATA = 0x11
+FLASH_DEFL_END = 0x12
+SPI_FLASH_MD5 = 0x13
+
+CHECKSUM_SEED = 0xEF
+SECTOR_SIZE = 0x1000
+
+# ROM error codes (second status byte)
+ERR_INVALID = 0x05
+ERR_FAILED = 0x06
+ERR_CRC = 0x07
+ERR_DEFLATE = 0x0B
+
+SYNC_PAYLOAD = bytes([0x07, 0x07, 0x12, 0x20]) + bytes([0x55] * 32)
+
+BOOT_BANNER = (b"ets Jun  8 2016 00:22:57\r\n\r\n"
+               b"rst:0x1 (POWERON_RESET),boot:0x3 (DOWNLOAD_BOOT(UART0/UART1/SDIO_REI_REO_V2))\r\n"
+               b"waiting for download\r\n")
+
+APP_BANNER = (b"ets Jun  8 2016 00:22:57\r\n\r\n"
+              b"rst:0x1 (POWERON_RESET),boot:0x13 (SPI_FAST_FLASH_BOOT)\r\n"
+              b"I (29) boot: ESP-IDF v5.1.2 2nd stage bootloader\r\n"
+              b"I (29) boot: compile time Jan  1 2025 00:00:00\r\n")
+
+APP_READY = b"I (%d) main_task: Calling app_main()\r\n"
+
+NMEA_LINE = b"$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+
+ROM_BAUD = 115200
+
+CHIP_MAGIC_REG = 0x40001000
+CHIP_MAGICS = {"esp32": 0x00F01D83, "esp32s2": 0x000007C6, "esp32s3": 0x00000009, "esp32c3": 0x1B31506F}
+
+# eFuse word with the ESP32 package (CHIP_VER_PKG) and the SPI1 controller
+EFUSE_BLK0_RDATA3 = 0x3FF5A00C
+SPI_CMD_REG = 0x3FF42000
+SPI_USR2_REG = 0x3FF42024
+SPI_W0_REG = 0x3FF42080
+SPI_CMD_USR = 1 << 18
+SPIFLASH_RDID = 0x9F
+FLASH_MANUFACTURER = 0xEF       # Winbond
+FLASH_MEMORY_TYPE = 0x40
+
+
+class RomError(Exception):
+    def __init__(self, code):
+        Exception.__init__(self, code)
+        self.code = code
+
+
+class Rom:
+    def __init__(self, args):
+        self.args = args
+        self.flash = bytearray(b"\xff" * args.flash_size)
+        if args.flash_file and os.path.exists(args.flash_file):
+            with open(args.flash_file, "rb") as f:
+                data = f.read(args.flash_size)
+            self.flash[:len(data)] = data
+        self.run_app = False    # the next open boots the flashed firmware (--app-log)
+        self.registers = {
+            CHIP_MAGIC_REG: CHIP_MAGICS[args.chip],
+            EFUSE_BLK0_RDATA3: ((args.package & 0x07) << 9) | (((args.package >> 3) & 0x01) << 2),
+        }
+        self.reset()
+
+    def log(self, msg):
+        if not self.args.quiet:
+            sys.stderr.write("esp32-sim: %s\n" % msg)
+
+    def reset(self):
+        self.baud = ROM_BAUD
+        self.next_baud = None   # applied after the CHANGE_BAUDRATE response
+        self.blocks = 0
+        self.synced = False
+        self.attached = False
+        self.write = None       # [offset, blocks, block_size, next_seq]
+        self.inflater = None    # zlib stream of a compressed write
+        self.inflate_pos = 0
+
+    def save(self):
+        if self.args.flash_file:
+            with open(self.args.flash_file, "wb") as f:
+                f.write(self.flash)
+
+    def handle(self, op, chk, data):
+        if op == SYNC:
+            if data != SYNC_PAYLOAD:
+                raise RomError(ERR_INVALID)
+            # The pty cannot show the reset that precedes a SYNC: assume the ROM rate again
+            self.baud = ROM_BAUD
+            self.synced = True
+            return 0, b""
+        if not self.synced:
+            return None         # the ROM ignores everything until it syncs
+
+        if op == READ_REG:
+            (addr,) = struct.unpack("<I", data[:4])
+            return self.registers.get(addr, 0), b""
+        if op == WRITE_REG:
+            addr, value, mask, _ = struct.unpack("<IIII", data[:16])
+            self.registers[addr] = (self.registers.get(addr, 0) & ~mask) | (value & mask)
+            if addr == SPI_CMD_REG and self.registers[addr] & SPI_CMD_USR:
+                self.spi_command()
+            return 0, b""
+        if op == SPI_ATTACH:
+            self.attached = True
+            return 0, b""
+        if op == SPI_SET_PARAMS:
+            _, total = struct.unpack("<II", data[:8])
+            if total > len(self.flash):
+                self.log("flash size set to %d bytes, only %d present" % (total, len(self.flash)))
+            return 0, b""
+        if op == CHANGE_BAUDRATE:
+            baud, _ = struct.unpack("<II", data[:8])
+            self.log("baud rate changed to %d" % baud)
+            self.next_baud = baud
+            return 0, b""
+        if op == FLASH_BEGIN:
+            return self.flash_begin(data)
+        if op == FLASH_DATA:
+            return self.flash_data(chk, data)
+        if op == FLASH_DEFL_BEGIN:
+            result = self.flash_begin(data)
+            self.inflater = zlib.decompressobj()
+            self.inflate_pos = self.write[0]
+            return result
+        if op == FLASH_DEFL_DATA:
+            return self.flash_defl_data(chk, data)
+        if op in (FLASH_END, FLASH_DEFL_END):
+            (stay,) = struct.unpack("<I", data[:4])
+            self.write = None
+            self.inflater = None
+            self.save()
+            self.run_app = self.args.app_log is not None
+            self.log("flash end (%s)" % ("stay in loader" if stay else "run user code"))
+            return 0, b""
+        if op == SPI_FLASH_MD5:
+            addr, size = struct.unpack("<II", data[:8])
+            if addr + size > len(self.flash):
+                raise RomError(ERR_FAILED)
+            return 0, hashlib.md5(self.flash[addr:addr + size]).hexdigest().encode()
+        raise RomError(ERR_INVALID)
+
+    def spi_command(self):
+        # Only RDID is answered; the transfer finishes at once
+        if self.registers.get(SPI_USR2_REG, 0) & 0xFF == SPIFLASH_RDID:
+            capacity = len(self.flash).bit_length() - 1
+            self.registers[SPI_W0_REG] = FLASH_MANUFACTURER | (FLASH_MEMORY_TYPE << 8) | (capacity << 16)
+        self.registers[SPI_CMD_REG] &= ~SPI_CMD_USR
+
+    def flash_begin(self, data):
+        erase_size, blocks, block_size, offset = struct.unpack("<IIII", data[:16])
+        if offset + erase_size > len(self.flash) or offset % SECTOR_SIZE:
+            raise RomError(ERR_FAILED)
+        end = min(len(self.flash), (offset + erase_size + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE)
+        self.flash[offset:end] = b"\xff" * (end - offset)
+        self.write = [offset, blocks, block_size, 0]
+        self.log("erased 0x%x bytes at 0x%x, expecting %d blocks of %d" % (end - offset, offset, blocks, block_size))
+        return 0, b""
+
+    def check_block(self, chk, data):
+        if self.write is None or len(data) < 16:
+            raise RomError(ERR_INVALID)
+        size, seq = struct.unpack("<II", data[:8])
+        payload = data[16:]
+        offset, blocks, block_size, next_seq = self.write
+        if size != len(payload) or size > block_size or seq != next_seq or seq >= blocks:
+            raise RomError(ERR_INVALID)
+
+        expected = CHECKSUM_SEED
+        for b in payload:
+            expected ^= b
+        if expected != chk:
+            raise RomError(ERR_CRC)
+
+        # A marginal link corrupts some of the large packets
+        self.blocks += 1
+        if self.baud > self.args.flaky_baud and self.blocks % self.args.flaky_every == 0:
+            raise RomError(ERR_CRC)
+
+        self.write[3] = seq + 1
+        return seq, payload
+
+    def flash_data(self, chk, data):
+        seq, payload = self.check_block(chk, data)
+        offset, _, block_size, _ = self.write
+        if len(payload) != block_size:
+            raise RomError(ERR_INVALID)
+        start = offset + seq * block_size
+        self.flash[start:start + len(payload)] = payload
+        return 0, b""
+
+    def flash_defl_data(self, chk, data):
+        if self.inflater is None:
+            raise RomError(ERR_INVALID)
+        _, payload = self.check_block(chk, data)
+        try:
+            out = self.inflater.decompress(payload)
+        except zlib.error:
+            raise RomError(ERR_DEFLATE)
+        if self.inflate_pos + len(out) > len(self.flash):
+            raise RomError(ERR_FAILED)
+        self.flash[self.inflate_pos:self.inflate_pos + len(out)] = out
+        self.inflate_pos += len(out)
+        return 0, b""
+
+
+def slip_encode(packet):
+    out = bytearray([SLIP_END])
+    for b in packet:
+        if b == SLIP_END:
+            out += bytes([SLIP_ESC, SLIP_ESC_END])
+        elif b == SLIP_ESC:
+            out += bytes([SLIP_ESC, SLIP_ESC_ESC])
+        else:
+            out.append(b)
+    out.append(SLIP_END)
+    return bytes(out)
+
+
+class SlipDecoder:
+    def __init__(self):
+        self.frame = None
+        self.escape = False
+
+    def feed(self, data):
+        for b in data:
+            if b == SLIP_END:
+                if self.frame:
+                    yield bytes(self.frame)
+                self.frame = bytearray()
+                self.escape = False
+            elif self.frame is None:
+                continue
+            elif self.escape:
+                self.escape = False
+                if b == SLIP_ESC_END:
+                    self.frame.append(SLIP_END)
+                elif b == SLIP_ESC_ESC:
+                    self.frame.append(SLIP_ESC)
+                else:
+                    self.frame = None
+            elif b == SLIP_ESC:
+                self.escape = True
+            else:
+                self.frame.append(b)
+
+
+def response(op, value, body, error=0):
+    status = bytes([1 if error else 0, error, 0, 0])
+    data = body + status
+    return slip_encode(struct.pack("<BBHI", 1, op, len(data), value) + data)
+
+
+def send(master, rom, data):
+    # Above the link limit nothing the host receives makes sense
+    if rom.baud > rom.args.max_baud:
+        data = bytes(random.getrandbits(8) for _ in range(len(data)))
+    write_all(master, data)
+
+
+def write_all(fd, data):
+    while data:
+        try:
+            n = os.write(fd, data)
+        except BlockingIOError:
+            select.select([], [fd], [], 0.1)
+            continue
+        data = data[n:]
+
+
+def app_log(size):
+    lines = []
+    total = 0
+    ms = 30
+    while total < size:
+        line = b"I (%d) app: boot log line %08d, padding the console with some text\r\n" % (ms, len(lines))
+        lines.append(line)
+        total += len(line)
+        ms += 1
+    lines.append(APP_READY % ms)
+    return b"".join(lines)
+
+
+def serve(master, rom, args):
+    decoder = None
+    mode = args.banner
+    poller = select.poll()
+    poller.register(master, select.POLLIN)
+
+    while True:
+        # Right after an open, notice it quickly even if the client sends nothing
+        events = poller.poll(20 if decoder is None else 100 if mode == "noise" else 1000)
+        hangup = any(ev & select.POLLHUP for _, ev in events)
+
+        if hangup:
+            # Nobody has the port open
+            if decoder is not None:
+                rom.log("port closed")
+                decoder = None
+                rom.reset()
+            time.sleep(0.02)
+            continue
+
+        if decoder is None:
+            # A client opened the port: behave like a reset into download mode
+            mode = "firmware" if rom.run_app else args.banner
+            rom.run_app = False
+            rom.log("port opened, booting (%s)" % mode)
+            decoder = SlipDecoder()
+            time.sleep(args.boot_delay / 1000.0)
+            if mode == "download":
+                write_all(master, BOOT_BANNER)
+            elif mode == "app":
+                write_all(master, APP_BANNER)
+            elif mode == "firmware":
+                # The monitor holds EN low for 100 ms after opening the port
+                time.sleep(0.1)
+                write_all(master, APP_BANNER + app_log(args.app_log))
+
+        if mode == "noise":
+            write_all(master, NMEA_LINE)
+            time.sleep(0.1)
+
+        if not events:
+            continue
+
+        try:
+            data = os.read(master, 4096)
+        except OSError:
+            continue
+
+        if mode != "download":
+            continue
+
+        for frame in decoder.feed(data):
+            if len(frame) < 8 or frame[0] != 0:
+                continue
+            _, op, size, chk = struct.unpack("<BBHI", frame[:8])
+            body = frame[8:8 + size]
+            try:
+                result = rom.handle(op, chk, body)
+            except RomError as e:
+                rom.log("command 0x%02x failed with error 0x%02x" % (op, e.code))
+                send(master, rom, response(op, 0, b"", e.code))
+                continue
+            if result is None:
+                continue
+            value, reply = result
+            if args.latency_ms:
+                time.sleep(args.latency_ms / 1000.0)
+            # The ROM answers SYNC several times
+            for _ in range(8 if op == SYNC else 1):
+                send(master, rom, response(op, value, reply))
+            if rom.next_baud:
+                rom.baud, rom.next_baud = rom.next_baud, None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulated ESP32 ROM loader on a pty")
+    parser.add_argument("--link", help="create a symlink to the pty at this path")
+    parser.add_argument("--flash-size", type=int, default=4 * 1024 * 1024, metavar="BYTES")
+    parser.add_argument("--flash-file", help="load the flash contents from / save them to this file")
+    parser.add_argument("--boot-delay", type=int, default=30, metavar="MS",
+                        help="delay before the boot banner after the port is opened")
+    parser.add_argument("--latency-ms", type=int, default=0, metavar="MS",
+                        help="delay added before every response")
+    parser.add_argument("--max-baud", type=int, default=1 << 30, metavar="BAUD",
+                        help="garble every response above this baud rate")
+    parser.add_argument("--flaky-baud", type=int, default=1 << 30, metavar="BAUD",
+                        help="fail some data blocks above this baud rate")
+    parser.add_argument("--flaky-every", type=int, default=200, metavar="N",
+                        help="with --flaky-baud, fail one data block out of N")
+    parser.add_argument("--banner", choices=["download", "app", "noise", "silent"], default="download",
+                        help="what the device sends when the port is opened")
+    parser.add_argument("--chip", choices=sorted(CHIP_MAGICS), default="esp32",
+                        help="chip family reported by the magic register")
+    parser.add_argument("--package", type=int, default=0, metavar="N",
+                        help="ESP32 package in eFuse (0 D0WDQ6, 5 PICO-D4, 6 PICO-V3-02...)")
+    parser.add_argument("--app-log", type=int, metavar="BYTES",
+                        help="after a flash, boot the firmware and print this much log on the next open")
+    parser.add_argument("--quiet", action="store_true", help="do not log commands")
+    args = parser.parse_args()
+
+    # Terminate like Ctrl+C so the --link symlink is removed
+    signal.signal(signal.SIGTERM, signal.default_int_handler)
+
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    path = os.ttyname(slave)
+    os.close(slave)
+    os.set_blocking(master, False)
+
+    if args.link:
+        if os.path.islink(args.link):
+            os.unlink(args.link)
+        os.symlink(path, args.link)
+
+    print("ESP32 ROM simulator on %s" % (args.link or path), flush=True)
+
+    rom = Rom(args)
+    try:
+        serve(master, rom, args)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.link and os.path.islink(args.link):
+            os.unlink(args.link)
+
+
+if __name__ == "__main__":
+    main()
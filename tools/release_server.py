@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+#
+# MIT License
+#
+# Copyright (c) 2024 SplinterGU
+#
+# Local stand-in for the GitHub releases API and asset downloads.
+#
+# Layout of the served directory:
+#
+#   <root>/<owner>/<repo>/<tag>/<asset files>
+#
+# The highest tag (sorted by name) is reported as the latest release.
+#
+# Asset downloads support ETag / Last-Modified revalidation and single
+# HTTP Range requests (disable them with --no-ranges). --drop-after cuts
+# every response body after that many bytes, to exercise resumable downloads.
+#
+# --latency-ms delays every response, like the round trip to a remote
+# server. --bandwidth caps each response body to that many bytes per second.
+#
+# Every asset carries a "digest" ("sha256:<hex>") like the GitHub API does;
+# --digest bad reports a wrong one and --digest none leaves it out, so the
+# client has to fall back to a "<asset>.sha256" file if the release has one.
+#
+# Usage:
+#   tools/release_server.py --root DIR [--port 8000] [--no-ranges] [--drop-after BYTES]
+#                           [--latency-ms MS] [--bandwidth BYTES_PER_SECOND]
+#                           [--digest good|bad|none]
+#   ESPECCY_API_URL=http://127.0.0.1:8000 especcy_flash_tool
+#
+
+import argparse
+import email.utils
+import hashlib
+import json
+import os
+import re
+import socket
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import unquote
+
+
+class ReleaseHandler(BaseHTTPRequestHandler):
+    server_version = "release-server/1.0"
+
+    def log_message(self, fmt, *args):
+        if not self.server.quiet:
+            sys.stderr.write("%s %s\n" % (self.address_string(), fmt % args))
+
+    def base_url(self):
+        host = self.headers.get("Host") or "%s:%d" % self.server.server_address[:2]
+        return "http://%s" % host
+
+    def send_json(self, code, payload):
+        body = json.dumps(payload, indent=2).encode()
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.write_body(body)
+
+    def write_body(self, data):
+        if not self.server.bandwidth:
+            self.wfile.write(data)
+            return
+
+        # Enviar en trozos y dormir lo necesario para no pasar del ancho de banda
+        chunk = max(1024, self.server.bandwidth // 20)
+        start = time.monotonic()
+        for pos in range(0, len(data), chunk):
+            self.wfile.write(data[pos:pos + chunk])
+            ahead = (pos + chunk) / self.server.bandwidth - (time.monotonic() - start)
+            if ahead > 0:
+                time.sleep(ahead)
+
+    def do_GET(self):
+        if self.server.latency_ms:
+            time.sleep(self.server.latency_ms / 1000.0)
+
+        parts = [unquote(p) for p in self.path.split("?")[0].split("/") if p]
+        if len(parts) == 5 and parts[0] == "repos" and parts[3:] == ["releases", "latest"]:
+            self.latest_release(parts[1], parts[2])
+        elif len(parts) == 5 and parts[0] == "download":
+            self.download(*parts[1:])
+        else:
+            self.send_json(404, {"message": "Not Found"})
+
+    def latest_release(self, owner, repo):
+        repo_dir = os.path.join(self.server.root, owner, repo)
+        tags = sorted(d for d in os.listdir(repo_dir)
+                      if os.path.isdir(os.path.join(repo_dir, d))) if os.path.isdir(repo_dir) else []
+        if not tags:
+            self.send_json(404, {"message": "Not Found"})
+            return
+
+        tag = tags[-1]
+        assets = []
+        for name in sorted(os.listdir(os.path.join(repo_dir, tag))):
+            path = os.path.join(repo_dir, tag, name)
+            asset = {
+                "name": name,
+                "size": os.path.getsize(path),
+                "browser_download_url": "%s/download/%s/%s/%s/%s" % (self.base_url(), owner, repo, tag, name),
+            }
+            if self.server.digest != "none":
+                digest = self.file_sha256(path)
+                if self.server.digest == "bad":
+                    digest = "0" * len(digest)
+                asset["digest"] = "sha256:" + digest
+            assets.append(asset)
+
+        self.send_json(200, {
+            "tag_name": tag,
+            "name": tag,
+            "body": "Release %s\n" % tag,
+            "assets": assets,
+        })
+
+    def file_sha256(self, path):
+        st = os.stat(path)
+        key = (path, st.st_size, st.st_mtime_ns)
+        if key not in self.server.digests:
+            with open(path, "rb") as f:
+                self.server.digests[key] = hashlib.sha256(f.read()).hexdigest()
+        return self.server.digests[key]
+
+    def download(self, owner, repo, tag, name):
+        path = os.path.join(self.server.root, owner, repo, tag, name)
+        if not os.path.isfile(path):
+            self.send_json(404, {"message": "Not Found"})
+            return
+
+        st = os.stat(path)
+        etag = '"%s"' % hashlib.sha1(("%s:%d:%d" % (path, st.st_size, int(st.st_mtime))).encode()).hexdigest()
+        last_modified = email.utils.formatdate(int(st.st_mtime), usegmt=True)
+
+        not_modified = False
+        if self.headers.get("If-None-Match"):
+            not_modified = self.headers.get("If-None-Match") == etag
+        elif self.headers.get("If-Modified-Since"):
+            since = email.utils.parsedate_to_datetime(self.headers.get("If-Modified-Since"))
+            not_modified = since is not None and int(st.st_mtime) <= int(since.timestamp())
+
+        if not_modified:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.send_header("Last-Modified", last_modified)
+            self.end_headers()
+            return
+
+        start, end = 0, st.st_size - 1
+        status = 200
+        ranged = self.headers.get("Range")
+        if ranged and self.server.ranges:
+            match = re.fullmatch(r"bytes=(\d*)-(\d*)", ranged.strip())
+            if match and (match.group(1) or match.group(2)):
+                if match.group(1):
+                    start = int(match.group(1))
+                    if match.group(2):
+                        end = min(int(match.group(2)), st.st_size - 1)
+                else:
+                    start = max(0, st.st_size - int(match.group(2)))
+                if start >= st.st_size or start > end:
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % st.st_size)
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                status = 206
+
+        with open(path, "rb") as fp:
+            fp.seek(start)
+            data = fp.read(end - start + 1)
+
+        self.send_response(status)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(len(data)))
+        if self.server.ranges:
+            self.send_header("Accept-Ranges", "bytes")
+        if status == 206:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, st.st_size))
+        self.send_header("ETag", etag)
+        self.send_header("Last-Modified", last_modified)
+        self.end_headers()
+
+        if self.server.drop_after and len(data) > self.server.drop_after:
+            # Simular un corte de la conexión a mitad de la respuesta
+            self.write_body(data[:self.server.drop_after])
+            self.wfile.flush()
+            self.close_connection = True
+            self.connection.shutdown(socket.SHUT_RDWR)
+            return
+
+        self.write_body(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Local GitHub releases stand-in")
+    parser.add_argument("--root", required=True, help="directory with <owner>/<repo>/<tag>/<assets>")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--quiet", action="store_true", help="do not log requests")
+    parser.add_argument("--no-ranges", action="store_true", help="ignore Range requests")
+    parser.add_argument("--digest", choices=("good", "bad", "none"), default="good",
+                        help="digest reported for each asset (default: good)")
+    parser.add_argument("--drop-after", type=int, default=0, metavar="BYTES",
+                        help="cut every response body after BYTES bytes")
+    parser.add_argument("--latency-ms", type=int, default=0, metavar="MS",
+                        help="delay before every response")
+    parser.add_argument("--bandwidth", type=int, default=0, metavar="BYTES",
+                        help="limit every response body to BYTES per second")
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), ReleaseHandler)
+    server.root = os.path.abspath(args.root)
+    server.quiet = args.quiet
+    server.ranges = not args.no_ranges
+    server.drop_after = args.drop_after
+    server.latency_ms = args.latency_ms
+    server.bandwidth = args.bandwidth
+    server.digest = args.digest
+    server.digests = {}
+    print("Serving %s on http://127.0.0.1:%d" % (server.root, args.port), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,655 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <io.h>
+    #define ftruncate(fd, size)     _chsize_s(fd, size)
+    #define OPEN_FLAGS              (O_RDWR | O_CREAT | O_BINARY)
+#else
+    #include <unistd.h>
+    #define OPEN_FLAGS              (O_RDWR | O_CREAT)
+#endif
+
+#include "image_stream.h"
+#include "md5.h"
+#include "sha256.h"
+#include "transfer.h"
+
+#define SEGMENT_RETRIES         3
+#define JOURNAL_INTERVAL_MS     1000
+
+// Bytes fuera de orden que se incorporan al hash en cada vuelta del bucle de descarga
+#define HASH_CATCH_UP_MAX       (1024 * 1024)
+
+typedef struct transfer transfer;
+
+// Un tramo del archivo pedido con su propia conexión
+typedef struct {
+    transfer   *t;
+    CURL       *curl;
+    long long   start;          // primer byte del tramo
+    long long   end;            // último byte del tramo (inclusive)
+    long long   pos;            // próximo byte a escribir
+    int         retries;
+    int         checked;        // respuesta validada con el primer bloque
+    int         full;           // el servidor ignoró el rango y manda el archivo entero
+    long        status;         // código HTTP de la respuesta actual
+    long long   range_start;    // de Content-Range
+    long long   range_total;
+    char        etag[128];
+    char        last_modified[64];
+} segment;
+
+struct transfer {
+    int             fd;
+    sha256_ctx      sha;
+    md5_ctx         md5;
+    long long       hashed;     // los bytes [0, hashed) ya pasaron por el hash
+    int             insecure;
+    int             failed;
+    image_stream   *stream;     // imagen compartida con el flasheo (o NULL)
+    int             attached;
+};
+
+// Publica la imagen en cuanto se conoce su tamaño total
+static void attach_stream(transfer *t, long long total) {
+    if (!t->stream || t->attached || total <= 0) return;
+    if (ftruncate(t->fd, total) != 0) return;
+    if (image_stream_attach(t->stream, t->fd, total) == 0) t->attached = 1;
+}
+
+// Escribe en una posición del archivo
+static int write_at(int fd, const void *data, size_t len, long long offset) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return -1;
+    return write(fd, data, (unsigned int)len) == (int)len ? 0 : -1;
+#else
+    const char *p = (const char *)data;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+#endif
+}
+
+static long long read_at(int fd, void *data, size_t len, long long offset) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return -1;
+    return read(fd, data, (unsigned int)len);
+#else
+    return pread(fd, data, len, (off_t)offset);
+#endif
+}
+
+static void hash_update(transfer *t, const void *data, size_t len) {
+    sha256_update(&t->sha, data, len);
+    md5_update(&t->md5, data, len);
+    t->hashed += (long long)len;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Copia el valor de una cabecera "Nombre: valor" si coincide el nombre
+static int header_value(const char *line, size_t len, const char *name, char *value, size_t size) {
+    size_t name_len = strlen(name);
+    if (len <= name_len || strncasecmp(line, name, name_len) != 0) return 0;
+
+    const char *p = line + name_len;
+    const char *end = line + len;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (end > p && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ')) end--;
+
+    size_t n = (size_t)(end - p);
+    if (n >= size) n = size - 1;
+    memcpy(value, p, n);
+    value[n] = '\0';
+    return 1;
+}
+
+// Cabeceras de la respuesta: estado, Content-Range y validadores
+static size_t segment_header(char *buffer, size_t size, size_t nitems, void *data) {
+    size_t len = size * nitems;
+    segment *seg = (segment *)data;
+    char value[128];
+
+    // Cada redirección empieza una respuesta nueva
+    if (len > 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        const char *code = memchr(buffer, ' ', len);
+        seg->status = code ? strtol(code + 1, NULL, 10) : 0;
+        seg->range_start = -1;
+        seg->range_total = -1;
+        seg->etag[0] = '\0';
+        seg->last_modified[0] = '\0';
+        return len;
+    }
+
+    if (header_value(buffer, len, "Content-Range:", value, sizeof(value))) {
+        long long start, end, total;
+        if (sscanf(value, "bytes %lld-%lld/%lld", &start, &end, &total) == 3) {
+            seg->range_start = start;
+            seg->range_total = total;
+        }
+    }
+    header_value(buffer, len, "ETag:", seg->etag, sizeof(seg->etag));
+    header_value(buffer, len, "Last-Modified:", seg->last_modified, sizeof(seg->last_modified));
+
+    return len;
+}
+
+// Escribe los datos recibidos en su lugar del archivo
+static size_t segment_write(void *ptr, size_t size, size_t nmemb, void *data) {
+    size_t len = size * nmemb;
+    segment *seg = (segment *)data;
+    transfer *t = seg->t;
+
+    if (!seg->checked) {
+        seg->checked = 1;
+        if (seg->status == 206) {
+            // El tramo recibido tiene que empezar donde lo pedimos
+            if (seg->range_start != seg->pos) return 0;
+            attach_stream(t, seg->range_total);
+        } else if (seg->status == 200 && seg->start == 0) {
+            // Servidor sin soporte de rangos: llega el archivo completo
+            seg->full = 1;
+            seg->pos = 0;
+
+            curl_off_t length = -1;
+            curl_easy_getinfo(seg->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            attach_stream(t, (long long)length);
+        } else {
+            return 0;
+        }
+    }
+
+    if (write_at(t->fd, ptr, len, seg->pos) != 0) return 0;
+    if (t->attached) image_stream_write(t->stream, seg->pos, ptr, len);
+
+    // Hash en orden mientras los datos llegan contiguos desde el principio
+    if (seg->pos == t->hashed) hash_update(t, ptr, len);
+    seg->pos += (long long)len;
+    return len;
+}
+
+// Callback de progreso de curl; abortar la transferencia si se pidió cancelar
+static int progress_cancel(void *data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    (void)dltotal;
+    (void)dlnow;
+    (void)ultotal;
+    (void)ulnow;
+    const volatile int *cancel = (const volatile int *)data;
+    return (cancel && *cancel) ? 1 : 0;
+}
+
+void transfer_set_tls(void *curl, int insecure) {
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, insecure ? 0L : 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, insecure ? 0L : 2L);
+}
+
+void transfer_set_cancel(void *curl, const volatile int *cancel) {
+    if (!cancel) return;
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_cancel);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)cancel);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+}
+
+static CURL *segment_handle(segment *seg, const char *url, const volatile int *cancel) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return NULL;
+
+    char range[64];
+    snprintf(range, sizeof(range), "%lld-%lld", seg->pos, seg->end);
+
+    seg->checked = 0;
+    seg->status = 0;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, segment_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, seg);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, segment_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, seg);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, seg);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);  // Seguir redirecciones si es necesario
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+    transfer_set_tls(curl, seg->t->insecure);
+    transfer_set_cancel(curl, cancel);
+    return curl;
+}
+
+// Guarda el avance de cada tramo para poder reanudar
+static void save_journal(const char *path, const transfer_result *result, const segment *segs, int count) {
+    char journal[1200], temp[1300];
+    snprintf(journal, sizeof(journal), "%s.journal", path);
+    snprintf(temp, sizeof(temp), "%s.tmp", journal);
+
+    FILE *fp = fopen(temp, "w");
+    if (!fp) return;
+
+    fprintf(fp, "size %lld\n", result->size);
+    fprintf(fp, "etag %s\n", result->etag[0] ? result->etag : "-");
+    fprintf(fp, "modified %s\n", result->last_modified[0] ? result->last_modified : "-");
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "segment %lld %lld %lld\n", segs[i].start, segs[i].end, segs[i].pos);
+    }
+
+    if (fclose(fp) != 0) {
+        remove(temp);
+        return;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    remove(journal);
+#endif
+    rename(temp, journal);
+}
+
+// Carga el avance de un intento anterior si corresponde a la misma versión del archivo
+static int load_journal(const char *path, const transfer_result *result, segment **segs, int *count) {
+    char journal[1200], line[512];
+    snprintf(journal, sizeof(journal), "%s.journal", path);
+
+    FILE *fp = fopen(journal, "r");
+    if (!fp) return 1;
+
+    long long size = -1;
+    char etag[128] = "", modified[64] = "";
+    segment *list = NULL;
+    int n = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "size ", 5) == 0) {
+            size = atoll(line + 5);
+        } else if (strncmp(line, "etag ", 5) == 0) {
+            snprintf(etag, sizeof(etag), "%s", strcmp(line + 5, "-") ? line + 5 : "");
+        } else if (strncmp(line, "modified ", 9) == 0) {
+            snprintf(modified, sizeof(modified), "%s", strcmp(line + 9, "-") ? line + 9 : "");
+        } else if (strncmp(line, "segment ", 8) == 0) {
+            segment *grown = realloc(list, (n + 1) * sizeof(segment));
+            if (!grown) break;
+            list = grown;
+            memset(&list[n], 0, sizeof(segment));
+            if (sscanf(line + 8, "%lld %lld %lld", &list[n].start, &list[n].end, &list[n].pos) == 3) n++;
+        }
+    }
+    fclose(fp);
+
+    // Sin validador no se puede saber si el archivo cambió
+    int same = size == result->size && n > 0 &&
+               (etag[0] || modified[0]) &&
+               strcmp(etag, result->etag) == 0 && strcmp(modified, result->last_modified) == 0;
+
+    struct stat st;
+    if (!same || stat(path, &st) != 0 || (long long)st.st_size != size) {
+        free(list);
+        return 1;
+    }
+
+    *segs = list;
+    *count = n;
+    return 0;
+}
+
+static void remove_journal(const char *path) {
+    char journal[1200];
+    snprintf(journal, sizeof(journal), "%s.journal", path);
+    remove(journal);
+}
+
+// Reparte [from, total) en tramos para las conexiones disponibles
+static segment *plan_segments(long long from, long long total, int connections, int *count) {
+    long long remaining = total - from;
+    int n = (int)((remaining + TRANSFER_MIN_SEGMENT - 1) / TRANSFER_MIN_SEGMENT);
+    if (n > connections) n = connections;
+    if (n < 1) n = 1;
+
+    segment *segs = calloc(n, sizeof(segment));
+    if (!segs) return NULL;
+
+    long long step = remaining / n;
+    for (int i = 0; i < n; i++) {
+        segs[i].start = from + step * i;
+        segs[i].end = (i == n - 1) ? total - 1 : from + step * (i + 1) - 1;
+        segs[i].pos = segs[i].start;
+    }
+
+    *count = n;
+    return segs;
+}
+
+/*
+ * Incorpora al hash lo que ya está en el archivo a continuación de lo hasheado.
+ *
+ * Cuando el tramo que va en orden alcanza el comienzo del siguiente, ese ya
+ * tiene datos escritos: se leen ahora, recién escritos y en la caché de
+ * páginas, en vez de releer todo al final. Desde ahí el siguiente tramo sigue
+ * hasheando a medida que llega.
+ */
+static void advance_hash(transfer *t, const segment *segs, int count) {
+    char buffer[65536];
+    long long budget = HASH_CATCH_UP_MAX;
+
+    while (budget > 0) {
+        long long limit = -1;
+        for (int i = 0; i < count; i++) {
+            if (segs[i].start <= t->hashed && t->hashed < segs[i].pos) {
+                limit = segs[i].pos;
+                break;
+            }
+        }
+        if (limit < 0) return;
+
+        long long want = limit - t->hashed;
+        if (want > (long long)sizeof(buffer)) want = sizeof(buffer);
+        if (want > budget) want = budget;
+
+        long long n = read_at(t->fd, buffer, (size_t)want, t->hashed);
+        if (n <= 0) return;
+        hash_update(t, buffer, (size_t)n);
+        budget -= n;
+    }
+}
+
+// Descarga los tramos pendientes en paralelo con curl_multi
+static int fetch_segments(transfer *t, const transfer_request *req, const char *url,
+                          transfer_result *result, segment *segs, int count) {
+    CURLM *multi = curl_multi_init();
+    if (!multi) return 1;
+
+    int active = 0;
+    for (int i = 0; i < count; i++) {
+        segs[i].t = t;
+        if (segs[i].pos > segs[i].end) continue;
+        segs[i].curl = segment_handle(&segs[i], url, req->cancel);
+        if (!segs[i].curl) {
+            t->failed = 1;
+            break;
+        }
+        curl_multi_add_handle(multi, segs[i].curl);
+        active++;
+    }
+
+    double last_journal = now_ms();
+
+    while (active > 0 && !t->failed) {
+        int running;
+        if (curl_multi_perform(multi, &running) != CURLM_OK) {
+            t->failed = 1;
+            break;
+        }
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            segment *seg;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&seg);
+            CURLcode code = msg->data.result;
+
+            curl_multi_remove_handle(multi, seg->curl);
+            curl_easy_cleanup(seg->curl);
+            seg->curl = NULL;
+            active--;
+
+            if (code == CURLE_OK && seg->status == 206 && seg->pos > seg->end) continue;
+
+            // Tramo cortado: se vuelve a pedir desde donde quedó
+            if (seg->status != 200 && seg->retries++ < SEGMENT_RETRIES && !(req->cancel && *req->cancel)) {
+                seg->curl = segment_handle(seg, url, req->cancel);
+                if (seg->curl) {
+                    curl_multi_add_handle(multi, seg->curl);
+                    active++;
+                    continue;
+                }
+            }
+
+            snprintf(result->error, sizeof(result->error), "segment %lld-%lld failed %ld (%s)",
+                     seg->start, seg->end, seg->status, curl_easy_strerror(code));
+            t->failed = 1;
+        }
+
+        if (req->cancel && *req->cancel) t->failed = 1;
+
+        advance_hash(t, segs, count);
+
+        if (now_ms() - last_journal >= JOURNAL_INTERVAL_MS) {
+            save_journal(req->path, result, segs, count);
+            last_journal = now_ms();
+        }
+
+        if (active > 0 && !t->failed) curl_multi_poll(multi, NULL, 0, 200, NULL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (segs[i].curl) {
+            curl_multi_remove_handle(multi, segs[i].curl);
+            curl_easy_cleanup(segs[i].curl);
+            segs[i].curl = NULL;
+        }
+    }
+    curl_multi_cleanup(multi);
+
+    return t->failed;
+}
+
+// Termina el hash leyendo lo que llegó fuera de orden y todavía no se incorporó
+static int finish_hash(transfer *t, long long total, transfer_result *result) {
+    char buffer[65536];
+
+    while (t->hashed < total) {
+        size_t want = (size_t)((total - t->hashed) < (long long)sizeof(buffer) ? total - t->hashed : (long long)sizeof(buffer));
+        long long n = read_at(t->fd, buffer, want, t->hashed);
+        if (n <= 0) return 1;
+        hash_update(t, buffer, (size_t)n);
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&t->sha, digest);
+    digest_to_hex(digest, sizeof(digest), result->sha256);
+    md5_final(&t->md5, result->md5);
+    return 0;
+}
+
+int transfer_download(const transfer_request *req, transfer_result *result) {
+    memset(result, 0, sizeof(*result));
+
+    transfer t;
+    memset(&t, 0, sizeof(t));
+    sha256_init(&t.sha);
+    md5_init(&t.md5);
+    t.stream = req->stream;
+    t.insecure = req->insecure;
+
+    t.fd = open(req->path, OPEN_FLAGS, 0644);
+    if (t.fd < 0) {
+        snprintf(result->error, sizeof(result->error), "can't write %s: %s", req->path, strerror(errno));
+        if (t.stream) image_stream_finish(t.stream, 0, NULL, NULL);
+        return 1;
+    }
+
+    // Primera petición: condicional y solo por los primeros bytes
+    segment probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.t = &t;
+    probe.end = TRANSFER_PROBE_SIZE - 1;
+
+    probe.curl = segment_handle(&probe, req->url, req->cancel);
+    if (!probe.curl) {
+        if (t.stream) image_stream_finish(t.stream, 0, NULL, NULL);
+        close(t.fd);
+        return 1;
+    }
+
+    struct curl_slist *headers = NULL;
+    char header[256];
+    if (req->etag && *req->etag) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", req->etag);
+        headers = curl_slist_append(headers, header);
+    }
+    if (req->last_modified && *req->last_modified) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", req->last_modified);
+        headers = curl_slist_append(headers, header);
+    }
+    curl_easy_setopt(probe.curl, CURLOPT_HTTPHEADER, headers);
+
+    CURLcode res = curl_easy_perform(probe.curl);
+    curl_easy_getinfo(probe.curl, CURLINFO_RESPONSE_CODE, &result->http_code);
+
+    char effective[2048] = "";
+    char *final_url = NULL;
+    curl_easy_getinfo(probe.curl, CURLINFO_EFFECTIVE_URL, &final_url);
+    if (final_url) snprintf(effective, sizeof(effective), "%s", final_url);
+
+    curl_easy_cleanup(probe.curl);
+    curl_slist_free_all(headers);
+
+    snprintf(result->etag, sizeof(result->etag), "%s", probe.etag);
+    snprintf(result->last_modified, sizeof(result->last_modified), "%s", probe.last_modified);
+
+    if (res == CURLE_OK && result->http_code == 304) {
+        // El llamador publica la copia de la caché
+        result->not_modified = 1;
+        close(t.fd);
+        return 0;
+    }
+
+    // Un tramo inicial cortado no es un error si el servidor soporta rangos:
+    // lo que falta se pide junto con el resto
+    int ranged = result->http_code == 206 && probe.range_total > 0;
+    if (res != CURLE_OK && ranged && res != CURLE_ABORTED_BY_CALLBACK && res != CURLE_WRITE_ERROR) res = CURLE_OK;
+
+    if (res != CURLE_OK || (result->http_code != 200 && result->http_code != 206)) {
+        if (res != CURLE_ABORTED_BY_CALLBACK) {
+            snprintf(result->error, sizeof(result->error), "download error %ld (%s)", result->http_code, curl_easy_strerror(res));
+        }
+        if (t.stream) image_stream_finish(t.stream, 0, NULL, NULL);
+        close(t.fd);
+        return 1;
+    }
+
+    int ret = 0;
+
+    if (probe.full || probe.range_total <= probe.pos) {
+        // Un solo stream: el archivo ya llegó completo
+        result->size = probe.pos;
+        result->segments = 1;
+        if (ftruncate(t.fd, result->size) != 0) ret = 1;
+    } else {
+        // El resto del archivo se pide en tramos, reanudando si hay un journal válido
+        result->size = probe.range_total;
+
+        segment *segs = NULL;
+        int count = 0;
+        if (load_journal(req->path, result, &segs, &count) == 0) {
+            long long first = result->size;
+            for (int i = 0; i < count; i++) {
+                result->resumed += segs[i].pos - segs[i].start;
+                if (segs[i].start < first) first = segs[i].start;
+            }
+
+            // Si esta vez el tramo inicial llegó más corto, cubrir el hueco
+            if (probe.pos < first) {
+                segment *grown = realloc(segs, (count + 1) * sizeof(segment));
+                if (!grown) {
+                    free(segs);
+                    if (t.stream) image_stream_finish(t.stream, 0, NULL, NULL);
+                    close(t.fd);
+                    return 1;
+                }
+                segs = grown;
+                memmove(&segs[1], &segs[0], count * sizeof(segment));
+                memset(&segs[0], 0, sizeof(segment));
+                segs[0].start = segs[0].pos = probe.pos;
+                segs[0].end = first - 1;
+                count++;
+            }
+        } else {
+            int connections = req->connections > 0 ? req->connections : TRANSFER_CONNECTIONS_DEFAULT;
+            segs = plan_segments(probe.pos, result->size, connections, &count);
+            if (!segs || ftruncate(t.fd, result->size) != 0) {
+                free(segs);
+                if (t.stream) image_stream_finish(t.stream, 0, NULL, NULL);
+                close(t.fd);
+                return 1;
+            }
+        }
+
+        // Lo aprovechado de un intento anterior ya está en el archivo
+        if (t.attached) {
+            for (int i = 0; i < count; i++) {
+                long long from = segs[i].start > probe.pos ? segs[i].start : probe.pos;
+                if (segs[i].pos > from) image_stream_publish(t.stream, from, (size_t)(segs[i].pos - from));
+            }
+        }
+
+        result->segments = count + 1;
+        save_journal(req->path, result, segs, count);
+
+        ret = fetch_segments(&t, req, effective[0] ? effective : req->url, result, segs, count);
+
+        save_journal(req->path, result, segs, count);
+        free(segs);
+    }
+
+    if (ret == 0) ret = finish_hash(&t, result->size, result);
+
+    // Con el hash distinto lo recibido no sirve ni para reanudar
+    if (ret == 0 && req->sha256 && *req->sha256 && strcasecmp(req->sha256, result->sha256) != 0) {
+        snprintf(result->error, sizeof(result->error), "checksum mismatch: got sha256 %s, expected %s", result->sha256, req->sha256);
+        result->corrupt = 1;
+        ret = 1;
+    }
+    if (ret == 0 || result->corrupt) remove_journal(req->path);
+
+    // Sin tamaño conocido de antemano la imagen se publica al final
+    if (ret == 0 && t.stream && !t.attached) attach_stream(&t, result->size);
+    if (t.stream) image_stream_finish(t.stream, ret == 0 && t.attached, result->sha256, result->md5);
+
+    close(t.fd);
+    return ret;
+}
@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdint.h>
+
+#include "image_stream.h"
+#include "md5.h"
+
+// Conexiones simultáneas por defecto para descargas por rangos
+#define TRANSFER_CONNECTIONS_DEFAULT    4
+
+// La primera petición pide este tramo; si el archivo entra completo no hacen falta más
+#define TRANSFER_PROBE_SIZE             (256 * 1024)
+
+// Tamaño mínimo de cada segmento adicional
+#define TRANSFER_MIN_SEGMENT            (512 * 1024)
+
+typedef struct {
+    const char         *url;
+    const char         *path;           // destino; con <path>.journal se puede reanudar
+    const char         *etag;           // validadores para la petición condicional (o NULL)
+    const char         *last_modified;
+    int                 connections;
+    const volatile int *cancel;
+    image_stream       *stream;         // si no es NULL, publica lo recibido mientras llega
+    const char         *sha256;         // hash esperado en hex (o NULL para no comprobarlo)
+    int                 insecure;       // 1: no verificar el certificado del servidor
+} transfer_request;
+
+typedef struct {
+    int         not_modified;           // el servidor respondió 304
+    long        http_code;
+    long long   size;
+    char        sha256[65];             // hash del archivo completo
+    uint8_t     md5[MD5_DIGEST_SIZE];   // MD5 del archivo, calculado en la misma pasada
+    int         corrupt;                // el hash no coincide con req->sha256
+    char        etag[128];
+    char        last_modified[64];
+    int         segments;               // conexiones usadas (1 = un solo stream)
+    long long   resumed;                // bytes aprovechados de un intento anterior
+    char        error[256];             // motivo del fallo (vacío si no hay uno que informar)
+} transfer_result;
+
+/**
+ * @brief Hace que una transferencia de curl se aborte cuando *cancel pase a 1.
+ *
+ * @param curl Handle de curl (CURL *).
+ * @param cancel Bandera de cancelación; si es NULL no se hace nada.
+ */
+void transfer_set_cancel(void *curl, const volatile int *cancel);
+
+/**
+ * @brief Activa (o, con insecure, desactiva) la verificación TLS de un handle de curl.
+ */
+void transfer_set_tls(void *curl, int insecure);
+
+/**
+ * @brief Descarga una URL a un archivo usando varias conexiones por rangos.
+ *
+ * La primera petición es condicional y pide solo los primeros bytes: si el
+ * servidor no soporta rangos responde con el archivo completo y la descarga
+ * sigue como un único stream. Si los soporta, el resto se reparte en segmentos
+ * que se piden a la vez con curl_multi y se escriben en su lugar con pwrite.
+ * El avance se guarda en <path>.journal para reanudar tras una interrupción.
+ * Con req->stream los bytes se publican a medida que llegan, salvo en el caso
+ * 304, donde el llamador debe publicar la copia que ya tiene.
+ *
+ * SHA-256 y MD5 se calculan mientras los datos llegan en orden; lo que llega
+ * fuera de orden se incorpora en cuanto el prefijo contiguo lo alcanza, con
+ * las páginas todavía en caché. Si req->sha256 no coincide el stream termina
+ * como fallido, así el flasheo nunca se confirma con una imagen corrupta.
+ *
+ * @return 0 si el archivo quedó completo (o no modificado), 1 si falló.
+ */
+int transfer_download(const transfer_request *req, transfer_result *result);
+
+#endif // TRANSFER_H
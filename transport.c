@@ -0,0 +1,302 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#if defined(__linux__)
+// termios2 está en los headers del kernel, que no conviven con <termios.h>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#else
+#include <termios.h>
+#endif
+#endif
+
+#include "transport.h"
+
+// Las esperas de escritura se cortan en tramos de este largo para atender la cancelación
+#define WRITE_SLICE_MS          100
+
+// Error máximo (en %) entre la velocidad pedida y la que consiguió el adaptador
+#define BAUD_TOLERANCE          3
+
+static int cancelled(const volatile int *cancel) {
+    return cancel && *cancel;
+}
+
+int transport_baud_supported(int baud) {
+#if defined(__linux__)
+    return baud >= TRANSPORT_BAUD_MIN && baud <= TRANSPORT_BAUD_MAX;
+#else
+    return get_baud_rate(baud) != -1;
+#endif
+}
+
+static int set_speed(FD fd, int baud) {
+    if (!transport_baud_supported(baud)) return -1;
+
+#if defined(_WIN32) || defined(_WIN64)
+    DCB dcbSerialParams = {0};
+    dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
+    if (!GetCommState(fd, &dcbSerialParams)) return -1;
+    dcbSerialParams.BaudRate = (DWORD)baud;
+    if (!SetCommState(fd, &dcbSerialParams)) return -1;
+#elif defined(__linux__)
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0) return -1;
+
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = (speed_t)baud;
+    tio.c_ospeed = (speed_t)baud;
+
+    // TCSETSW2: el cambio se aplica después de enviar lo pendiente
+    if (ioctl(fd, TCSETSW2, &tio) != 0) return -1;
+
+    // El driver deja en c_ospeed la velocidad que consiguió realmente
+    if (ioctl(fd, TCGETS2, &tio) != 0) return -1;
+    long error = (long)tio.c_ospeed - baud;
+    if (error < 0) error = -error;
+    if (error * 100 > (long)baud * BAUD_TOLERANCE) return -1;
+#else
+    struct termios options;
+    if (tcgetattr(fd, &options) != 0) return -1;
+
+    speed_t speed = (speed_t)get_baud_rate(baud);
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+
+    tcdrain(fd);
+    if (tcsetattr(fd, TCSANOW, &options) == -1) return -1;
+#endif
+    return 0;
+}
+
+// Sin control de flujo por hardware (RTS maneja el reset y CTS no suele estar
+// cableado) ni traducción de fines de línea. Con VMIN 1 y VTIME 0 poll() avisa
+// con el primer byte, y con O_NONBLOCK read() nunca espera.
+static int set_raw(FD fd) {
+#if defined(__linux__)
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0) return -1;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_iflag &= ~(INLCR | ICRNL | IGNCR | ISTRIP);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    return ioctl(fd, TCSETS2, &tio);
+#else
+    struct termios options;
+    if (tcgetattr(fd, &options) != 0) return -1;
+    options.c_cflag &= ~CRTSCTS;
+    options.c_iflag &= ~(INLCR | ICRNL | IGNCR | ISTRIP);
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+    return tcsetattr(fd, TCSANOW, &options);
+#endif
+}
+
+// ASYNC_LOW_LATENCY: en los FTDI el latency timer pasa de 16 ms a 1 ms
+static void set_low_latency(transport *t) {
+#if defined(__linux__)
+    struct serial_struct serial;
+    if (ioctl(t->fd, TIOCGSERIAL, &serial) != 0) return;
+
+    if (serial.flags & ASYNC_LOW_LATENCY) {
+        t->low_latency = 1;
+        return;
+    }
+
+    int flags = serial.flags;
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(t->fd, TIOCSSERIAL, &serial) == 0) {
+        t->low_latency = 1;
+        t->saved_flags = flags;
+    }
+#else
+    (void)t;
+#endif
+}
+
+static void restore_flags(transport *t) {
+#if defined(__linux__)
+    struct serial_struct serial;
+    if (t->saved_flags < 0 || ioctl(t->fd, TIOCGSERIAL, &serial) != 0) return;
+    serial.flags = t->saved_flags;
+    ioctl(t->fd, TIOCSSERIAL, &serial);
+#else
+    (void)t;
+#endif
+}
+
+int transport_open(transport *t, const char *path) {
+    memset(t, 0, sizeof(*t));
+    t->baud = ESP32_ROM_BAUD;
+    t->saved_flags = -1;
+
+    serial_port_info info;
+    if (find_serial_port(path, &info) == 0) t->adapter = info.type;
+
+#if defined(_WIN32) || defined(_WIN64)
+    t->fd = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (t->fd == INVALID_HANDLE_VALUE) return -1;
+    if (configure_port(t->fd) == -1) {
+        CloseHandle(t->fd);
+        return -1;
+    }
+
+    // Que ReadFile vuelva apenas haya datos, o a los TRANSPORT_READ_SLICE_MS si no llega nada
+    COMMTIMEOUTS timeouts = {0};
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = TRANSPORT_READ_SLICE_MS;
+    SetCommTimeouts(t->fd, &timeouts);
+#else
+    t->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (t->fd == -1) return -1;
+    if (configure_port(t->fd) == -1 || set_raw(t->fd) != 0) {
+        close(t->fd);
+        return -1;
+    }
+    set_low_latency(t);
+#endif
+    return 0;
+}
+
+void transport_close(transport *t) {
+#if defined(_WIN32) || defined(_WIN64)
+    CloseHandle(t->fd);
+#else
+    restore_flags(t);
+    close(t->fd);
+#endif
+    t->tx_len = 0;
+}
+
+int transport_set_baud(transport *t, int baud) {
+    if (set_speed(t->fd, baud) != 0) return -1;
+    t->baud = baud;
+    return 0;
+}
+
+static int write_all(transport *t, const uint8_t *data, size_t len, const volatile int *cancel) {
+#if defined(_WIN32) || defined(_WIN64)
+    (void)cancel;
+    while (len > 0) {
+        DWORD written = 0;
+        if (!WriteFile(t->fd, data, (DWORD)len, &written, NULL)) return -1;
+        data += written;
+        len -= written;
+    }
+#else
+    while (len > 0) {
+        ssize_t n = write(t->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) return -1;
+
+            // Puerto no bloqueante: esperar a que se vacíe el buffer de salida
+            struct pollfd pfd = { .fd = t->fd, .events = POLLOUT };
+            if (poll(&pfd, 1, WRITE_SLICE_MS) < 0 && errno != EINTR) return -1;
+            if (cancelled(cancel)) return -1;
+            continue;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+#endif
+    return 0;
+}
+
+int transport_flush(transport *t, const volatile int *cancel) {
+    if (t->tx_len == 0) return 0;
+
+    // Si la escritura falla, la trama a medias se descarta
+    int ret = write_all(t, t->tx, t->tx_len, cancel);
+    t->tx_len = 0;
+    return ret;
+}
+
+int transport_write(transport *t, const void *data, size_t len, const volatile int *cancel) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len > 0) {
+        size_t n = sizeof(t->tx) - t->tx_len;
+        if (n > len) n = len;
+        memcpy(t->tx + t->tx_len, p, n);
+        t->tx_len += n;
+        p += n;
+        len -= n;
+
+        if (t->tx_len == sizeof(t->tx) && transport_flush(t, cancel) != 0) return -1;
+    }
+    return 0;
+}
+
+int transport_read(transport *t, void *buf, size_t size, int timeout_ms) {
+#if defined(_WIN32) || defined(_WIN64)
+    // ReadFile vuelve en cuanto hay datos o a los TRANSPORT_READ_SLICE_MS (ver transport_open)
+    (void)timeout_ms;
+    DWORD n = 0;
+    if (!ReadFile(t->fd, buf, (DWORD)size, &n, NULL)) return -1;
+    return (int)n;
+#else
+    struct pollfd pfd = { .fd = t->fd, .events = POLLIN };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) return errno == EINTR ? 0 : -1;
+    if (ret == 0) return 0;
+    if (pfd.revents & (POLLERR | POLLNVAL)) return -1;
+
+    ssize_t n = read(t->fd, buf, size);
+    if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+    // Legible pero sin datos y con la línea colgada: el adaptador desapareció
+    if (n == 0) return pfd.revents & POLLHUP ? -1 : 0;
+    return (int)n;
+#endif
+}
+
+void transport_discard_input(transport *t) {
+#if defined(_WIN32) || defined(_WIN64)
+    PurgeComm(t->fd, PURGE_RXCLEAR);
+#elif defined(__linux__)
+    ioctl(t->fd, TCFLSH, TCIFLUSH);
+#else
+    tcflush(t->fd, TCIFLUSH);
+#endif
+}
@@ -0,0 +1,128 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2024 SplinterGU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Credits:
+ * - Developed by SplinterGU
+ * - GitHub: https://github.com/SplinterGU/ESPeccyFlashTool
+ * - This project is a tool for flashing firmware to ESP32 devices.
+ *
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp32_detect.h"
+#include "serial_enum.h"
+
+// Velocidades que acepta termios2 (BOTHER); el adaptador puede no llegar a todas
+#define TRANSPORT_BAUD_MIN          300
+#define TRANSPORT_BAUD_MAX          12000000    // FT232H; los CP2102N llegan a 3 Mbaud
+
+// Buffer de salida: entra cualquier trama SLIP de un bloque de 1 KB con todos los bytes escapados
+#define TRANSPORT_TX_SIZE           4096
+
+// En Windows ReadFile vuelve con lo que haya o a los tantos milisegundos
+#define TRANSPORT_READ_SLICE_MS     50
+
+/*
+ * Puerto serie abierto para hablar con el ESP32 con la menor latencia posible.
+ *
+ * En Linux la velocidad se fija con termios2 (BOTHER), así que vale cualquier
+ * valor entre TRANSPORT_BAUD_MIN y TRANSPORT_BAUD_MAX y no solo las constantes
+ * B*; si el adaptador redondea a otra velocidad, el cambio se rechaza. El
+ * driver queda en ASYNC_LOW_LATENCY, que en los FTDI baja el latency timer de
+ * 16 ms a 1 ms (cada respuesta del ROM esperaba hasta 16 ms en el adaptador).
+ * Las lecturas no bloquean: poll() despierta con el primer byte (VMIN 1,
+ * VTIME 0).
+ *
+ * Lo escrito se junta en tx y transport_flush() lo manda, así cada comando
+ * sale en una sola escritura; el driver lo reparte en paquetes USB.
+ *
+ * Funciona igual sobre un pty (los ioctl que el pty no entiende se ignoran).
+ */
+typedef struct {
+    FD              fd;
+    int             baud;
+    adapter_type    adapter;        // según sysfs (ADAPTER_UNKNOWN si no se sabe)
+    int             low_latency;    // el driver quedó en ASYNC_LOW_LATENCY
+    int             saved_flags;    // flags del driver antes de tocarlos, -1 si no se cambiaron
+
+    uint8_t         tx[TRANSPORT_TX_SIZE];
+    size_t          tx_len;
+} transport;
+
+/**
+ * @brief Abre el puerto en 8N1 binario, no bloqueante, a ESP32_ROM_BAUD.
+ *
+ * @return 0 si se pudo abrir y configurar, -1 si no.
+ */
+int transport_open(transport *t, const char *path);
+
+/**
+ * @brief Devuelve el driver a como estaba y cierra el puerto (lo pendiente en tx se descarta).
+ */
+void transport_close(transport *t);
+
+/**
+ * @brief 1 si la velocidad se puede pedir en este sistema.
+ */
+int transport_baud_supported(int baud);
+
+/**
+ * @brief Cambia la velocidad tras terminar de enviar lo pendiente.
+ *
+ * @return 0 si el puerto quedó a esa velocidad, -1 si no (sin cambios en t->baud).
+ */
+int transport_set_baud(transport *t, int baud);
+
+/**
+ * @brief Agrega datos a la salida; solo se envían si se llena el buffer.
+ *
+ * @param cancel Bandera de cancelación (puede ser NULL).
+ * @return 0, o -1 si falló la escritura o se canceló.
+ */
+int transport_write(transport *t, const void *data, size_t len, const volatile int *cancel);
+
+/**
+ * @brief Envía todo lo pendiente.
+ *
+ * @return 0, o -1 si falló la escritura o se canceló.
+ */
+int transport_flush(transport *t, const volatile int *cancel);
+
+/**
+ * @brief Espera hasta timeout_ms a que lleguen datos y lee los que haya.
+ *
+ * @return Bytes leídos, 0 si no llegó nada a tiempo, -1 si el puerto falló o desapareció.
+ */
+int transport_read(transport *t, void *buf, size_t size, int timeout_ms);
+
+/**
+ * @brief Descarta lo recibido y todavía no leído.
+ */
+void transport_discard_input(transport *t);
+
+#endif // TRANSPORT_H